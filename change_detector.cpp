@@ -0,0 +1,160 @@
+#include "change_detector.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+class OpenCVChangeDetector : public ChangeDetector {
+public:
+    explicit OpenCVChangeDetector(int pixelThreshold) : pixelThreshold(pixelThreshold) {}
+
+    const char* name() const override { return "opencv"; }
+
+    bool hasReference() const override { return !reference.empty(); }
+
+    void setReference(const cv::FrameRef& frame) override {
+        cv::Mat gray = frame.gray();
+        if (gray.empty()) {
+            reference.release();
+            return;
+        }
+        gray.copyTo(reference);
+    }
+
+    int compare(const cv::FrameRef& frame) override {
+        cv::Mat gray = frame.gray();
+        if (gray.empty() || reference.empty() || gray.cols != reference.cols || gray.rows != reference.rows)
+            return -1;
+        cv::absdiff(gray, reference, diff);
+        cv::threshold(diff, thresh, pixelThreshold, 255, cv::THRESH_BINARY);
+        return cv::countNonZero(thresh);
+    }
+
+private:
+    int pixelThreshold;
+    cv::Mat reference;
+    cv::Mat diff, thresh;
+};
+
+// One pass over both planes, no intermediate images, see PlaneChangeCounter.
+class KernelChangeDetector : public ChangeDetector {
+public:
+    KernelChangeDetector(const ChangeDetectorConfig& config, bool scalar) : counter(config, scalar), scalar(scalar) {}
+
+    const char* name() const override { return scalar ? "scalar" : "fused"; }
+
+    bool hasReference() const override { return counter.hasReference(); }
+
+    void setReference(const cv::FrameRef& frame) override {
+        cv::Mat gray = frame.gray();
+        counter.setReference(gray.empty() ? nullptr : gray.data, gray.empty() ? 0 : (int)gray.step[0], gray.cols,
+                             gray.rows);
+    }
+
+    int compare(const cv::FrameRef& frame) override {
+        cv::Mat gray = frame.gray();
+        if (gray.empty())
+            return -1;
+        return counter.compare(gray.data, (int)gray.step[0], gray.cols, gray.rows);
+    }
+
+    std::vector<int> tileCounts() const override { return counter.tileCounts(); }
+
+private:
+    PlaneChangeCounter counter;
+    bool scalar;
+};
+
+// TDL keeps its own copy of the background in ION memory and runs
+// subtract / threshold / connected components on IVE. The CPU only turns
+// the moving regions it reports into per-tile pixel counts, the union of
+// the boxes so overlapping regions are not counted twice.
+class HardwareChangeDetector : public ChangeDetector {
+public:
+    HardwareChangeDetector(const ChangeDetectorConfig& config, cvitdl_handle_t tdlHandle)
+        : config(config), tdlHandle(tdlHandle), tiles((size_t)config.tilesX * config.tilesY, 0) {}
+
+    const char* name() const override { return "hardware"; }
+
+    bool hasReference() const override { return referenceSet; }
+
+    // the background copy is an IVE job of its own, a frame nothing moved in leaves the
+    // old one, for at most BACKGROUND_MAX_AGE frames so slow drift does not build up
+    void setReference(const cv::FrameRef& frame) override {
+        if (referenceSet && lastCount == 0 && backgroundAge < BACKGROUND_MAX_AGE) {
+            backgroundAge++;
+            return;
+        }
+        VIDEO_FRAME_INFO_S* frameInfo = reinterpret_cast<VIDEO_FRAME_INFO_S*>(frame.frame_info());
+        referenceSet = false;
+        if (frameInfo == nullptr)
+            return;
+        CVI_S32 ret = CVI_TDL_Set_MotionDetection_Background(tdlHandle, frameInfo);
+        if (ret != CVI_SUCCESS) {
+            std::cerr << "CVI_TDL_Set_MotionDetection_Background failed with error code: " << ret << std::endl;
+            return;
+        }
+        referenceSet = true;
+        backgroundAge = 0;
+    }
+
+    int compare(const cv::FrameRef& frame) override {
+        VIDEO_FRAME_INFO_S* frameInfo = reinterpret_cast<VIDEO_FRAME_INFO_S*>(frame.frame_info());
+        lastCount = -1;
+        if (frameInfo == nullptr || !referenceSet)
+            return -1;
+        cvtdl_object_t objects = {0};
+        CVI_S32 ret = CVI_TDL_MotionDetection(tdlHandle, frameInfo, &objects, (uint8_t)config.pixelThreshold,
+                                              config.minArea);
+        if (ret != CVI_SUCCESS) {
+            std::cerr << "CVI_TDL_MotionDetection failed with error code: " << ret << std::endl;
+            CVI_TDL_Free(&objects);
+            return -1;
+        }
+        boxes.clear();
+        for (uint32_t i = 0; i < objects.size; i++) {
+            const cvtdl_bbox_t& box = objects.info[i].bbox;
+            boxes.push_back({ box.x1, box.y1, box.x2, box.y2 });
+        }
+        CVI_TDL_Free(&objects);
+        // the regions are bounding boxes, the pixels they cover stand in for the changed ones
+        lastCount = countBoxPixels(boxes, (int)frameInfo->stVFrame.u32Width, (int)frameInfo->stVFrame.u32Height,
+                                   config.tilesX, config.tilesY, tiles.data());
+        return lastCount;
+    }
+
+    std::vector<int> tileCounts() const override { return tiles; }
+
+private:
+    static const int BACKGROUND_MAX_AGE = 8;
+
+    ChangeDetectorConfig config;
+    cvitdl_handle_t tdlHandle;
+    bool referenceSet = false;
+    int lastCount = -1;
+    int backgroundAge = 0;
+    std::vector<ChangeBox> boxes;
+    std::vector<int> tiles;
+};
+
+} // namespace
+
+std::unique_ptr<ChangeDetector> createChangeDetector(ChangeDetectorBackend backend, const ChangeDetectorConfig& config,
+                                                     cvitdl_handle_t tdlHandle) {
+    checkChangeDetectorConfig(backend, config, tdlHandle != nullptr);
+    switch (backend) {
+    case ChangeDetectorBackend::Hardware:
+        return std::unique_ptr<ChangeDetector>(new HardwareChangeDetector(config, tdlHandle));
+    case ChangeDetectorBackend::Fused:
+        return std::unique_ptr<ChangeDetector>(new KernelChangeDetector(config, false));
+    case ChangeDetectorBackend::Scalar:
+        return std::unique_ptr<ChangeDetector>(new KernelChangeDetector(config, true));
+    case ChangeDetectorBackend::OpenCV:
+    default:
+        return std::unique_ptr<ChangeDetector>(new OpenCVChangeDetector(config.pixelThreshold));
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef CHANGE_DETECTOR_H
+#define CHANGE_DETECTOR_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "change_detector_core.h"
+#include "cvi_tdl.h"
+
+// Compares Y frames against a stored reference frame.
+// The frame passed in is only read during the call, backends that need to
+// keep it around copy what they need.
+class ChangeDetector {
+public:
+    virtual ~ChangeDetector() {}
+
+    virtual const char* name() const = 0;
+
+    virtual bool hasReference() const = 0;
+
+    // Replace the reference frame. Backends where that is costly may keep the
+    // old one while the last compare() found nothing changed.
+    virtual void setReference(const cv::FrameRef& frame) = 0;
+
+    // Number of pixels that differ from the reference by more than the threshold,
+    // -1 on failure or when there is no reference yet.
+    virtual int compare(const cv::FrameRef& frame) = 0;
+
+    // Changed pixels per tile from the last compare(), row-major tilesX x tilesY,
+    // empty for backends that only count the whole frame.
+    virtual std::vector<int> tileCounts() const { return std::vector<int>(); }
+};
+
+// tdlHandle is only used by the hardware backend, throws when checkChangeDetectorConfig() does.
+std::unique_ptr<ChangeDetector> createChangeDetector(ChangeDetectorBackend backend, const ChangeDetectorConfig& config,
+                                                     cvitdl_handle_t tdlHandle);
+
+#endif // CHANGE_DETECTOR_H
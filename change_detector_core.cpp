@@ -0,0 +1,123 @@
+#include "change_detector_core.h"
+#include "motion_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+ChangeDetectorBackend parseChangeDetectorBackend(const std::string& name) {
+    if (name == "opencv")
+        return ChangeDetectorBackend::OpenCV;
+    if (name == "hardware")
+        return ChangeDetectorBackend::Hardware;
+    if (name == "fused")
+        return ChangeDetectorBackend::Fused;
+    if (name == "scalar")
+        return ChangeDetectorBackend::Scalar;
+    throw std::runtime_error("Unknown change detector backend: " + name);
+}
+
+void checkChangeDetectorConfig(ChangeDetectorBackend backend, const ChangeDetectorConfig& config, bool hasTdlHandle) {
+    if (config.tilesX < 1 || config.tilesY < 1 || config.step < 1)
+        throw std::runtime_error("Change detector tiles and step must be positive.");
+    // the hardware backend hands it to IVE as a byte
+    if (config.pixelThreshold < 0 || config.pixelThreshold > 255)
+        throw std::runtime_error("Change detector pixel threshold must be 0 to 255.");
+    if (config.minArea < 0)
+        throw std::runtime_error("Change detector minimum area must not be negative.");
+    if (backend == ChangeDetectorBackend::Hardware && !hasTdlHandle)
+        throw std::runtime_error("Hardware change detector needs a TDL handle.");
+}
+
+PlaneChangeCounter::PlaneChangeCounter(const ChangeDetectorConfig& config, bool scalar)
+    : config(config), scalar(scalar), tiles((size_t)config.tilesX * config.tilesY, 0) {}
+
+void PlaneChangeCounter::setReference(const uint8_t* plane, int stride, int planeWidth, int planeHeight) {
+    reference.clear();
+    if (plane == nullptr || planeWidth <= 0 || planeHeight <= 0)
+        return;
+    width = planeWidth;
+    height = planeHeight;
+    reference.resize((size_t)width * height);
+    for (int y = 0; y < height; y++) {
+        const uint8_t* src = plane + (size_t)y * stride;
+        std::copy(src, src + width, reference.begin() + (size_t)y * width);
+    }
+}
+
+int PlaneChangeCounter::compare(const uint8_t* plane, int stride, int planeWidth, int planeHeight) {
+    if (plane == nullptr || reference.empty() || planeWidth != width || planeHeight != height)
+        return -1;
+    if (scalar)
+        return countChangedPixelsScalar(plane, stride, reference.data(), width, width, height, config.pixelThreshold,
+                                        config.step, config.tilesX, config.tilesY, tiles.data());
+    return countChangedPixels(plane, stride, reference.data(), width, width, height, config.pixelThreshold,
+                              config.step, config.tilesX, config.tilesY, tiles.data());
+}
+
+int countBoxPixels(const std::vector<ChangeBox>& boxes, int width, int height, int tilesX, int tilesY,
+                   int* tileCounts) {
+    if (tilesX < 1 || tilesY < 1 || tileCounts == nullptr) {
+        tilesX = 1;
+        tilesY = 1;
+        tileCounts = nullptr;
+    }
+    if (tileCounts != nullptr)
+        memset(tileCounts, 0, sizeof(int) * tilesX * tilesY);
+    if (width <= 0 || height <= 0)
+        return 0;
+
+    // every pixel a box touches, clipped to the frame
+    struct Span {
+        int x0, y0, x1, y1;
+    };
+    std::vector<Span> spans;
+    for (const ChangeBox& box : boxes) {
+        Span span;
+        span.x0 = std::max(0, (int)std::floor(box.x1));
+        span.y0 = std::max(0, (int)std::floor(box.y1));
+        span.x1 = std::min(width, (int)std::ceil(box.x2));
+        span.y1 = std::min(height, (int)std::ceil(box.y2));
+        if (span.x0 < span.x1 && span.y0 < span.y1)
+            spans.push_back(span);
+    }
+
+    // row by row, the boxes crossing it merged into runs so overlaps count once
+    int total = 0;
+    std::vector<std::pair<int, int>> runs;
+    for (int y = 0; y < height; y++) {
+        runs.clear();
+        for (const Span& span : spans) {
+            if (y >= span.y0 && y < span.y1)
+                runs.push_back(std::make_pair(span.x0, span.x1));
+        }
+        if (runs.empty())
+            continue;
+        std::sort(runs.begin(), runs.end());
+        int* tileRow = tileCounts != nullptr ? tileCounts + (y * tilesY / height) * tilesX : nullptr;
+        int start = runs[0].first;
+        int end = runs[0].second;
+        for (size_t i = 1; i <= runs.size(); i++) {
+            if (i < runs.size() && runs[i].first <= end) {
+                end = std::max(end, runs[i].second);
+                continue;
+            }
+            total += end - start;
+            if (tileRow != nullptr) {
+                for (int tx = 0; tx < tilesX; tx++) {
+                    const int x0 = std::max(start, tx * width / tilesX);
+                    const int x1 = std::min(end, (tx + 1) * width / tilesX);
+                    if (x0 < x1)
+                        tileRow[tx] += x1 - x0;
+                }
+            }
+            if (i < runs.size()) {
+                start = runs[i].first;
+                end = runs[i].second;
+            }
+        }
+    }
+    return total;
+}
@@ -0,0 +1,72 @@
+#ifndef CHANGE_DETECTOR_CORE_H
+#define CHANGE_DETECTOR_CORE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The parts of the change detector backends that work on plain planes and
+// boxes, without FrameRefs or the TDL SDK, so they also build on the host.
+
+// Which implementation compares the motion frames, picked once at startup.
+enum class ChangeDetectorBackend {
+    OpenCV,     // absdiff + threshold + countNonZero on the CPU
+    Hardware,   // TDL motion detection, IVE does the work on the VB frames
+    Fused,      // single pass kernel from motion_kernel.h, RVV when built for it
+    Scalar      // plain loops, reference for host runs without OpenCV or the TPU
+};
+
+struct ChangeDetectorConfig {
+    int pixelThreshold = 30;    // per-pixel difference that counts as changed, 0 to 255
+    int minArea = 0;            // hardware only, motion regions below this many pixels are dropped
+    int tilesX = 1;             // all but opencv, grid reported by tileCounts()
+    int tilesY = 1;
+    int step = 1;               // fused and scalar only, compare every step-th row and column
+};
+
+// "opencv", "hardware", "fused" or "scalar", throws on anything else.
+ChangeDetectorBackend parseChangeDetectorBackend(const std::string& name);
+
+// Throws when the backend cannot run with this config, hasTdlHandle says
+// whether the hardware backend was given its handle.
+void checkChangeDetectorConfig(ChangeDetectorBackend backend, const ChangeDetectorConfig& config, bool hasTdlHandle);
+
+// What the fused and scalar backends do with the Y plane of a frame: keep a
+// packed copy of the reference, its buffer reused so steady state does not
+// allocate, and count the changed pixels of the next plane per tile.
+class PlaneChangeCounter {
+public:
+    PlaneChangeCounter(const ChangeDetectorConfig& config, bool scalar);
+
+    bool hasReference() const { return !reference.empty(); }
+
+    // A null plane clears the reference.
+    void setReference(const uint8_t* plane, int stride, int width, int height);
+
+    // Changed pixels against the reference, -1 without one or when the size differs.
+    int compare(const uint8_t* plane, int stride, int width, int height);
+
+    const std::vector<int>& tileCounts() const { return tiles; }
+
+private:
+    ChangeDetectorConfig config;
+    bool scalar;
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> reference;
+    std::vector<int> tiles;
+};
+
+// A moving region as the hardware backend reports it, in pixels of the frame.
+struct ChangeBox {
+    float x1, y1, x2, y2;
+};
+
+// Pixels of a width x height frame inside at least one box, per tile of a
+// tilesX x tilesY grid split like countChangedPixels(). Boxes are clipped to
+// the frame and overlapping ones count once, so the total never exceeds the
+// frame. tileCounts gets tilesX * tilesY entries row-major and may be null.
+int countBoxPixels(const std::vector<ChangeBox>& boxes, int width, int height, int tilesX, int tilesY,
+                   int* tileCounts);
+
+#endif // CHANGE_DETECTOR_CORE_H
@@ -0,0 +1,110 @@
+#include "detection_crops.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+
+bool overlaps(const cv::Rect& a, const cv::Rect& b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+cv::Rect unite(const cv::Rect& a, const cv::Rect& b) {
+    int x1 = std::min(a.x, b.x);
+    int y1 = std::min(a.y, b.y);
+    int x2 = std::max(a.x + a.width, b.x + b.width);
+    int y2 = std::max(a.y + a.height, b.y + b.height);
+    return cv::Rect(x1, y1, x2 - x1, y2 - y1);
+}
+
+// Round outwards to even edges. Two neighbouring regions may then share a
+// column or row of pixels, which does not matter for upload.
+cv::Rect alignEven(const cv::Rect& r, cv::Size frameSize) {
+    int x1 = r.x & ~1;
+    int y1 = r.y & ~1;
+    int x2 = std::min((r.x + r.width + 1) & ~1, frameSize.width & ~1);
+    int y2 = std::min((r.y + r.height + 1) & ~1, frameSize.height & ~1);
+    return cv::Rect(x1, y1, x2 - x1, y2 - y1);
+}
+
+void appendJson(std::string& out, const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int n = std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (n > 0)
+        out.append(buffer, std::min(n, (int)sizeof(buffer) - 1));
+}
+
+} // namespace
+
+std::vector<cv::Rect> mergeDetectionRegions(const std::vector<Detection>& detections, int padding, cv::Size frameSize) {
+    std::vector<cv::Rect> regions;
+    for (const Detection& d : detections) {
+        int x1 = std::max(0, (int)std::floor(d.x1) - padding);
+        int y1 = std::max(0, (int)std::floor(d.y1) - padding);
+        int x2 = std::min(frameSize.width, (int)std::ceil(d.x2) + padding);
+        int y2 = std::min(frameSize.height, (int)std::ceil(d.y2) + padding);
+        if (x2 > x1 && y2 > y1)
+            regions.push_back(cv::Rect(x1, y1, x2 - x1, y2 - y1));
+    }
+    // a merge can make a region reach one it did not touch before, go again until nothing changes
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < regions.size() && !merged; i++) {
+            for (size_t j = i + 1; j < regions.size(); j++) {
+                if (overlaps(regions[i], regions[j])) {
+                    regions[i] = unite(regions[i], regions[j]);
+                    regions.erase(regions.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+    for (cv::Rect& r : regions)
+        r = alignEven(r, frameSize);
+    regions.erase(std::remove_if(regions.begin(), regions.end(), [](const cv::Rect& r) { return r.empty(); }),
+                  regions.end());
+    // top to bottom, left to right, the way the page is read
+    std::sort(regions.begin(), regions.end(), [](const cv::Rect& a, const cv::Rect& b) {
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+    return regions;
+}
+
+std::string describeDetectionCrops(const std::vector<Detection>& detections, const std::vector<cv::Rect>& regions,
+                                   cv::Size frameSize, const std::vector<std::string>& classNames) {
+    std::string json;
+    appendJson(json, "{\"width\":%d,\"height\":%d,\"crops\":[", frameSize.width, frameSize.height);
+    for (size_t i = 0; i < regions.size(); i++) {
+        const cv::Rect& r = regions[i];
+        appendJson(json, "%s{\"file\":\"crop%zu.jpg\",\"x\":%d,\"y\":%d,\"width\":%d,\"height\":%d}",
+                   i ? "," : "", i, r.x, r.y, r.width, r.height);
+    }
+    json += "],\"objects\":[";
+    for (size_t i = 0; i < detections.size(); i++) {
+        const Detection& d = detections[i];
+        // a box sticking out of the frame still belongs to the crop that was cut from it
+        const float cx = std::min((d.x1 + d.x2) / 2, frameSize.width - 1.f);
+        const float cy = std::min((d.y1 + d.y2) / 2, frameSize.height - 1.f);
+        int crop = -1;
+        for (size_t k = 0; k < regions.size(); k++) {
+            const cv::Rect& r = regions[k];
+            if (cx >= r.x && cx < r.x + r.width && cy >= r.y && cy < r.y + r.height) {
+                crop = (int)k;
+                break;
+            }
+        }
+        // class names are our own model labels, nothing in them needs escaping
+        const char* label = d.classId >= 0 && d.classId < (int)classNames.size() ? classNames[d.classId].c_str() : "";
+        appendJson(json, "%s{\"class\":%d,\"label\":\"%s\",\"score\":%.3f,\"x1\":%.1f,\"y1\":%.1f,\"x2\":%.1f,\"y2\":%.1f,\"crop\":%d}",
+                   i ? "," : "", d.classId, label, d.score, d.x1, d.y1, d.x2, d.y2, crop);
+    }
+    json += "]}";
+    return json;
+}
@@ -0,0 +1,28 @@
+#ifndef DETECTION_CROPS_H
+#define DETECTION_CROPS_H
+
+#include <opencv2/core.hpp>
+
+#include <string>
+#include <vector>
+
+// One model detection, already mapped to full frame coordinates.
+struct Detection {
+    float x1, y1, x2, y2;
+    float score;
+    int classId;
+};
+
+// Regions of the frame worth uploading: every detection grown by padding on
+// each side, overlapping ones merged until no two regions overlap, clipped to
+// the frame and aligned to even coordinates so NV21 chroma rows and columns
+// line up with luma.
+std::vector<cv::Rect> mergeDetectionRegions(const std::vector<Detection>& detections, int padding, cv::Size frameSize);
+
+// JSON sidecar for a crops upload. Lists the crops with their position in the
+// frame and every detection with class, score, frame coordinates and the index
+// of the crop holding it. The crop files are named crop<index>.jpg.
+std::string describeDetectionCrops(const std::vector<Detection>& detections, const std::vector<cv::Rect>& regions,
+                                   cv::Size frameSize, const std::vector<std::string>& classNames);
+
+#endif // DETECTION_CROPS_H
@@ -29,6 +29,7 @@
 #endif
 
 #include <dlfcn.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -36,7 +37,9 @@
 #include <unistd.h>
 
 #include <pthread.h>
+#include <semaphore.h>
 #include <sys/prctl.h>
+#include <time.h>
 
 #define SENSOR_GCORE_GC4653
 
@@ -176,6 +179,53 @@ typedef VB_POOL (*PFN_CVI_VB_CreatePool)(VB_POOL_CONFIG_S* pstVbPoolCfg);
 
 typedef CVI_S32 (*PFN_CVI_SYS_VI_Open)();
 typedef CVI_S32 (*PFN_CVI_SYS_VI_Close)();
+
+//added by jj
+typedef enum _MOD_ID_E {
+    CVI_ID_BASE = 0,
+    CVI_ID_VB,
+    CVI_ID_SYS,
+    CVI_ID_RGN,
+    CVI_ID_CHNL,
+    CVI_ID_VDEC,
+    CVI_ID_VPSS,
+    CVI_ID_VENC,
+    CVI_ID_H264E,
+    CVI_ID_JPEGE,
+    CVI_ID_MPEG4E,
+    CVI_ID_H265E,
+    CVI_ID_JPEGD,
+    CVI_ID_VO,
+    CVI_ID_VI,
+    CVI_ID_DIS,
+    CVI_ID_RC,
+    CVI_ID_AIO,
+    CVI_ID_AI,
+    CVI_ID_AO,
+    CVI_ID_AENC,
+    CVI_ID_ADEC,
+    CVI_ID_AUD,
+    CVI_ID_VPU,
+    CVI_ID_ISP,
+    CVI_ID_IVE,
+    CVI_ID_USER,
+    CVI_ID_PROC,
+    CVI_ID_LOG,
+    CVI_ID_H264D,
+    CVI_ID_GDC,
+    CVI_ID_PHOTO,
+    CVI_ID_FB,
+    CVI_ID_BUTT
+} MOD_ID_E;
+
+typedef struct _MMF_CHN_S {
+    MOD_ID_E enModId;
+    CVI_S32 s32DevId;
+    CVI_S32 s32ChnId;
+} MMF_CHN_S;
+
+typedef CVI_S32 (*PFN_CVI_SYS_Bind)(const MMF_CHN_S* pstSrcChn, const MMF_CHN_S* pstDestChn);
+typedef CVI_S32 (*PFN_CVI_SYS_UnBind)(const MMF_CHN_S* pstSrcChn, const MMF_CHN_S* pstDestChn);
 }
 
 static void* libsys_atomic = 0;
@@ -198,6 +248,9 @@ static PFN_CVI_VB_CreatePool CVI_VB_CreatePool = 0;
 static PFN_CVI_SYS_VI_Open CVI_SYS_VI_Open = 0;
 static PFN_CVI_SYS_VI_Close CVI_SYS_VI_Close = 0;
 
+static PFN_CVI_SYS_Bind CVI_SYS_Bind = 0;
+static PFN_CVI_SYS_UnBind CVI_SYS_UnBind = 0;
+
 static int unload_sys_library()
 {
     if (libsys_atomic)
@@ -229,6 +282,9 @@ static int unload_sys_library()
     CVI_SYS_VI_Open = 0;
     CVI_SYS_VI_Close = 0;
 
+    CVI_SYS_Bind = 0;
+    CVI_SYS_UnBind = 0;
+
     return 0;
 }
 
@@ -279,6 +335,9 @@ static int load_sys_library()
     CVI_SYS_VI_Open = (PFN_CVI_SYS_VI_Open)dlsym(libsys, "CVI_SYS_VI_Open");
     CVI_SYS_VI_Close = (PFN_CVI_SYS_VI_Close)dlsym(libsys, "CVI_SYS_VI_Close");
 
+    CVI_SYS_Bind = (PFN_CVI_SYS_Bind)dlsym(libsys, "CVI_SYS_Bind");
+    CVI_SYS_UnBind = (PFN_CVI_SYS_UnBind)dlsym(libsys, "CVI_SYS_UnBind");
+
     return 0;
 
 OUT:
@@ -637,6 +696,19 @@ typedef struct _VI_CHN_ATTR_S {
     CVI_U32 u32BindVbPool; /*chn bind vb*/
 } VI_CHN_ATTR_S;
 
+typedef struct _VI_CHN_STATUS_S {
+    CVI_BOOL bEnable; /* RO;Whether this channel is enabled */
+    CVI_U32 u32FrameRate; /* RO;current frame rate */
+    CVI_U64 u64PrevTime; // latest time (us)
+    CVI_U32 u32FrameNum;  //The number of Frame in one second
+    CVI_U32 u32LostFrame; /* RO;Lost frame count */
+    CVI_U32 u32VbFail; /* RO;Video buffer malloc failure */
+    CVI_U32 u32IntCnt; /* RO;Receive frame int count */
+    CVI_U32 u32RecvPic; /* RO;Receive frame count */
+    CVI_U32 u32TotalMemByte; /* RO;VI buffer malloc failure */
+    SIZE_S stSize; /* RO;chn output size */
+} VI_CHN_STATUS_S;
+
 
 
 typedef enum _VI_CROP_COORDINATE_E {
@@ -730,6 +802,7 @@ typedef CVI_S32 (*PFN_CVI_VI_GetPipeFrame)(VI_PIPE ViPipe, VIDEO_FRAME_INFO_S *p
 typedef CVI_S32 (*PFN_CVI_VI_SetPipeDumpAttr)(VI_PIPE ViPipe, const VI_DUMP_ATTR_S *pstDumpAttr);
 typedef CVI_S32 (*PFN_CVI_VI_ReleaseChnFrame)(VI_PIPE ViPipe, VI_CHN ViChn, const VIDEO_FRAME_INFO_S *pstFrameInfo);
 typedef CVI_S32 (*PFN_CVI_VI_ReleasePipeFrame)(VI_PIPE ViPipe, const VIDEO_FRAME_INFO_S *pstVideoFrame);
+typedef CVI_S32 (*PFN_CVI_VI_QueryChnStatus)(VI_PIPE ViPipe, VI_CHN ViChn, VI_CHN_STATUS_S *pstChnStatus);
 }
 
 extern "C"
@@ -863,6 +936,7 @@ static PFN_CVI_VI_GetPipeFrame CVI_VI_GetPipeFrame = 0;
 static PFN_CVI_VI_SetPipeDumpAttr CVI_VI_SetPipeDumpAttr = 0;
 static PFN_CVI_VI_ReleaseChnFrame CVI_VI_ReleaseChnFrame = 0;
 static PFN_CVI_VI_ReleasePipeFrame CVI_VI_ReleasePipeFrame = 0;
+static PFN_CVI_VI_QueryChnStatus CVI_VI_QueryChnStatus = 0;
 
 static PFN_CVI_VPSS_AttachVbPool CVI_VPSS_AttachVbPool = 0;
 static PFN_CVI_VPSS_CreateGrp CVI_VPSS_CreateGrp = 0;
@@ -950,6 +1024,7 @@ static int unload_vpu_library()
     CVI_VI_SetPipeDumpAttr = 0;
     CVI_VI_ReleaseChnFrame = 0;
     CVI_VI_ReleasePipeFrame = 0;
+    CVI_VI_QueryChnStatus = 0;
 
     CVI_VPSS_AttachVbPool = 0;
     CVI_VPSS_CreateGrp = 0;
@@ -1090,6 +1165,7 @@ static int load_vpu_library()
     CVI_VI_SetPipeDumpAttr = (PFN_CVI_VI_SetPipeDumpAttr)dlsym(libvpu, "CVI_VI_SetPipeDumpAttr");
     CVI_VI_ReleaseChnFrame = (PFN_CVI_VI_ReleaseChnFrame)dlsym(libvpu, "CVI_VI_ReleaseChnFrame");
     CVI_VI_ReleasePipeFrame = (PFN_CVI_VI_ReleasePipeFrame)dlsym(libvpu, "CVI_VI_ReleasePipeFrame");
+    CVI_VI_QueryChnStatus = (PFN_CVI_VI_QueryChnStatus)dlsym(libvpu, "CVI_VI_QueryChnStatus");
 
     CVI_VPSS_AttachVbPool = (PFN_CVI_VPSS_AttachVbPool)dlsym(libvpu, "CVI_VPSS_AttachVbPool");
     CVI_VPSS_CreateGrp = (PFN_CVI_VPSS_CreateGrp)dlsym(libvpu, "CVI_VPSS_CreateGrp");
@@ -2142,6 +2218,85 @@ typedef struct _ISP_STATISTICS_CFG_S {
 #define AF_XOFFSET_MIN (8)
 #define AF_YOFFSET_MIN (2)
 
+//added by jj
+#define AE_ZONE_ROW (30)
+#define AE_ZONE_COLUMN (34)
+#define AWB_ZONE_NUM (AWB_ZONE_ORIG_ROW * AWB_ZONE_ORIG_COLUMN)
+#define AF_ZONE_ROW (15)
+#define AF_ZONE_COLUMN (17)
+#define MAX_HIST_BINS (256)
+#define BAYER_PATTERN_NUM 4
+
+typedef enum _ISP_CHANNEL_LIST_E {
+    ISP_CHANNEL_LE,
+    ISP_CHANNEL_SE,
+    ISP_CHANNEL_MAX_NUM,
+} ISP_CHANNEL_LIST_E;
+
+typedef enum _ISP_BAYER_CHANNEL_E {
+    ISP_BAYER_CHN_R,
+    ISP_BAYER_CHN_GR,
+    ISP_BAYER_CHN_GB,
+    ISP_BAYER_CHN_B,
+    ISP_BAYER_CHN_NUM,
+} ISP_BAYER_CHANNEL_E;
+
+typedef enum _ISP_VD_TYPE_E {
+    ISP_VD_FE_START = 0,
+    ISP_VD_FE_END,
+    ISP_VD_BE_END,
+    ISP_VD_MAX
+} ISP_VD_TYPE_E;
+
+typedef struct _ISP_AE_GRID_INFO_S {
+    CVI_U16 au16GridYPos[AE_ZONE_ROW + 1];
+    CVI_U16 au16GridXPos[AE_ZONE_COLUMN + 1];
+    CVI_U8 u8Status;
+} ISP_AE_GRID_INFO_S;
+
+typedef struct _ISP_AE_STATISTICS_S {
+    CVI_U32 au32FEHist1024Value[ISP_CHANNEL_MAX_NUM][AE_MAX_NUM][MAX_HIST_BINS];
+    CVI_U16 au16FEGlobalAvg[ISP_CHANNEL_MAX_NUM][AE_MAX_NUM][BAYER_PATTERN_NUM];
+    CVI_U16 au16FEZoneAvg[ISP_CHANNEL_MAX_NUM][AE_MAX_NUM][AE_ZONE_ROW][AE_ZONE_COLUMN][BAYER_PATTERN_NUM];
+    CVI_U32 au32BEHist1024Value[MAX_HIST_BINS];
+    CVI_U16 au16BEGlobalAvg[BAYER_PATTERN_NUM];
+    CVI_U16 au16BEZoneAvg[AE_ZONE_ROW][AE_ZONE_COLUMN][BAYER_PATTERN_NUM];
+    ISP_AE_GRID_INFO_S stFEGridInfo;
+} ISP_AE_STATISTICS_S;
+
+typedef struct _ISP_AWB_GRID_INFO_S {
+    CVI_U16 au16GridYPos[AWB_ZONE_ORIG_ROW + 1];
+    CVI_U16 au16GridXPos[AWB_ZONE_ORIG_COLUMN + 1];
+    CVI_U8 u8Status;
+} ISP_AWB_GRID_INFO_S;
+
+typedef struct _ISP_WB_STATISTICS_S {
+    CVI_U16 u16GlobalR; /*RW; Range:[0x0, 0x3FF]*/
+    CVI_U16 u16GlobalG; /*RW; Range:[0x0, 0x3FF]*/
+    CVI_U16 u16GlobalB; /*RW; Range:[0x0, 0x3FF]*/
+    CVI_U16 u16CountAll; /*RW; Range:[0x0, 0xFFFF]*/
+    CVI_U16 au16ZoneAvgR[AWB_ZONE_NUM]; /*RW; Range:[0x0, 0x3FF]*/
+    CVI_U16 au16ZoneAvgG[AWB_ZONE_NUM]; /*RW; Range:[0x0, 0x3FF]*/
+    CVI_U16 au16ZoneAvgB[AWB_ZONE_NUM]; /*RW; Range:[0x0, 0x3FF]*/
+    CVI_U16 au16ZoneCountAll[AWB_ZONE_NUM]; /*RW; Range:[0x0, 0xFFFF]*/
+    ISP_AWB_GRID_INFO_S stGridInfo;
+} ISP_WB_STATISTICS_S;
+
+typedef struct _ISP_FOCUS_ZONE_S {
+    CVI_U16 u16HlCnt;
+    CVI_U64 u64h0;
+    CVI_U64 u64h1;
+    CVI_U32 u32v0;
+} ISP_FOCUS_ZONE_S;
+
+typedef struct _ISP_FE_FOCUS_STATISTICS_S {
+    ISP_FOCUS_ZONE_S stZoneMetrics[AF_ZONE_ROW][AF_ZONE_COLUMN]; /*R; The zoned measure of contrast*/
+} ISP_FE_FOCUS_STATISTICS_S;
+
+typedef struct _ISP_AF_STATISTICS_S {
+    ISP_FE_FOCUS_STATISTICS_S stFEAFStat;
+} ISP_AF_STATISTICS_S;
+
 typedef CVI_S32 (*PFN_CVI_MIPI_SetMipiReset)(CVI_S32 devno, CVI_U32 reset);
 typedef CVI_S32 (*PFN_CVI_MIPI_SetSensorClock)(CVI_S32 devno, CVI_U32 enable);
 typedef CVI_S32 (*PFN_CVI_MIPI_SetSensorReset)(CVI_S32 devno, CVI_U32 reset);
@@ -2160,10 +2315,18 @@ typedef CVI_S32 (*PFN_CVI_ISP_Exit)(VI_PIPE ViPipe);
 
 typedef CVI_S32 (*PFN_CVI_ISP_SetBindAttr)(VI_PIPE ViPipe, const ISP_BIND_ATTR_S *pstBindAttr);
 typedef CVI_S32 (*PFN_CVI_ISP_SetPubAttr)(VI_PIPE ViPipe, const ISP_PUB_ATTR_S *pstPubAttr);
+typedef CVI_S32 (*PFN_CVI_ISP_GetPubAttr)(VI_PIPE ViPipe, ISP_PUB_ATTR_S *pstPubAttr);
 
 typedef CVI_S32 (*PFN_CVI_ISP_SetStatisticsConfig)(VI_PIPE ViPipe, const ISP_STATISTICS_CFG_S *pstStatCfg);
 typedef CVI_S32 (*PFN_CVI_ISP_GetStatisticsConfig)(VI_PIPE ViPipe, ISP_STATISTICS_CFG_S *pstStatCfg);
 
+//added by jj
+typedef CVI_S32 (*PFN_CVI_ISP_GetAEStatistics)(VI_PIPE ViPipe, ISP_AE_STATISTICS_S *pstAeStat);
+typedef CVI_S32 (*PFN_CVI_ISP_GetWBStatistics)(VI_PIPE ViPipe, ISP_WB_STATISTICS_S *pstWBStat);
+typedef CVI_S32 (*PFN_CVI_ISP_GetFocusStatistics)(VI_PIPE ViPipe, ISP_AF_STATISTICS_S *pstAfStat);
+typedef CVI_S32 (*PFN_CVI_ISP_GetVDTimeOut)(VI_PIPE ViPipe, ISP_VD_TYPE_E enIspVDType, CVI_U32 u32MilliSec);
+typedef CVI_S32 (*PFN_CVI_ISP_GetFrameID)(VI_PIPE ViPipe, CVI_U32 *frameID);
+
 }
 
 static void* libae = 0;
@@ -2190,10 +2353,18 @@ static PFN_CVI_ISP_Exit CVI_ISP_Exit = 0;
 
 static PFN_CVI_ISP_SetBindAttr CVI_ISP_SetBindAttr = 0;
 static PFN_CVI_ISP_SetPubAttr CVI_ISP_SetPubAttr = 0;
+static PFN_CVI_ISP_GetPubAttr CVI_ISP_GetPubAttr = 0;
 
 static PFN_CVI_ISP_SetStatisticsConfig CVI_ISP_SetStatisticsConfig = 0;
 static PFN_CVI_ISP_GetStatisticsConfig CVI_ISP_GetStatisticsConfig = 0;
 
+//added by jj
+static PFN_CVI_ISP_GetAEStatistics CVI_ISP_GetAEStatistics = 0;
+static PFN_CVI_ISP_GetWBStatistics CVI_ISP_GetWBStatistics = 0;
+static PFN_CVI_ISP_GetFocusStatistics CVI_ISP_GetFocusStatistics = 0;
+static PFN_CVI_ISP_GetVDTimeOut CVI_ISP_GetVDTimeOut = 0;
+static PFN_CVI_ISP_GetFrameID CVI_ISP_GetFrameID = 0;
+
 
 static int unload_ae_library()
 {
@@ -2347,10 +2518,17 @@ static int unload_isp_library()
 
     CVI_ISP_SetBindAttr = 0;
     CVI_ISP_SetPubAttr = 0;
+    CVI_ISP_GetPubAttr = 0;
 
     CVI_ISP_SetStatisticsConfig = 0;
     CVI_ISP_GetStatisticsConfig = 0;
 
+    CVI_ISP_GetAEStatistics = 0;
+    CVI_ISP_GetWBStatistics = 0;
+    CVI_ISP_GetFocusStatistics = 0;
+    CVI_ISP_GetVDTimeOut = 0;
+    CVI_ISP_GetFrameID = 0;
+
     return 0;
 }
 
@@ -2389,10 +2567,19 @@ static int load_isp_library()
 
     CVI_ISP_SetBindAttr = (PFN_CVI_ISP_SetBindAttr)dlsym(libisp, "CVI_ISP_SetBindAttr");
     CVI_ISP_SetPubAttr = (PFN_CVI_ISP_SetPubAttr)dlsym(libisp, "CVI_ISP_SetPubAttr");
+    CVI_ISP_GetPubAttr = (PFN_CVI_ISP_GetPubAttr)dlsym(libisp, "CVI_ISP_GetPubAttr");
 
     CVI_ISP_SetStatisticsConfig = (PFN_CVI_ISP_SetStatisticsConfig)dlsym(libisp, "CVI_ISP_SetStatisticsConfig");
     CVI_ISP_GetStatisticsConfig = (PFN_CVI_ISP_GetStatisticsConfig)dlsym(libisp, "CVI_ISP_GetStatisticsConfig");
 
+    //added by jj
+    // optional, get_3a_stats() reports them missing
+    CVI_ISP_GetAEStatistics = (PFN_CVI_ISP_GetAEStatistics)dlsym(libisp, "CVI_ISP_GetAEStatistics");
+    CVI_ISP_GetWBStatistics = (PFN_CVI_ISP_GetWBStatistics)dlsym(libisp, "CVI_ISP_GetWBStatistics");
+    CVI_ISP_GetFocusStatistics = (PFN_CVI_ISP_GetFocusStatistics)dlsym(libisp, "CVI_ISP_GetFocusStatistics");
+    CVI_ISP_GetVDTimeOut = (PFN_CVI_ISP_GetVDTimeOut)dlsym(libisp, "CVI_ISP_GetVDTimeOut");
+    CVI_ISP_GetFrameID = (PFN_CVI_ISP_GetFrameID)dlsym(libisp, "CVI_ISP_GetFrameID");
+
     return 0;
 
 OUT:
@@ -2702,26 +2889,167 @@ static void* isp_main(void* arg)
     return NULL;
 }
 
+//added by jj
+static const char* stream_names[CAPTURE_CVI_STREAM_COUNT] = { "bgr", "tdl", "motion", "full" };
+
+static const PIXEL_FORMAT_E stream_pixel_formats[CAPTURE_CVI_STREAM_COUNT] = {
+    PIXEL_FORMAT_BGR_888,
+    PIXEL_FORMAT_RGB_888_PLANAR,
+    PIXEL_FORMAT_YUV_400,
+    PIXEL_FORMAT_NV21
+};
+
+static int get_stream_buffer_size(int stream, int width, int height)
+{
+    const int w = (width + 63) & ~63;
+    const int h = (height + 63) & ~63;
+
+    switch (stream_pixel_formats[stream])
+    {
+    case PIXEL_FORMAT_BGR_888:
+    case PIXEL_FORMAT_RGB_888_PLANAR:
+        return w * h * 3;
+    case PIXEL_FORMAT_YUV_400:
+        return w * h;
+    case PIXEL_FORMAT_NV21:
+        return w * h * 3 / 2;
+    default:
+        return w * h * 3;
+    }
+}
+
+//added by jj
+// blocks in the pool of a vpss chn, the retaining streams get retain_budget more
+static int get_stream_pool_blocks(const capture_cvi_options& options, int stream)
+{
+    return options.chn_vb_count + ((options.retain_streams >> stream) & 1 ? options.retain_budget : 0);
+}
+
+//added by jj
+// the vb blocks are few and live as long as their pools, so every block is mapped
+// once and only has its cpu cache invalidated when a new frame lands in it
+class vb_map_cache
+{
+public:
+    vb_map_cache();
+    ~vb_map_cache();
+
+    // cpu view of [phyaddr, phyaddr + length), 0 on failure
+    // the mapping is pinned until unpin(), a pinned mapping is never unmapped
+    unsigned char* map(unsigned long long phyaddr, int length);
+
+    // a frame is done with the view map() returned
+    void unpin(const void* ptr);
+
+    // mappings kept around unpinned, the block count of all pools is enough
+    void set_capacity(int capacity);
+
+    // unmap everything no frame reads, call before the vb pools are destroyed
+    // a mapping still pinned is unmapped by the unpin() that lets go of it last,
+    // until set_capacity() is called again
+    void clear();
+
+    void get_stats(capture_cvi_stats* stats);
+
+private:
+    struct entry
+    {
+        unsigned long long phyaddr;
+        int length;
+        void* ptr;
+        unsigned int last_use;
+        int pins;           // frames reading through this mapping
+    };
+
+    void evict(size_t i);
+
+    pthread_mutex_t lock;
+    std::vector<entry> entries;
+    size_t capacity;
+    unsigned int tick;
+
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int evictions;
+    unsigned int mapped_bytes;
+};
+
+// until open() knows the block count of its pools
+#define VB_MAP_CACHE_MAX_ENTRIES 32
+
+static vb_map_cache g_vb_map_cache;
+
+//added by jj
+// one read_frames() result waiting in the capture ring
+class capture_cvi_ring_slot
+{
+public:
+    capture_cvi_frame frames[CAPTURE_CVI_STREAM_COUNT];
+    capture_cvi_frame raw_frame;
+};
+
+static void* capture_main(void* arg);
+
 class capture_cvi_impl
 {
 public:
     capture_cvi_impl();
     ~capture_cvi_impl();
 
-    int open(int width = 1920, int height = 1080, float fps = 30);
+    int open(int width, int height, float fps, const capture_cvi_options& options);
 
     int start_streaming();
 
-    int read_frame(unsigned char* bgrdata, bool retain_image_ptr);
+    int read_frame(unsigned char* bgrdata);
+
+    //added by jj
+    int read_frame(capture_cvi_frame* frame, capture_cvi_frame* raw_frame);
+
+    // frames has CAPTURE_CVI_STREAM_COUNT entries, null entries are fetched and dropped
+    // entries of disabled streams are left empty
+    int read_frames(capture_cvi_frame** frames, capture_cvi_frame* raw_frame);
+
+    // read_frames() when vi is bound to vpss, only the vpss outputs are dequeued
+    int read_frames_bound(capture_cvi_frame** frames, capture_cvi_frame* raw_frame);
 
     int stop_streaming();
 
     int close();
 
     //added by jj
-    void* getImagePtr();
-    void* getOriginalImagePtr();
-    void releaseImagePtr(); //will release image_ptr as well as original_image_ptr
+    // overrun accounting from the gap to the previous vi frame
+    // also remembers the pts of the frame so get_3a_stats() can stamp the statistics with it
+    void account_frame(const VIDEO_FRAME_INFO_S* info);
+
+    // pts of the vi frame the isp counted as frame_id, 0 when it was never seen
+    unsigned long long frame_id_pts(unsigned int frame_id);
+
+    int start_capture_thread(int ring_size, int keep_raw);
+
+    int stop_capture_thread();
+
+    int pop_frames(capture_cvi_frame** frames, capture_cvi_frame* raw_frame, int timeout_ms);
+
+    // body of the capture thread
+    void capture_loop();
+
+    // live vpss chn changes, picked up from the next frame on
+    int set_stream_crop(int stream, int x, int y, int width, int height);
+
+    int set_stream_size(int stream, int width, int height);
+
+    int set_mode(int mode);
+
+    int retain(capture_cvi_frame* frame);
+
+    int get_3a_stats(capture_cvi_3a_stats* stats, int timeout_ms);
+
+    // hand back every frame still queued on the vi chn and the vpss chns
+    void drain_frames();
+
+    int pause();
+
+    int resume();
 
 public:
     int crop_width;
@@ -2730,6 +3058,63 @@ public:
     int output_width;
     int output_height;
 
+    //added by jj
+    // requested stream size, kept across close()
+    int stream_config_width[CAPTURE_CVI_STREAM_COUNT];
+    int stream_config_height[CAPTURE_CVI_STREAM_COUNT];
+
+    // resolved at open(), 0 for disabled streams
+    int stream_width[CAPTURE_CVI_STREAM_COUNT];
+    int stream_height[CAPTURE_CVI_STREAM_COUNT];
+
+    // chn pool block size, the upper bound for set_stream_size()
+    int stream_block_size[CAPTURE_CVI_STREAM_COUNT];
+
+    // sensor area each stream is scaled from
+    int stream_crop_x[CAPTURE_CVI_STREAM_COUNT];
+    int stream_crop_y[CAPTURE_CVI_STREAM_COUNT];
+    int stream_crop_width[CAPTURE_CVI_STREAM_COUNT];
+    int stream_crop_height[CAPTURE_CVI_STREAM_COUNT];
+
+    capture_cvi_options options;
+    capture_cvi_stats stats;
+    int mode;
+    unsigned long long frame_interval_us;
+    unsigned long long last_pts;
+
+    //added by jj
+    // pts of the latest vi frames by u32TimeRef, the frame count the isp also reports
+    // written by whoever reads frames, looked up by get_3a_stats() under pts_lock
+    enum { PTS_HISTORY_SIZE = 16 };
+    unsigned int pts_history_ref[PTS_HISTORY_SIZE];
+    unsigned long long pts_history[PTS_HISTORY_SIZE];
+    int pts_history_count;
+    pthread_mutex_t pts_lock;
+
+    // capture thread and its single producer / single consumer ring
+    // ring_head is only written by the producer, ring_tail by the consumer and, under
+    // CAPTURE_CVI_POLICY_LATEST on a full ring, by the producer dropping the oldest slot
+    // ring_lock covers moving a slot and its tail step, ring_sem counts the published
+    // slots so the consumer can wait with a timeout
+    int b_capture_thread_created = 0;
+    int capture_thread_running = 0;
+    int capture_keep_raw = 0;
+    pthread_t capture_thread = 0;
+
+    capture_cvi_ring_slot* ring = 0;
+    int ring_size = 0;
+    unsigned int ring_head = 0;
+    unsigned int ring_tail = 0;
+    unsigned int capture_reads = 0;
+    pthread_mutex_t ring_lock;
+    sem_t ring_sem;
+
+    // pause() stops the pipe and parks the sensor, everything else stays set up
+    // a capture thread running at pause() is restarted by resume()
+    int b_paused = 0;
+    int paused_ring_size = 0;
+    int paused_keep_raw = 0;
+
     // flag
     int b_vb_inited = 0;
     int b_sys_inited = 0;
@@ -2737,9 +3122,11 @@ public:
 
     // vb pool
     int b_vb_pool0_created = 0;
-    int b_vb_pool1_created = 0;
     VB_POOL VbPool0 = VB_INVALID_POOLID;
-    VB_POOL VbPool1 = VB_INVALID_POOLID;
+
+    // one pool per vpss chn
+    int b_vb_pool_chn_created[CAPTURE_CVI_STREAM_COUNT];
+    VB_POOL VbPoolChn[CAPTURE_CVI_STREAM_COUNT];
 
     // sensor
     int b_sensor_set = 0;
@@ -2752,12 +3139,10 @@ public:
     int b_vi_pipe_created = 0;
     int b_vi_pipe_started = 0;
     int b_vi_chn_enabled = 0;
-    int b_vi_frame_got = 0;
 
     VI_DEV ViDev = 0;
     VI_PIPE ViPipe = 0;
     VI_CHN ViChn = 0;
-    VIDEO_FRAME_INFO_S stFrameInfo;
 
     // isp
     int b_isp_ae_registered = 0;
@@ -2769,41 +3154,50 @@ public:
 
     // vpss
     int b_vpss_grp_created = 0;
-    int b_vpss_chn_enabled = 0;
-    int b_vpss_vbpool_attached = 0;
+    // read by a running capture thread, set_mode() switches the full chn under it
+    int b_vpss_chn_enabled[CAPTURE_CVI_STREAM_COUNT];
+    int b_vpss_vbpool_attached[CAPTURE_CVI_STREAM_COUNT];
     int b_vpss_grp_started = 0;
-    int b_vpss_frame_got = 0;
-    int b_vi_pipe_frame_got = 0;
+    int b_vi_vpss_bound = 0;
 
     VPSS_GRP VpssGrp = 0;
     // VPSS_GRP VpssGrp = CVI_VPSS_GetAvailableGrp();
-    VPSS_CHN VpssChn = VPSS_CHN0;
-    VIDEO_FRAME_INFO_S stFrameInfo_bgr;
-
-private:
-    //added by jj
-    void* image_ptr;
-    void* original_image_ptr;
+    // stream i is served by VPSS_CHN i
 };
 
 capture_cvi_impl::capture_cvi_impl()
 {
+    //added by jj
+    pthread_mutex_init(&pts_lock, 0);
+
+    // only the bgr main stream by default, at the open() size
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        stream_config_width[i] = 0;
+        stream_config_height[i] = 0;
+    }
+    stream_config_width[CAPTURE_CVI_STREAM_MAIN] = -1;
+    stream_config_height[CAPTURE_CVI_STREAM_MAIN] = -1;
+
     crop_width = 0;
     crop_height = 0;
 
     output_width = 0;
     output_height = 0;
 
+    options = capture_cvi_options();
+    stats = capture_cvi_stats();
+    mode = CAPTURE_CVI_MODE_STILL;
+    frame_interval_us = 0;
+    last_pts = 0;
+    pts_history_count = 0;
+
     b_vb_inited = 0;
     b_sys_inited = 0;
     b_sys_vi_opened = 0;
 
     b_vb_pool0_created = 0;
-    b_vb_pool1_created = 0;
-    b_vb_pool1_created = 0;
     VbPool0 = VB_INVALID_POOLID;
-    VbPool1 = VB_INVALID_POOLID;
-    VbPool1 = VB_INVALID_POOLID;
 
     b_sensor_set = 0;
 
@@ -2813,7 +3207,6 @@ capture_cvi_impl::capture_cvi_impl()
     b_vi_pipe_created = 0;
     b_vi_pipe_started = 0;
     b_vi_chn_enabled = 0;
-    b_vi_frame_got = 0;
 
     ViDev = 0;
     ViPipe = 0;
@@ -2827,25 +3220,44 @@ capture_cvi_impl::capture_cvi_impl()
     isp_thread = 0;
 
     b_vpss_grp_created = 0;
-    b_vpss_chn_enabled = 0;
-    b_vpss_vbpool_attached = 0;
     b_vpss_grp_started = 0;
-    b_vpss_frame_got = 0;
+    b_vi_vpss_bound = 0;
+
+    b_paused = 0;
+    paused_ring_size = 0;
+    paused_keep_raw = 0;
 
     VpssGrp = 0;
     // VpssGrp = CVI_VPSS_GetAvailableGrp();
-    VpssChn = VPSS_CHN0;
-    //added by jj
-    image_ptr = nullptr;
-    original_image_ptr = nullptr;
+
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        stream_width[i] = 0;
+        stream_height[i] = 0;
+        stream_block_size[i] = 0;
+
+        stream_crop_x[i] = 0;
+        stream_crop_y[i] = 0;
+        stream_crop_width[i] = 0;
+        stream_crop_height[i] = 0;
+
+        b_vb_pool_chn_created[i] = 0;
+        VbPoolChn[i] = VB_INVALID_POOLID;
+
+        b_vpss_chn_enabled[i] = 0;
+        b_vpss_vbpool_attached[i] = 0;
+    }
 }
 
 capture_cvi_impl::~capture_cvi_impl()
 {
     close();
+
+    //added by jj
+    pthread_mutex_destroy(&pts_lock);
 }
 
-int capture_cvi_impl::open(int width, int height, float fps)
+int capture_cvi_impl::open(int width, int height, float fps, const capture_cvi_options& _options)
 {
     const CVI_U16 cap_width = get_sensor_cfg()->cap_width;
     const CVI_U16 cap_height = get_sensor_cfg()->cap_height;
@@ -2926,7 +3338,96 @@ int capture_cvi_impl::open(int width, int height, float fps)
 #define ALIGN(x, a)      (((x) + ((a)-1)) & ~((a)-1))
 
     int yuv_buffer_size = ALIGN(cap_width, 64) * ALIGN(cap_height, 64) * 3 / 2;
-    int bgr_buffer_size = ALIGN(output_width, 64) * ALIGN(output_height, 64) * 3;
+
+    //added by jj
+    // buffering
+    {
+        // nothing dequeues a vi chn bound to vpss unless the raw frame is asked for, it may queue none
+        const int min_vi_depth = _options.bind_vpss ? 0 : 1;
+        if (_options.vb_count < 1 || _options.chn_vb_count < 1 || _options.vi_depth < min_vi_depth || _options.vpss_depth < 1
+            || _options.policy < CAPTURE_CVI_POLICY_FIFO || _options.policy > CAPTURE_CVI_POLICY_QUEUE)
+        {
+            fprintf(stderr, "invalid capture options vb %d chn vb %d vi depth %d vpss depth %d policy %d\n",
+                    _options.vb_count, _options.chn_vb_count, _options.vi_depth, _options.vpss_depth, _options.policy);
+            return -1;
+        }
+
+        // one more block than the queue holds, so vi always has somewhere to write
+        if (_options.vb_count <= _options.vi_depth)
+        {
+            fprintf(stderr, "vb_count %d <= vi_depth %d, vi will stall\n", _options.vb_count, _options.vi_depth);
+        }
+
+        if (_options.chn_vb_count <= _options.vpss_depth)
+        {
+            fprintf(stderr, "chn_vb_count %d <= vpss_depth %d, vpss will stall\n", _options.chn_vb_count, _options.vpss_depth);
+        }
+
+        if (_options.retain_budget < 0)
+        {
+            fprintf(stderr, "invalid retain_budget %d\n", _options.retain_budget);
+            return -1;
+        }
+
+        options = _options;
+
+        // a libsys without the bind api keeps the SendFrame round trip
+        if (options.bind_vpss && (!CVI_SYS_Bind || !CVI_SYS_UnBind))
+        {
+            fprintf(stderr, "CVI_SYS_Bind not available, vpss is fed from user space\n");
+            options.bind_vpss = 0;
+
+            if (options.vi_depth < 1)
+                options.vi_depth = 1;
+        }
+
+        stats = capture_cvi_stats();
+        mode = CAPTURE_CVI_MODE_STILL;
+        frame_interval_us = cap_fps > 0.f ? (unsigned long long)(1000000 / cap_fps) : 0;
+        last_pts = 0;
+        pts_history_count = 0;
+    }
+
+    //added by jj
+    // resolve stream sizes
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        int w = stream_config_width[i];
+        int h = stream_config_height[i];
+
+        if (w == -1 || h == -1)
+        {
+            if (i == CAPTURE_CVI_STREAM_MAIN)
+            {
+                w = output_width;
+                h = output_height;
+            }
+            if (i == CAPTURE_CVI_STREAM_TDL)
+            {
+                w = 320;
+                h = 320;
+            }
+            if (i == CAPTURE_CVI_STREAM_MOTION)
+            {
+                w = 160;
+                h = ALIGN(160 * cap_height / cap_width, 2);
+            }
+            if (i == CAPTURE_CVI_STREAM_FULL)
+            {
+                w = cap_width;
+                h = cap_height;
+            }
+        }
+
+        if (w > cap_width || h > cap_height || (w != 0 && (w < 8 || h < 8)))
+        {
+            fprintf(stderr, "invalid %s stream size %d x %d\n", stream_names[i], w, h);
+            return -1;
+        }
+
+        stream_width[i] = w;
+        stream_height[i] = h;
+    }
 
     int ret_val = 0;
 
@@ -2935,7 +3436,7 @@ int capture_cvi_impl::open(int width, int height, float fps)
         VB_CONFIG_S stVbConfig;
         stVbConfig.u32MaxPoolCnt = 1;
         stVbConfig.astCommPool[0].u32BlkSize = yuv_buffer_size;
-        stVbConfig.astCommPool[0].u32BlkCnt = 4;
+        stVbConfig.astCommPool[0].u32BlkCnt = options.vb_count;
         stVbConfig.astCommPool[0].enRemapMode = VB_REMAP_MODE_NONE;
         snprintf(stVbConfig.astCommPool[0].acName, MAX_VB_POOL_NAME_LEN, "cv-capture-comm0");
 
@@ -3005,24 +3506,45 @@ int capture_cvi_impl::open(int width, int height, float fps)
     //         b_vb_pool0_created = 1;
     //     }
 
-        // create vb pool1
+        //added by jj
+        // create one vb pool per enabled vpss chn
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
         {
+            if (stream_width[i] == 0)
+                continue;
+
+            stream_block_size[i] = get_stream_buffer_size(i, stream_width[i], stream_height[i]);
+
             VB_POOL_CONFIG_S stVbPoolCfg;
-            stVbPoolCfg.u32BlkSize = bgr_buffer_size;
-            stVbPoolCfg.u32BlkCnt = 1;
+            stVbPoolCfg.u32BlkSize = stream_block_size[i];
+            stVbPoolCfg.u32BlkCnt = get_stream_pool_blocks(options, i);
             stVbPoolCfg.enRemapMode = VB_REMAP_MODE_NONE;
-            snprintf(stVbPoolCfg.acName, MAX_VB_POOL_NAME_LEN, "cv-capture-bgr");
+            snprintf(stVbPoolCfg.acName, MAX_VB_POOL_NAME_LEN, "cv-capture-%s", stream_names[i]);
 
-            VbPool1 = CVI_VB_CreatePool(&stVbPoolCfg);
-            if (VbPool1 == VB_INVALID_POOLID)
+            VbPoolChn[i] = CVI_VB_CreatePool(&stVbPoolCfg);
+            if (VbPoolChn[i] == VB_INVALID_POOLID)
             {
-                fprintf(stderr, "CVI_VB_CreatePool VbPool1 failed %x\n", VbPool1);
+                fprintf(stderr, "CVI_VB_CreatePool %s failed %x\n", stream_names[i], VbPoolChn[i]);
                 ret_val = -1;
                 goto OUT;
             }
 
-            b_vb_pool1_created = 1;
+            b_vb_pool_chn_created[i] = 1;
+        }
+
+        stats.ion_bytes = yuv_buffer_size * options.vb_count;
+        int block_count = options.vb_count;
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+        {
+            if (b_vb_pool_chn_created[i])
+            {
+                stats.ion_bytes += stream_block_size[i] * get_stream_pool_blocks(options, i);
+                block_count += get_stream_pool_blocks(options, i);
+            }
         }
+
+        // one mapping per block, nothing is ever evicted in steady state
+        g_vb_map_cache.set_capacity(block_count);
     }
 
     // prepare sensor
@@ -3532,7 +4054,7 @@ int capture_cvi_impl::open(int width, int height, float fps)
         stChnAttr.enCompressMode = COMPRESS_MODE_NONE;
         stChnAttr.bMirror = CVI_FALSE;
         stChnAttr.bFlip = CVI_FALSE;
-        stChnAttr.u32Depth = 1;
+        stChnAttr.u32Depth = options.vi_depth;
         stChnAttr.stFrameRate.s32SrcFrameRate = -1;
         stChnAttr.stFrameRate.s32DstFrameRate = -1;
         stChnAttr.u32BindVbPool = -1;// FIXME
@@ -3569,86 +4091,117 @@ int capture_cvi_impl::open(int width, int height, float fps)
             b_vpss_grp_created = 1;
         }
 
-        if (crop_width != cap_width || crop_height != cap_height)
+        //added by jj
+        // one chn per enabled stream, all fed from the same vi frame
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
         {
-            VPSS_CROP_INFO_S stCropInfo;
-            stCropInfo.bEnable = CVI_TRUE;
-            stCropInfo.enCropCoordinate = VPSS_CROP_ABS_COOR;
-            stCropInfo.stCropRect.s32X = (cap_width - crop_width) / 2;
-            stCropInfo.stCropRect.s32Y = (cap_height - crop_height) / 2;
-            stCropInfo.stCropRect.u32Width = crop_width;
-            stCropInfo.stCropRect.u32Height = crop_height;
+            if (stream_width[i] == 0)
+                continue;
 
-            CVI_S32 ret = CVI_VPSS_SetChnCrop(VpssGrp, VpssChn, &stCropInfo);
-            if (ret != CVI_SUCCESS)
+            const VPSS_CHN VpssChn = i;
+            const int chn_width = stream_width[i];
+            const int chn_height = stream_height[i];
+
+            stream_crop_x[i] = 0;
+            stream_crop_y[i] = 0;
+            stream_crop_width[i] = cap_width;
+            stream_crop_height[i] = cap_height;
+
+            // the main stream keeps the open() aspect ratio by center cropping
+            if (i == CAPTURE_CVI_STREAM_MAIN && (crop_width != cap_width || crop_height != cap_height))
             {
-                fprintf(stderr, "CVI_VPSS_SetChnCrop failed %x\n", ret);
-                ret_val = -1;
-                goto OUT;
+                VPSS_CROP_INFO_S stCropInfo;
+                stCropInfo.bEnable = CVI_TRUE;
+                stCropInfo.enCropCoordinate = VPSS_CROP_ABS_COOR;
+                stCropInfo.stCropRect.s32X = (cap_width - crop_width) / 2;
+                stCropInfo.stCropRect.s32Y = (cap_height - crop_height) / 2;
+                stCropInfo.stCropRect.u32Width = crop_width;
+                stCropInfo.stCropRect.u32Height = crop_height;
+
+                CVI_S32 ret = CVI_VPSS_SetChnCrop(VpssGrp, VpssChn, &stCropInfo);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_SetChnCrop failed %x\n", ret);
+                    ret_val = -1;
+                    goto OUT;
+                }
+
+                stream_crop_x[i] = stCropInfo.stCropRect.s32X;
+                stream_crop_y[i] = stCropInfo.stCropRect.s32Y;
+                stream_crop_width[i] = crop_width;
+                stream_crop_height[i] = crop_height;
             }
-        }
 
-        // vpss set chn attr
-        {
-            VPSS_CHN_ATTR_S stChnAttr;
-            stChnAttr.u32Width = output_width;
-            stChnAttr.u32Height = output_height;
-            stChnAttr.enVideoFormat = VIDEO_FORMAT_LINEAR;
-            stChnAttr.enPixelFormat = PIXEL_FORMAT_BGR_888;
-            stChnAttr.stFrameRate.s32SrcFrameRate = -1;
-            stChnAttr.stFrameRate.s32DstFrameRate = -1;
-            stChnAttr.bMirror = CVI_FALSE;
-            stChnAttr.bFlip = CVI_FALSE;
-            stChnAttr.u32Depth = 1;
-            stChnAttr.stAspectRatio.enMode = ASPECT_RATIO_NONE;
-            stChnAttr.stAspectRatio.bEnableBgColor = CVI_FALSE;
-            stChnAttr.stAspectRatio.u32BgColor = 0;
-            stChnAttr.stAspectRatio.stVideoRect.s32X = 0;
-            stChnAttr.stAspectRatio.stVideoRect.s32Y = 0;
-            stChnAttr.stAspectRatio.stVideoRect.u32Width = output_width;
-            stChnAttr.stAspectRatio.stVideoRect.u32Height = output_height;
-            stChnAttr.stNormalize.bEnable = CVI_FALSE;
-            stChnAttr.stNormalize.factor[0] = 0.f;
-            stChnAttr.stNormalize.factor[1] = 0.f;
-            stChnAttr.stNormalize.factor[2] = 0.f;
-            stChnAttr.stNormalize.mean[0] = 0.f;
-            stChnAttr.stNormalize.mean[1] = 0.f;
-            stChnAttr.stNormalize.mean[2] = 0.f;
-            stChnAttr.stNormalize.rounding = VPSS_ROUNDING_TO_EVEN;
-
-            CVI_S32 ret = CVI_VPSS_SetChnAttr(VpssGrp, VpssChn, &stChnAttr);
-            if (ret != CVI_SUCCESS)
+            // vpss set chn attr
             {
-                fprintf(stderr, "CVI_VPSS_SetChnAttr failed %x\n", ret);
-                ret_val = -1;
-                goto OUT;
+                VPSS_CHN_ATTR_S stChnAttr;
+                stChnAttr.u32Width = chn_width;
+                stChnAttr.u32Height = chn_height;
+                stChnAttr.enVideoFormat = VIDEO_FORMAT_LINEAR;
+                stChnAttr.enPixelFormat = stream_pixel_formats[i];
+                stChnAttr.stFrameRate.s32SrcFrameRate = -1;
+                stChnAttr.stFrameRate.s32DstFrameRate = -1;
+                stChnAttr.bMirror = CVI_FALSE;
+                stChnAttr.bFlip = CVI_FALSE;
+                stChnAttr.u32Depth = options.vpss_depth;
+                stChnAttr.stAspectRatio.enMode = ASPECT_RATIO_NONE;
+                stChnAttr.stAspectRatio.bEnableBgColor = CVI_FALSE;
+                stChnAttr.stAspectRatio.u32BgColor = 0;
+                stChnAttr.stAspectRatio.stVideoRect.s32X = 0;
+                stChnAttr.stAspectRatio.stVideoRect.s32Y = 0;
+                stChnAttr.stAspectRatio.stVideoRect.u32Width = chn_width;
+                stChnAttr.stAspectRatio.stVideoRect.u32Height = chn_height;
+                stChnAttr.stNormalize.bEnable = CVI_FALSE;
+                stChnAttr.stNormalize.factor[0] = 0.f;
+                stChnAttr.stNormalize.factor[1] = 0.f;
+                stChnAttr.stNormalize.factor[2] = 0.f;
+                stChnAttr.stNormalize.mean[0] = 0.f;
+                stChnAttr.stNormalize.mean[1] = 0.f;
+                stChnAttr.stNormalize.mean[2] = 0.f;
+                stChnAttr.stNormalize.rounding = VPSS_ROUNDING_TO_EVEN;
+
+                if (i == CAPTURE_CVI_STREAM_TDL)
+                {
+                    // letterbox the whole sensor view into the model input, black bars
+                    stChnAttr.stAspectRatio.enMode = ASPECT_RATIO_AUTO;
+                    stChnAttr.stAspectRatio.bEnableBgColor = CVI_TRUE;
+                    stChnAttr.stAspectRatio.u32BgColor = 0x000000;
+                }
+
+                CVI_S32 ret = CVI_VPSS_SetChnAttr(VpssGrp, VpssChn, &stChnAttr);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_SetChnAttr %s failed %x\n", stream_names[i], ret);
+                    ret_val = -1;
+                    goto OUT;
+                }
             }
-        }
 
-        // vpss enable chn
-        {
-            CVI_S32 ret = CVI_VPSS_EnableChn(VpssGrp, VpssChn);
-            if (ret != CVI_SUCCESS)
+            // vpss enable chn
             {
-                fprintf(stderr, "CVI_VPSS_EnableChn failed %x\n", ret);
-                ret_val = -1;
-                goto OUT;
-            }
+                CVI_S32 ret = CVI_VPSS_EnableChn(VpssGrp, VpssChn);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_EnableChn %s failed %x\n", stream_names[i], ret);
+                    ret_val = -1;
+                    goto OUT;
+                }
 
-            b_vpss_chn_enabled = 1;
-        }
+                b_vpss_chn_enabled[i] = 1;
+            }
 
-        // vpss attach vb pool
-        {
-            CVI_S32 ret = CVI_VPSS_AttachVbPool(VpssGrp, VpssChn, VbPool1);
-            if (ret != CVI_SUCCESS)
+            // vpss attach vb pool
             {
-                fprintf(stderr, "CVI_VPSS_AttachVbPool failed %x\n", ret);
-                ret_val = -1;
-                goto OUT;
-            }
+                CVI_S32 ret = CVI_VPSS_AttachVbPool(VpssGrp, VpssChn, VbPoolChn[i]);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_AttachVbPool %s failed %x\n", stream_names[i], ret);
+                    ret_val = -1;
+                    goto OUT;
+                }
 
-            b_vpss_vbpool_attached = 1;
+                b_vpss_vbpool_attached[i] = 1;
+            }
         }
     }
 
@@ -3714,6 +4267,31 @@ int capture_cvi_impl::start_streaming()
         b_vpss_grp_started = 1;
     }
 
+    //added by jj
+    // let the hardware push every vi frame into the vpss grp
+    if (options.bind_vpss)
+    {
+        MMF_CHN_S stSrcChn;
+        stSrcChn.enModId = CVI_ID_VI;
+        stSrcChn.s32DevId = ViPipe;
+        stSrcChn.s32ChnId = ViChn;
+
+        MMF_CHN_S stDestChn;
+        stDestChn.enModId = CVI_ID_VPSS;
+        stDestChn.s32DevId = VpssGrp;
+        stDestChn.s32ChnId = 0;
+
+        CVI_S32 ret = CVI_SYS_Bind(&stSrcChn, &stDestChn);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_SYS_Bind failed %x\n", ret);
+            ret_val = -1;
+            goto OUT;
+        }
+
+        b_vi_vpss_bound = 1;
+    }
+
     return 0;
 
 OUT:
@@ -3721,80 +4299,667 @@ OUT:
     return ret_val;
 }
 
-//modified by jj
-int capture_cvi_impl::read_frame(unsigned char* bgrdata, bool retain_image_ptr)
+//added by jj
+static void setup_frame(capture_cvi_frame* frame, VIDEO_FRAME_INFO_S* info, int source, int dev, int chn)
 {
-    int ret_val = 0;
+    const VIDEO_FRAME_S& vf = info->stVFrame;
+
+    frame->width = vf.u32Width;
+    frame->height = vf.u32Height;
+    frame->pixel_format = vf.enPixelFormat;
+    frame->pts = vf.u64PTS;
+
+    for (int i = 0; i < 3; i++)
+    {
+        frame->stride[i] = vf.u32Stride[i];
+        frame->length[i] = vf.u32Length[i];
+        frame->phyaddr[i] = vf.u64PhyAddr[i];
+        frame->viraddr[i] = 0;
+        frame->plane_width[i] = 0;
+        frame->plane_height[i] = 0;
+        frame->plane_elemsize[i] = 1;
+        frame->plane_offset[i] = 0;
+    }
+
+    const int w = vf.u32Width;
+    const int h = vf.u32Height;
+    const int top = vf.s16OffsetTop;
+    const int left = vf.s16OffsetLeft;
+
+    switch (vf.enPixelFormat)
+    {
+    case PIXEL_FORMAT_RGB_888:
+    case PIXEL_FORMAT_BGR_888:
+        frame->plane_count = 1;
+        frame->plane_width[0] = w;
+        frame->plane_height[0] = h;
+        frame->plane_elemsize[0] = 3;
+        break;
+    case PIXEL_FORMAT_RGB_888_PLANAR:
+    case PIXEL_FORMAT_BGR_888_PLANAR:
+        frame->plane_count = 3;
+        for (int i = 0; i < 3; i++)
+        {
+            frame->plane_width[i] = w;
+            frame->plane_height[i] = h;
+        }
+        break;
+    case PIXEL_FORMAT_YUV_PLANAR_420:
+        frame->plane_count = 3;
+        frame->plane_width[0] = w;
+        frame->plane_height[0] = h;
+        frame->plane_width[1] = frame->plane_width[2] = w / 2;
+        frame->plane_height[1] = frame->plane_height[2] = h / 2;
+        break;
+    case PIXEL_FORMAT_NV12:
+    case PIXEL_FORMAT_NV21:
+        // interleaved uv, one element is a uv pair
+        frame->plane_count = 2;
+        frame->plane_width[0] = w;
+        frame->plane_height[0] = h;
+        frame->plane_width[1] = w / 2;
+        frame->plane_height[1] = h / 2;
+        frame->plane_elemsize[1] = 2;
+        break;
+    default:
+        // YUV_400 and anything we do not know the layout of, expose the first plane only
+        frame->plane_count = 1;
+        frame->plane_width[0] = w;
+        frame->plane_height[0] = h;
+        break;
+    }
+
+    for (int i = 0; i < frame->plane_count; i++)
+    {
+        const int subsampled = frame->plane_width[i] != w;
+        const int plane_top = subsampled ? top / 2 : top;
+        const int plane_left = subsampled ? left / 2 : left;
+        frame->plane_offset[i] = plane_top * frame->stride[i] + plane_left * frame->plane_elemsize[i];
+    }
+
+    frame->frame_info = info;
+    frame->source = source;
+    frame->dev = dev;
+    frame->chn = chn;
+}
 
-    // vi get frame
+
+vb_map_cache::vb_map_cache()
+{
+    pthread_mutex_init(&lock, 0);
+    capacity = VB_MAP_CACHE_MAX_ENTRIES;
+    tick = 0;
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+    mapped_bytes = 0;
+}
+
+vb_map_cache::~vb_map_cache()
+{
+    // mappings die with the process, the sys library may already be gone here
+    pthread_mutex_destroy(&lock);
+}
+
+unsigned char* vb_map_cache::map(unsigned long long phyaddr, int length)
+{
+    pthread_mutex_lock(&lock);
+
+    tick++;
+
+    entry* e = 0;
+    for (size_t i = 0; i < entries.size(); i++)
     {
-        CVI_S32 ret = CVI_VI_GetChnFrame(ViPipe, ViChn, &stFrameInfo, 2000);
-        if (ret != CVI_SUCCESS)
+        if (entries[i].phyaddr != phyaddr)
+            continue;
+
+        if (entries[i].length >= length)
         {
-            fprintf(stderr, "CVI_VI_GetChnFrame failed %x\n", ret);
-            ret_val = -1;
-            goto OUT;
+            e = &entries[i];
+            break;
         }
-        b_vi_frame_got = 1;
-        if (retain_image_ptr)
+
+        // same block seen through a larger frame, map it again
+        // a frame still reading the smaller view keeps it until it lets go
+        if (entries[i].pins == 0)
         {
-            original_image_ptr = new VIDEO_FRAME_INFO_S;
-            memcpy(original_image_ptr, &stFrameInfo, sizeof(VIDEO_FRAME_INFO_S));
-        } 
+            evict(i);
+            i--;
+        }
     }
 
-    if (0)
+    if (e)
     {
-        // dump
-        VIDEO_FRAME_S& vf = stFrameInfo.stVFrame;
-        fprintf(stderr, "vf u32Width = %u\n", vf.u32Width);
-        fprintf(stderr, "vf u32Height = %u\n", vf.u32Height);
-        fprintf(stderr, "vf enPixelFormat = %d\n", vf.enPixelFormat);
-        fprintf(stderr, "vf enBayerFormat = %d\n", vf.enBayerFormat);
-        fprintf(stderr, "vf enVideoFormat = %d\n", vf.enVideoFormat);
-        fprintf(stderr, "vf enColorGamut = %d\n", vf.enColorGamut);
-        fprintf(stderr, "vf u32Stride = %u %u %u\n", vf.u32Stride[0], vf.u32Stride[1], vf.u32Stride[2]);
-        fprintf(stderr, "vf u64PhyAddr = %lu %lu %lu\n", vf.u64PhyAddr[0], vf.u64PhyAddr[1], vf.u64PhyAddr[2]);
-        fprintf(stderr, "vf pu8VirAddr = %p %p %p\n", vf.pu8VirAddr[0], vf.pu8VirAddr[1], vf.pu8VirAddr[2]);
-        fprintf(stderr, "vf u32Length = %u %u %u\n", vf.u32Length[0], vf.u32Length[1], vf.u32Length[2]);
-        fprintf(stderr, "vf s16OffsetTop = %d\n", vf.s16OffsetTop);
-        fprintf(stderr, "vf s16OffsetBottom = %d\n", vf.s16OffsetBottom);
-        fprintf(stderr, "vf s16OffsetLeft = %d\n", vf.s16OffsetLeft);
-        fprintf(stderr, "vf s16OffsetRight = %d\n", vf.s16OffsetRight);
-        fprintf(stderr, "vf u32TimeRef = %u\n", vf.u32TimeRef);
-        fprintf(stderr, "vf u64PTS = %lu\n", vf.u64PTS);
-        fprintf(stderr, "vf pPrivateData = %p\n", vf.pPrivateData);
-        fprintf(stderr, "vf u32FrameFlag = %u\n", vf.u32FrameFlag);
+        hits++;
     }
+    else
+    {
+        if (entries.size() >= capacity)
+        {
+            // drop the least recently used mapping no frame is reading
+            size_t lru = entries.size();
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                if (entries[i].pins == 0 && (lru == entries.size() || entries[i].last_use < entries[lru].last_use))
+                    lru = i;
+            }
 
-    // vpss send frame
+            // all pinned, go over the capacity until frames are released
+            if (lru < entries.size())
+            {
+                evict(lru);
+                evictions++;
+            }
+        }
+
+        void* ptr = CVI_SYS_MmapCache(phyaddr, length);
+        if (!ptr)
+        {
+            fprintf(stderr, "CVI_SYS_MmapCache failed\n");
+            pthread_mutex_unlock(&lock);
+            return 0;
+        }
+
+        entry ne;
+        ne.phyaddr = phyaddr;
+        ne.length = length;
+        ne.ptr = ptr;
+        ne.last_use = 0;
+        ne.pins = 0;
+        entries.push_back(ne);
+        e = &entries.back();
+
+        misses++;
+        mapped_bytes += length;
+    }
+
+    e->last_use = tick;
+    e->pins++;
+
+    // the hardware wrote the block behind the cpu cache
+    CVI_S32 ret = CVI_SYS_IonInvalidateCache(phyaddr, e->ptr, length);
+    if (ret != CVI_SUCCESS)
     {
-        CVI_S32 ret = CVI_VPSS_SendFrame(VpssGrp, &stFrameInfo, -1);
-        if (ret != CVI_SUCCESS)
+        fprintf(stderr, "CVI_SYS_IonInvalidateCache failed %x\n", ret);
+    }
+
+    unsigned char* ptr = (unsigned char*)e->ptr;
+
+    pthread_mutex_unlock(&lock);
+
+    return ptr;
+}
+
+void vb_map_cache::unpin(const void* ptr)
+{
+    pthread_mutex_lock(&lock);
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].ptr == ptr && entries[i].pins > 0)
         {
-            fprintf(stderr, "CVI_VPSS_SendFrame failed %x\n", ret);
-            ret_val = -1;
-            goto OUT;
+            entries[i].pins--;
+            break;
         }
     }
 
-    // vpss get frame
+    // a smaller view replaced while pinned, or the cache went over capacity
+    for (size_t i = 0; i < entries.size() && entries.size() > capacity; i++)
+    {
+        if (entries[i].pins == 0)
+        {
+            evict(i);
+            evictions++;
+            i--;
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+void vb_map_cache::set_capacity(int _capacity)
+{
+    pthread_mutex_lock(&lock);
+
+    capacity = _capacity > 0 ? (size_t)_capacity : VB_MAP_CACHE_MAX_ENTRIES;
+
+    pthread_mutex_unlock(&lock);
+}
+
+void vb_map_cache::evict(size_t i)
+{
+    CVI_S32 ret = CVI_SYS_Munmap(entries[i].ptr, entries[i].length);
+    if (ret != CVI_SUCCESS)
+    {
+        fprintf(stderr, "CVI_SYS_Munmap failed %x\n", ret);
+    }
+
+    mapped_bytes -= entries[i].length;
+    entries[i] = entries.back();
+    entries.pop_back();
+}
+
+void vb_map_cache::clear()
+{
+    pthread_mutex_lock(&lock);
+
+    // a frame kept past close() still reads its block, its mapping stays
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].pins == 0)
+        {
+            evict(i);
+            i--;
+        }
+    }
+
+    // no capacity, so unpin() unmaps each one left as soon as its last frame lets go
+    capacity = 0;
+
+    pthread_mutex_unlock(&lock);
+}
+
+void vb_map_cache::get_stats(capture_cvi_stats* stats)
+{
+    pthread_mutex_lock(&lock);
+
+    stats->map_hits = hits;
+    stats->map_misses = misses;
+    stats->map_evictions = evictions;
+    stats->mapped_bytes = mapped_bytes;
+
+    pthread_mutex_unlock(&lock);
+}
+
+//added by jj
+// vpss frames held through capture_cvi::retain(), indexed by chn
+static unsigned int g_retained_frames[CAPTURE_CVI_STREAM_COUNT];
+
+capture_cvi_options::capture_cvi_options()
+{
+    vb_count = 4;
+    chn_vb_count = 2;
+    vi_depth = 1;
+    vpss_depth = 1;
+    policy = CAPTURE_CVI_POLICY_FIFO;
+    timeout_ms = 2000;
+    bind_vpss = 0;
+    preview_fps = 10.f;
+    preview_full = 0;
+    retain_budget = 1;
+    retain_streams = (1 << CAPTURE_CVI_STREAM_COUNT) - 1;
+}
+
+capture_cvi_stats::capture_cvi_stats()
+{
+    frames = 0;
+    dropped = 0;
+    overrun = 0;
+    empty = 0;
+    vi_lost = 0;
+    vi_vb_fail = 0;
+    ring_full = 0;
+    ion_bytes = 0;
+    map_hits = 0;
+    map_misses = 0;
+    map_evictions = 0;
+    mapped_bytes = 0;
+    retained = 0;
+    retain_denied = 0;
+}
+
+capture_cvi_3a_stats::capture_cvi_3a_stats()
+{
+    frame_id = 0;
+    pts = 0;
+    memset(ae_luma, 0, sizeof(ae_luma));
+    ae_global_luma = 0;
+    memset(awb_r, 0, sizeof(awb_r));
+    memset(awb_g, 0, sizeof(awb_g));
+    memset(awb_b, 0, sizeof(awb_b));
+    memset(af_fv, 0, sizeof(af_fv));
+}
+
+capture_cvi_frame::capture_cvi_frame()
+{
+    width = 0;
+    height = 0;
+    pixel_format = 0;
+    pts = 0;
+
+    plane_count = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        stride[i] = 0;
+        length[i] = 0;
+        phyaddr[i] = 0;
+        viraddr[i] = 0;
+        plane_width[i] = 0;
+        plane_height[i] = 0;
+        plane_elemsize[i] = 0;
+        plane_offset[i] = 0;
+    }
+
+    frame_info = 0;
+
+    source = 0;
+    dev = 0;
+    chn = 0;
+
+    retained = 0;
+
+    pthread_mutex_init(&map_lock, 0);
+    mapped_ptr = 0;
+    mapped_length = 0;
+}
+
+capture_cvi_frame::~capture_cvi_frame()
+{
+    release();
+
+    pthread_mutex_destroy(&map_lock);
+}
+
+bool capture_cvi_frame::empty() const
+{
+    return frame_info == 0;
+}
+
+//added by jj
+int capture_cvi_frame::luma_plane() const
+{
+    switch (pixel_format)
+    {
+    case PIXEL_FORMAT_YUV_PLANAR_422:
+    case PIXEL_FORMAT_YUV_PLANAR_420:
+    case PIXEL_FORMAT_YUV_PLANAR_444:
+    case PIXEL_FORMAT_YUV_400:
+    case PIXEL_FORMAT_NV12:
+    case PIXEL_FORMAT_NV21:
+    case PIXEL_FORMAT_NV16:
+    case PIXEL_FORMAT_NV61:
+        return 0;
+    default:
+        // packed yuyv interleaves luma with chroma, no single channel view
+        return -1;
+    }
+}
+
+unsigned char* capture_cvi_frame::map()
+{
+    pthread_mutex_lock(&map_lock);
+
+    if (!mapped_ptr && frame_info && plane_count > 0)
+    {
+        // all planes live in the same vb block, map the whole span at once
+        unsigned long long begin = phyaddr[0];
+        unsigned long long end = phyaddr[0] + length[0];
+        for (int i = 1; i < plane_count; i++)
+        {
+            if (phyaddr[i] < begin)
+                begin = phyaddr[i];
+            if (phyaddr[i] + length[i] > end)
+                end = phyaddr[i] + length[i];
+        }
+
+        const int span = (int)(end - begin);
+
+        void* ptr = g_vb_map_cache.map(begin, span);
+        if (ptr)
+        {
+            mapped_ptr = ptr;
+            mapped_length = span;
+
+            for (int i = 0; i < plane_count; i++)
+            {
+                viraddr[i] = (unsigned char*)mapped_ptr + (phyaddr[i] - begin);
+            }
+        }
+    }
+
+    unsigned char* ptr = viraddr[0];
+
+    pthread_mutex_unlock(&map_lock);
+
+    return ptr;
+}
+
+void capture_cvi_frame::release()
+{
+    // the mapping stays in g_vb_map_cache for the next frame in this block
+    if (mapped_ptr)
+        g_vb_map_cache.unpin(mapped_ptr);
+
+    mapped_ptr = 0;
+    mapped_length = 0;
+
+    if (retained)
+    {
+        __atomic_sub_fetch(&g_retained_frames[chn], 1, __ATOMIC_RELAXED);
+        retained = 0;
+    }
+
+    if (frame_info)
+    {
+        VIDEO_FRAME_INFO_S* info = (VIDEO_FRAME_INFO_S*)frame_info;
+
+        if (source == 1)
+        {
+            CVI_S32 ret = CVI_VI_ReleaseChnFrame(dev, chn, info);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VI_ReleaseChnFrame failed %x\n", ret);
+            }
+        }
+
+        if (source == 2)
+        {
+            CVI_S32 ret = CVI_VPSS_ReleaseChnFrame(dev, chn, info);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VPSS_ReleaseChnFrame failed %x\n", ret);
+            }
+        }
+
+        delete info;
+
+        frame_info = 0;
+    }
+
+    plane_count = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        viraddr[i] = 0;
+    }
+}
+
+//added by jj
+void capture_cvi_impl::account_frame(const VIDEO_FRAME_INFO_S* info)
+{
+    const unsigned long long pts = info->stVFrame.u64PTS;
+
+    if (last_pts != 0 && pts > last_pts && frame_interval_us != 0)
+    {
+        // frames the sensor delivered that the driver overwrote before we dequeued them
+        const unsigned long long gap = (pts - last_pts + frame_interval_us / 2) / frame_interval_us;
+        if (gap > 1)
+            __atomic_add_fetch(&stats.overrun, (unsigned int)(gap - 1), __ATOMIC_RELAXED);
+    }
+
+    last_pts = pts;
+
+    pthread_mutex_lock(&pts_lock);
+    const int slot = pts_history_count % PTS_HISTORY_SIZE;
+    pts_history_ref[slot] = info->stVFrame.u32TimeRef;
+    pts_history[slot] = pts;
+    pts_history_count++;
+    pthread_mutex_unlock(&pts_lock);
+}
+
+unsigned long long capture_cvi_impl::frame_id_pts(unsigned int frame_id)
+{
+    unsigned long long pts = 0;
+
+    pthread_mutex_lock(&pts_lock);
+    if (pts_history_count > 0)
+    {
+        const int count = pts_history_count < PTS_HISTORY_SIZE ? pts_history_count : PTS_HISTORY_SIZE;
+        for (int i = 0; i < count; i++)
+        {
+            const int slot = (pts_history_count - 1 - i) % PTS_HISTORY_SIZE;
+            if (pts_history_ref[slot] == frame_id)
+            {
+                pts = pts_history[slot];
+                break;
+            }
+        }
+
+        // the isp finishes a frame before vpss hands it out, a statistics read often runs
+        // a frame or two ahead of the newest frame read, those follow at the frame interval
+        const int newest = (pts_history_count - 1) % PTS_HISTORY_SIZE;
+        const unsigned int ahead = frame_id - pts_history_ref[newest];
+        if (pts == 0 && ahead > 0 && ahead <= 4 && frame_interval_us != 0)
+        {
+            pts = pts_history[newest] + ahead * frame_interval_us;
+        }
+    }
+    pthread_mutex_unlock(&pts_lock);
+
+    return pts;
+}
+
+void capture_cvi_frame::swap(capture_cvi_frame& other)
+{
+#define SWAP_FIELD(T, x) { T tmp = x; x = other.x; other.x = tmp; }
+    SWAP_FIELD(int, width)
+    SWAP_FIELD(int, height)
+    SWAP_FIELD(int, pixel_format)
+    SWAP_FIELD(unsigned long long, pts)
+    SWAP_FIELD(int, plane_count)
+    for (int i = 0; i < 3; i++)
+    {
+        SWAP_FIELD(int, stride[i])
+        SWAP_FIELD(int, length[i])
+        SWAP_FIELD(unsigned long long, phyaddr[i])
+        SWAP_FIELD(unsigned char*, viraddr[i])
+        SWAP_FIELD(int, plane_width[i])
+        SWAP_FIELD(int, plane_height[i])
+        SWAP_FIELD(int, plane_elemsize[i])
+        SWAP_FIELD(int, plane_offset[i])
+    }
+    SWAP_FIELD(void*, frame_info)
+    SWAP_FIELD(int, source)
+    SWAP_FIELD(int, dev)
+    SWAP_FIELD(int, chn)
+    SWAP_FIELD(int, retained)
+    SWAP_FIELD(void*, mapped_ptr)
+    SWAP_FIELD(int, mapped_length)
+#undef SWAP_FIELD
+}
+
+//modified by jj
+int capture_cvi_impl::read_frame(capture_cvi_frame* frame, capture_cvi_frame* raw_frame)
+{
+    if (stream_width[CAPTURE_CVI_STREAM_MAIN] == 0)
+    {
+        fprintf(stderr, "bgr stream not enabled\n");
+        return -1;
+    }
+
+    capture_cvi_frame* frames[CAPTURE_CVI_STREAM_COUNT] = { frame, 0, 0, 0 };
+
+    return read_frames(frames, raw_frame);
+}
+
+//added by jj
+int capture_cvi_impl::read_frames(capture_cvi_frame** frames, capture_cvi_frame* raw_frame)
+{
+    int ret_val = 0;
+
+    VIDEO_FRAME_INFO_S* vi_frame_info = new VIDEO_FRAME_INFO_S;
+    VIDEO_FRAME_INFO_S* vpss_frame_infos[CAPTURE_CVI_STREAM_COUNT] = { 0, 0, 0, 0 };
+    int b_vi_frame_got = 0;
+    int b_vpss_frame_got[CAPTURE_CVI_STREAM_COUNT] = { 0, 0, 0, 0 };
+
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (frames[i])
+            frames[i]->release();
+    }
+
+    if (raw_frame)
+        raw_frame->release();
+
+    if (b_paused)
+    {
+        fprintf(stderr, "capture paused\n");
+        delete vi_frame_info;
+        return -1;
+    }
+
+    if (b_vi_vpss_bound)
+    {
+        delete vi_frame_info;
+        return read_frames_bound(frames, raw_frame);
+    }
+
+    // vi get frame
     {
-        CVI_S32 ret = CVI_VPSS_GetChnFrame(VpssGrp, VpssChn, &stFrameInfo_bgr, 2000);
+        // the capture thread always waits, the ring does the queueing there
+        const int timeout_ms = options.policy == CAPTURE_CVI_POLICY_QUEUE && !b_capture_thread_created ? 0 : options.timeout_ms;
+
+        CVI_S32 ret = CVI_VI_GetChnFrame(ViPipe, ViChn, vi_frame_info, timeout_ms);
         if (ret != CVI_SUCCESS)
         {
-            fprintf(stderr, "CVI_VPSS_GetChnFrame failed %x\n", ret);
+            __atomic_add_fetch(&stats.empty, 1, __ATOMIC_RELAXED);
+
+            if (timeout_ms == 0)
+            {
+                // nothing queued yet
+                ret_val = 1;
+                goto OUT;
+            }
+
+            fprintf(stderr, "CVI_VI_GetChnFrame failed %x\n", ret);
             ret_val = -1;
             goto OUT;
         }
 
-        b_vpss_frame_got = 1;
+        b_vi_frame_got = 1;
+
+        account_frame(vi_frame_info);
+    }
+
+    //added by jj
+    if (options.policy == CAPTURE_CVI_POLICY_LATEST)
+    {
+        // skip to the freshest queued frame
+        VIDEO_FRAME_INFO_S* newer_frame_info = new VIDEO_FRAME_INFO_S;
+
+        while (CVI_VI_GetChnFrame(ViPipe, ViChn, newer_frame_info, 0) == CVI_SUCCESS)
+        {
+            account_frame(newer_frame_info);
+
+            CVI_S32 ret = CVI_VI_ReleaseChnFrame(ViPipe, ViChn, vi_frame_info);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VI_ReleaseChnFrame failed %x\n", ret);
+            }
+
+            VIDEO_FRAME_INFO_S* tmp = vi_frame_info;
+            vi_frame_info = newer_frame_info;
+            newer_frame_info = tmp;
+
+            __atomic_add_fetch(&stats.dropped, 1, __ATOMIC_RELAXED);
+        }
+
+        delete newer_frame_info;
     }
 
     if (0)
     {
         // dump
-        VIDEO_FRAME_S& vf = stFrameInfo_bgr.stVFrame;
+        VIDEO_FRAME_S& vf = vi_frame_info->stVFrame;
         fprintf(stderr, "vf u32Width = %u\n", vf.u32Width);
         fprintf(stderr, "vf u32Height = %u\n", vf.u32Height);
         fprintf(stderr, "vf enPixelFormat = %d\n", vf.enPixelFormat);
@@ -3815,119 +4980,1161 @@ int capture_cvi_impl::read_frame(unsigned char* bgrdata, bool retain_image_ptr)
         fprintf(stderr, "vf u32FrameFlag = %u\n", vf.u32FrameFlag);
     }
 
-    // copy bgr
+    // vpss send frame
+    {
+        CVI_S32 ret = CVI_VPSS_SendFrame(VpssGrp, vi_frame_info, -1);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VPSS_SendFrame failed %x\n", ret);
+            ret_val = -1;
+            goto OUT;
+        }
+    }
+
+    // vpss get frame
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (!__atomic_load_n(&b_vpss_chn_enabled[i], __ATOMIC_ACQUIRE))
+            continue;
+
+        vpss_frame_infos[i] = new VIDEO_FRAME_INFO_S;
+
+        CVI_S32 ret = CVI_VPSS_GetChnFrame(VpssGrp, i, vpss_frame_infos[i], 2000);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VPSS_GetChnFrame %s failed %x\n", stream_names[i], ret);
+            ret_val = -1;
+            goto OUT;
+        }
+
+        b_vpss_frame_got[i] = 1;
+    }
+
+    // hand the frames over, they go back to the driver on release
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (!frames[i] || !b_vpss_frame_got[i])
+            continue;
+
+        setup_frame(frames[i], vpss_frame_infos[i], 2, VpssGrp, i);
+        vpss_frame_infos[i] = 0;
+        b_vpss_frame_got[i] = 0;
+    }
+
+    if (raw_frame)
     {
-        const VIDEO_FRAME_S& vf = stFrameInfo_bgr.stVFrame;
+        setup_frame(raw_frame, vi_frame_info, 1, ViPipe, ViChn);
+        vi_frame_info = 0;
+        b_vi_frame_got = 0;
+    }
+
+    __atomic_add_fetch(&stats.frames, 1, __ATOMIC_RELAXED);
 
-        // memcpy Y/BGR
-        CVI_U64 phyaddr = vf.u64PhyAddr[0];
-        // const unsigned char* ptr = vf.pu8VirAddr[0];
-        const int stride = vf.u32Stride[0];
-        const int length = vf.u32Length[0];
+OUT:
 
-        const int border_top = vf.s16OffsetTop;
-        // const int border_bottom = vf.s16OffsetBottom;
-        const int border_left = vf.s16OffsetLeft;
-        // const int border_right = vf.s16OffsetRight;
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (b_vpss_frame_got[i])
+        {
+            CVI_S32 ret = CVI_VPSS_ReleaseChnFrame(VpssGrp, i, vpss_frame_infos[i]);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VPSS_ReleaseChnFrame failed %x\n", ret);
+                ret_val = -1;
+            }
+        }
+
+        delete vpss_frame_infos[i];
+    }
+
+    if (b_vi_frame_got)
+    {
+        CVI_S32 ret = CVI_VI_ReleaseChnFrame(ViPipe, ViChn, vi_frame_info);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VI_ReleaseChnFrame failed %x\n", ret);
+            ret_val = -1;
+        }
+    }
+
+    delete vi_frame_info;
+
+    return ret_val;
+}
+
+//added by jj
+int capture_cvi_impl::read_frames_bound(capture_cvi_frame** frames, capture_cvi_frame* raw_frame)
+{
+    int ret_val = 0;
+
+    VIDEO_FRAME_INFO_S* vi_frame_info = 0;
+    VIDEO_FRAME_INFO_S* vpss_frame_infos[CAPTURE_CVI_STREAM_COUNT] = { 0, 0, 0, 0 };
+    int b_vi_frame_got = 0;
+    int b_vpss_frame_got[CAPTURE_CVI_STREAM_COUNT] = { 0, 0, 0, 0 };
+    int first_chn = -1;
+
+    // the capture thread always waits, the ring does the queueing there
+    const int timeout_ms = options.policy == CAPTURE_CVI_POLICY_QUEUE && !b_capture_thread_created ? 0 : options.timeout_ms;
+
+    // vpss get frame
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (!__atomic_load_n(&b_vpss_chn_enabled[i], __ATOMIC_ACQUIRE))
+            continue;
+
+        vpss_frame_infos[i] = new VIDEO_FRAME_INFO_S;
+
+        // the first chn paces the read, the others are filled from the same vi frame
+        CVI_S32 ret = CVI_VPSS_GetChnFrame(VpssGrp, i, vpss_frame_infos[i], first_chn == -1 ? timeout_ms : options.timeout_ms);
+        if (ret != CVI_SUCCESS)
+        {
+            if (first_chn == -1)
+            {
+                __atomic_add_fetch(&stats.empty, 1, __ATOMIC_RELAXED);
+
+                if (timeout_ms == 0)
+                {
+                    // nothing queued yet
+                    ret_val = 1;
+                    goto OUT;
+                }
+            }
+
+            fprintf(stderr, "CVI_VPSS_GetChnFrame %s failed %x\n", stream_names[i], ret);
+            ret_val = -1;
+            goto OUT;
+        }
+
+        b_vpss_frame_got[i] = 1;
+
+        if (options.policy == CAPTURE_CVI_POLICY_LATEST)
+        {
+            // skip to the freshest queued output of this chn
+            VIDEO_FRAME_INFO_S newer_frame_info;
+
+            while (CVI_VPSS_GetChnFrame(VpssGrp, i, &newer_frame_info, 0) == CVI_SUCCESS)
+            {
+                if (first_chn == -1)
+                    account_frame(vpss_frame_infos[i]);
+
+                ret = CVI_VPSS_ReleaseChnFrame(VpssGrp, i, vpss_frame_infos[i]);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_ReleaseChnFrame failed %x\n", ret);
+                }
+
+                *vpss_frame_infos[i] = newer_frame_info;
+
+                if (first_chn == -1)
+                    __atomic_add_fetch(&stats.dropped, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        if (first_chn == -1)
+            first_chn = i;
+    }
+
+    if (first_chn == -1)
+    {
+        fprintf(stderr, "no stream enabled\n");
+        ret_val = -1;
+        goto OUT;
+    }
+
+    // the chns are dequeued one by one, a chn still holding an older frame catches up
+    // so that every entry of the set comes from the same vi frame
+    for (int round = 0; round < 4; round++)
+    {
+        unsigned long long pts = 0;
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+        {
+            if (b_vpss_frame_got[i] && vpss_frame_infos[i]->stVFrame.u64PTS > pts)
+                pts = vpss_frame_infos[i]->stVFrame.u64PTS;
+        }
+
+        int b_aligned = 1;
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+        {
+            if (!b_vpss_frame_got[i])
+                continue;
+
+            while (vpss_frame_infos[i]->stVFrame.u64PTS < pts)
+            {
+                CVI_S32 ret = CVI_VPSS_ReleaseChnFrame(VpssGrp, i, vpss_frame_infos[i]);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_ReleaseChnFrame failed %x\n", ret);
+                }
+
+                b_vpss_frame_got[i] = 0;
+
+                ret = CVI_VPSS_GetChnFrame(VpssGrp, i, vpss_frame_infos[i], options.timeout_ms);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_GetChnFrame %s failed %x\n", stream_names[i], ret);
+                    ret_val = -1;
+                    goto OUT;
+                }
+
+                b_vpss_frame_got[i] = 1;
+            }
+
+            if (vpss_frame_infos[i]->stVFrame.u64PTS != pts)
+                b_aligned = 0;
+        }
+
+        if (b_aligned)
+            break;
+    }
+
+    account_frame(vpss_frame_infos[first_chn]);
+
+    // on demand, the vi frame the set was scaled from, taken from the vi chn queue
+    // older queued frames are dropped, the raw frame stays empty when vi_depth is 0 or
+    // the matching frame was already overwritten by a newer one
+    if (raw_frame && options.vi_depth > 0)
+    {
+        const unsigned long long pts = vpss_frame_infos[first_chn]->stVFrame.u64PTS;
+
+        vi_frame_info = new VIDEO_FRAME_INFO_S;
+
+        for (int i = 0; i <= options.vi_depth; i++)
+        {
+            CVI_S32 ret = CVI_VI_GetChnFrame(ViPipe, ViChn, vi_frame_info, 0);
+            if (ret != CVI_SUCCESS)
+                break;
+
+            if (vi_frame_info->stVFrame.u64PTS == pts)
+            {
+                b_vi_frame_got = 1;
+                break;
+            }
+
+            ret = CVI_VI_ReleaseChnFrame(ViPipe, ViChn, vi_frame_info);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VI_ReleaseChnFrame failed %x\n", ret);
+            }
+
+            if (vi_frame_info->stVFrame.u64PTS > pts)
+                break;
+        }
+
+        if (!b_vi_frame_got)
+            fprintf(stderr, "vi frame of pts %llu no longer queued\n", pts);
+    }
+
+    // hand the frames over, they go back to the driver on release
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (!frames[i] || !b_vpss_frame_got[i])
+            continue;
+
+        setup_frame(frames[i], vpss_frame_infos[i], 2, VpssGrp, i);
+        vpss_frame_infos[i] = 0;
+        b_vpss_frame_got[i] = 0;
+    }
+
+    if (raw_frame && b_vi_frame_got)
+    {
+        setup_frame(raw_frame, vi_frame_info, 1, ViPipe, ViChn);
+        vi_frame_info = 0;
+        b_vi_frame_got = 0;
+    }
+
+    __atomic_add_fetch(&stats.frames, 1, __ATOMIC_RELAXED);
+
+OUT:
+
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (b_vpss_frame_got[i])
+        {
+            CVI_S32 ret = CVI_VPSS_ReleaseChnFrame(VpssGrp, i, vpss_frame_infos[i]);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VPSS_ReleaseChnFrame failed %x\n", ret);
+                ret_val = -1;
+            }
+        }
+
+        delete vpss_frame_infos[i];
+    }
+
+    if (b_vi_frame_got)
+    {
+        CVI_S32 ret = CVI_VI_ReleaseChnFrame(ViPipe, ViChn, vi_frame_info);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VI_ReleaseChnFrame failed %x\n", ret);
+            ret_val = -1;
+        }
+    }
+
+    delete vi_frame_info;
+
+    return ret_val;
+}
+
+int capture_cvi_impl::read_frame(unsigned char* bgrdata)
+{
+    capture_cvi_frame frame;
+
+    int ret = read_frame(&frame, 0);
+    if (ret != 0)
+        return ret;
+
+    if (!frame.map())
+        return -1;
+
+    // copy bgr
+    {
+        const int stride = frame.stride[0];
+
+        const unsigned char* ptr = frame.viraddr[0] + frame.plane_offset[0];
+
+        // copy to bgrdata
+        int h2 = output_height;
+        int w2 = output_width * 3;
+        if (stride == output_width * 3)
+        {
+            h2 = 1;
+            w2 = output_height * output_width * 3;
+        }
+
+        for (int i = 0; i < h2; i++)
+        {
+#if __riscv_vector
+            int j = 0;
+            int n = w2;
+            while (n > 0) {
+                size_t vl = vsetvl_e8m8(n);
+                vuint8m8_t bgr = vle8_v_u8m8(ptr + j, vl);
+                vse8_v_u8m8(bgrdata, bgr, vl);
+                bgrdata += vl;
+                j += vl;
+                n -= vl;
+            }
+#else
+            memcpy(bgrdata, ptr, w2);
+            bgrdata += w2;
+#endif
+
+            ptr += stride;
+        }
+    }
+
+    return 0;
+}
+
+//added by jj
+static void* capture_main(void* arg)
+{
+    capture_cvi_impl* impl = (capture_cvi_impl*)arg;
+
+    prctl(PR_SET_NAME, "CV_CAPTURE", 0, 0, 0);
+
+    impl->capture_loop();
+
+    return NULL;
+}
+
+void capture_cvi_impl::capture_loop()
+{
+    capture_cvi_ring_slot slot;
+
+    capture_cvi_frame* frames[CAPTURE_CVI_STREAM_COUNT];
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        frames[i] = &slot.frames[i];
+    }
+
+    while (__atomic_load_n(&capture_thread_running, __ATOMIC_ACQUIRE))
+    {
+        int ret = read_frames(frames, capture_keep_raw ? &slot.raw_frame : 0);
+
+        // set_mode() waits on this to know no read still uses a chn it switches off
+        __atomic_add_fetch(&capture_reads, 1, __ATOMIC_RELEASE);
+
+        if (ret != 0)
+        {
+            // a failing pipe, or an empty one under CAPTURE_CVI_POLICY_QUEUE, returns at once
+            // do not spin on it
+            usleep(5 * 1000);
+            continue;
+        }
+
+        pthread_mutex_lock(&ring_lock);
+
+        const unsigned int head = ring_head;
+        const unsigned int tail = ring_tail;
+        int published = 1;
+        if (head - tail == (unsigned int)ring_size)
+        {
+            if (options.policy != CAPTURE_CVI_POLICY_LATEST)
+            {
+                pthread_mutex_unlock(&ring_lock);
+
+                // consumer is behind, keep what it has not seen yet and drop the new set
+                for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+                {
+                    slot.frames[i].release();
+                }
+                slot.raw_frame.release();
+
+                __atomic_add_fetch(&stats.ring_full, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            // consumer is behind and only wants the newest, the oldest slot makes room
+            // the published count stays the same, one slot out and one in
+            __atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+            published = 0;
+        }
+
+        // the set taken out of the ring, if any, comes back in slot
+        capture_cvi_ring_slot& dst = ring[head % ring_size];
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+        {
+            dst.frames[i].swap(slot.frames[i]);
+        }
+        dst.raw_frame.swap(slot.raw_frame);
+
+        __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+
+        pthread_mutex_unlock(&ring_lock);
+
+        if (published)
+        {
+            sem_post(&ring_sem);
+            continue;
+        }
+
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+        {
+            slot.frames[i].release();
+        }
+        slot.raw_frame.release();
+
+        __atomic_add_fetch(&stats.dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int capture_cvi_impl::start_capture_thread(int _ring_size, int keep_raw)
+{
+    if (b_capture_thread_created)
+    {
+        fprintf(stderr, "capture thread already running\n");
+        return -1;
+    }
+
+    if (!b_vpss_grp_started)
+    {
+        fprintf(stderr, "capture thread needs start_streaming() first\n");
+        return -1;
+    }
+
+    if (_ring_size < 1)
+    {
+        fprintf(stderr, "invalid ring size %d\n", _ring_size);
+        return -1;
+    }
+
+    // every slot pins one block of each stream pool, the consumer one more
+    if (options.chn_vb_count < _ring_size + 1)
+    {
+        fprintf(stderr, "chn_vb_count %d < ring size %d + 1, vpss will stall\n", options.chn_vb_count, _ring_size);
+    }
+
+    if (sem_init(&ring_sem, 0, 0) != 0)
+    {
+        fprintf(stderr, "sem_init failed\n");
+        return -1;
+    }
+
+    pthread_mutex_init(&ring_lock, 0);
+
+    ring = new capture_cvi_ring_slot[_ring_size];
+    ring_size = _ring_size;
+    ring_head = 0;
+    ring_tail = 0;
+    capture_keep_raw = keep_raw;
+
+    // set before the thread reads it
+    b_capture_thread_created = 1;
+    __atomic_store_n(&capture_thread_running, 1, __ATOMIC_RELEASE);
+
+    int ret = pthread_create(&capture_thread, 0, capture_main, this);
+    if (ret != 0)
+    {
+        fprintf(stderr, "pthread_create failed %x\n", ret);
+
+        b_capture_thread_created = 0;
+        capture_thread_running = 0;
+        delete[] ring;
+        ring = 0;
+        ring_size = 0;
+        pthread_mutex_destroy(&ring_lock);
+        sem_destroy(&ring_sem);
+        return -1;
+    }
+
+    return 0;
+}
+
+int capture_cvi_impl::stop_capture_thread()
+{
+    if (!b_capture_thread_created)
+        return 0;
+
+    int ret_val = 0;
+
+    // the thread notices within one read timeout
+    __atomic_store_n(&capture_thread_running, 0, __ATOMIC_RELEASE);
+
+    int ret = pthread_join(capture_thread, 0);
+    if (ret != 0)
+    {
+        fprintf(stderr, "pthread_join failed %x\n", ret);
+        ret_val = -1;
+    }
+
+    // hand whatever is still queued back to the driver
+    delete[] ring;
+    ring = 0;
+    ring_size = 0;
+    ring_head = 0;
+    ring_tail = 0;
+
+    pthread_mutex_destroy(&ring_lock);
+    sem_destroy(&ring_sem);
+
+    capture_thread = 0;
+    b_capture_thread_created = 0;
+
+    return ret_val;
+}
+
+int capture_cvi_impl::pop_frames(capture_cvi_frame** frames, capture_cvi_frame* raw_frame, int timeout_ms)
+{
+    if (!b_capture_thread_created)
+    {
+        fprintf(stderr, "capture thread not running\n");
+        return -1;
+    }
+
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (frames[i])
+            frames[i]->release();
+    }
+
+    if (raw_frame)
+        raw_frame->release();
+
+    // wait for a published slot
+    {
+        int ret = 0;
+        if (timeout_ms < 0)
+        {
+            while ((ret = sem_wait(&ring_sem)) != 0 && errno == EINTR)
+                ;
+        }
+        else if (timeout_ms == 0)
+        {
+            ret = sem_trywait(&ring_sem);
+        }
+        else
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += timeout_ms / 1000;
+            ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L)
+            {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000L;
+            }
+
+            while ((ret = sem_timedwait(&ring_sem, &ts)) != 0 && errno == EINTR)
+                ;
+        }
+
+        if (ret != 0)
+            return 1;
+    }
+
+    while (1)
+    {
+        // the slot a skipped set came from, returned to the driver outside the lock
+        capture_cvi_ring_slot skipped;
+
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+        {
+            if (frames[i])
+                frames[i]->swap(skipped.frames[i]);
+        }
+
+        if (raw_frame)
+            raw_frame->swap(skipped.raw_frame);
+
+        pthread_mutex_lock(&ring_lock);
+
+        // the producer may have moved the tail past a slot it dropped
+        const unsigned int tail = ring_tail;
+        capture_cvi_ring_slot& src = ring[tail % ring_size];
+
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+        {
+            if (frames[i])
+                frames[i]->swap(src.frames[i]);
+            else
+                skipped.frames[i].swap(src.frames[i]);
+        }
+
+        if (raw_frame)
+            raw_frame->swap(src.raw_frame);
+        else
+            skipped.raw_frame.swap(src.raw_frame);
+
+        __atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+
+        pthread_mutex_unlock(&ring_lock);
+
+        // skip ahead to the newest published slot
+        if (options.policy != CAPTURE_CVI_POLICY_LATEST || sem_trywait(&ring_sem) != 0)
+            break;
+
+        __atomic_add_fetch(&stats.dropped, 1, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+//added by jj
+int capture_cvi_impl::set_stream_crop(int stream, int x, int y, int width, int height)
+{
+    if (!b_vpss_grp_created || stream_width[stream] == 0)
+    {
+        fprintf(stderr, "%s stream not enabled\n", stream_names[stream]);
+        return -1;
+    }
+
+    const int cap_width = get_sensor_cfg()->cap_width;
+    const int cap_height = get_sensor_cfg()->cap_height;
+
+    if (width == 0 && height == 0)
+    {
+        // back to the whole sensor view
+        x = 0;
+        y = 0;
+        width = cap_width;
+        height = cap_height;
+    }
+
+    // keep the chroma planes aligned
+    x &= ~1;
+    y &= ~1;
+    width &= ~1;
+    height &= ~1;
+
+    if (x < 0 || y < 0 || width < 2 || height < 2 || x + width > cap_width || y + height > cap_height)
+    {
+        fprintf(stderr, "invalid %s crop %d %d %d x %d\n", stream_names[stream], x, y, width, height);
+        return -1;
+    }
+
+    {
+        VPSS_CROP_INFO_S stCropInfo;
+        stCropInfo.bEnable = (x == 0 && y == 0 && width == cap_width && height == cap_height) ? CVI_FALSE : CVI_TRUE;
+        stCropInfo.enCropCoordinate = VPSS_CROP_ABS_COOR;
+        stCropInfo.stCropRect.s32X = x;
+        stCropInfo.stCropRect.s32Y = y;
+        stCropInfo.stCropRect.u32Width = width;
+        stCropInfo.stCropRect.u32Height = height;
+
+        CVI_S32 ret = CVI_VPSS_SetChnCrop(VpssGrp, stream, &stCropInfo);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VPSS_SetChnCrop %s failed %x\n", stream_names[stream], ret);
+            return -1;
+        }
+    }
+
+    stream_crop_x[stream] = x;
+    stream_crop_y[stream] = y;
+    stream_crop_width[stream] = width;
+    stream_crop_height[stream] = height;
+
+    return 0;
+}
+
+int capture_cvi_impl::set_stream_size(int stream, int width, int height)
+{
+    if (!b_vpss_grp_created || stream_width[stream] == 0)
+    {
+        fprintf(stderr, "%s stream not enabled\n", stream_names[stream]);
+        return -1;
+    }
+
+    if (stream == CAPTURE_CVI_STREAM_MAIN)
+    {
+        fprintf(stderr, "bgr stream size follows open()\n");
+        return -1;
+    }
+
+    width &= ~1;
+    height &= ~1;
+
+    if (width < 2 || height < 2)
+    {
+        fprintf(stderr, "invalid %s stream size %d x %d\n", stream_names[stream], width, height);
+        return -1;
+    }
+
+    // the chn pool was sized at open()
+    if (get_stream_buffer_size(stream, width, height) > stream_block_size[stream])
+    {
+        fprintf(stderr, "%s stream size %d x %d exceeds its vb block\n", stream_names[stream], width, height);
+        return -1;
+    }
+
+    {
+        VPSS_CHN_ATTR_S stChnAttr;
+        CVI_S32 ret = CVI_VPSS_GetChnAttr(VpssGrp, stream, &stChnAttr);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VPSS_GetChnAttr %s failed %x\n", stream_names[stream], ret);
+            return -1;
+        }
+
+        stChnAttr.u32Width = width;
+        stChnAttr.u32Height = height;
+        stChnAttr.stAspectRatio.stVideoRect.s32X = 0;
+        stChnAttr.stAspectRatio.stVideoRect.s32Y = 0;
+        stChnAttr.stAspectRatio.stVideoRect.u32Width = width;
+        stChnAttr.stAspectRatio.stVideoRect.u32Height = height;
+
+        ret = CVI_VPSS_SetChnAttr(VpssGrp, stream, &stChnAttr);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VPSS_SetChnAttr %s failed %x\n", stream_names[stream], ret);
+            return -1;
+        }
+    }
+
+    stream_width[stream] = width;
+    stream_height[stream] = height;
+
+    return 0;
+}
+
+int capture_cvi_impl::set_mode(int _mode)
+{
+    if (_mode != CAPTURE_CVI_MODE_STILL && _mode != CAPTURE_CVI_MODE_PREVIEW)
+    {
+        fprintf(stderr, "invalid capture mode %d\n", _mode);
+        return -1;
+    }
+
+    if (!b_isp_inited)
+    {
+        fprintf(stderr, "not opened\n");
+        return -1;
+    }
+
+    if (_mode == mode)
+        return 0;
+
+    const float cap_fps = get_sensor_cfg()->cap_fps;
+    const float fps = _mode == CAPTURE_CVI_MODE_PREVIEW && options.preview_fps < cap_fps ? options.preview_fps : cap_fps;
+
+    int ret_val = 0;
+
+    // isp retimes the sensor through its cmos_fps_set and rescales the ae exposure limits
+    {
+        ISP_PUB_ATTR_S stPubAttr;
+        CVI_S32 ret = CVI_ISP_GetPubAttr(ViPipe, &stPubAttr);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_ISP_GetPubAttr failed %x\n", ret);
+            ret_val = -1;
+            goto OUT;
+        }
+
+        stPubAttr.f32FrameRate = fps;
+
+        ret = CVI_ISP_SetPubAttr(ViPipe, &stPubAttr);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_ISP_SetPubAttr failed %x\n", ret);
+            ret_val = -1;
+            goto OUT;
+        }
+
+        frame_interval_us = fps > 0.f ? (unsigned long long)(1000000 / fps) : 0;
+        last_pts = 0;
+    }
+
+    // the full resolution output is only scaled while taking stills, or always with preview_full
+    if (stream_width[CAPTURE_CVI_STREAM_FULL] != 0)
+    {
+        const VPSS_CHN VpssChn = CAPTURE_CVI_STREAM_FULL;
+
+        if (_mode == CAPTURE_CVI_MODE_PREVIEW && !options.preview_full && b_vpss_chn_enabled[VpssChn])
+        {
+            // a running capture thread stops asking for the chn, then the read it may be
+            // in finishes within one read timeout before the chn goes
+            __atomic_store_n(&b_vpss_chn_enabled[VpssChn], 0, __ATOMIC_RELEASE);
+
+            if (b_capture_thread_created)
+            {
+                const unsigned int reads = __atomic_load_n(&capture_reads, __ATOMIC_ACQUIRE);
+                for (int waited_ms = 0; waited_ms < 2 * options.timeout_ms + 100; waited_ms++)
+                {
+                    if (__atomic_load_n(&capture_reads, __ATOMIC_ACQUIRE) != reads)
+                        break;
+
+                    usleep(1000);
+                }
+            }
+
+            CVI_S32 ret = CVI_VPSS_DisableChn(VpssGrp, VpssChn);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VPSS_DisableChn %s failed %x\n", stream_names[VpssChn], ret);
+                __atomic_store_n(&b_vpss_chn_enabled[VpssChn], 1, __ATOMIC_RELEASE);
+                ret_val = -1;
+                goto OUT;
+            }
+        }
+
+        if (_mode == CAPTURE_CVI_MODE_STILL && !b_vpss_chn_enabled[VpssChn])
+        {
+            CVI_S32 ret = CVI_VPSS_EnableChn(VpssGrp, VpssChn);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VPSS_EnableChn %s failed %x\n", stream_names[VpssChn], ret);
+                ret_val = -1;
+                goto OUT;
+            }
+
+            // the capture thread picks it up with its next read, the sets line up by pts
+            __atomic_store_n(&b_vpss_chn_enabled[VpssChn], 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    mode = _mode;
+
+OUT:
+    return ret_val;
+}
+
+void capture_cvi_impl::drain_frames()
+{
+    VIDEO_FRAME_INFO_S* frame_info = new VIDEO_FRAME_INFO_S;
+
+    if (b_vi_chn_enabled)
+    {
+        while (CVI_VI_GetChnFrame(ViPipe, ViChn, frame_info, 0) == CVI_SUCCESS)
+        {
+            CVI_S32 ret = CVI_VI_ReleaseChnFrame(ViPipe, ViChn, frame_info);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VI_ReleaseChnFrame failed %x\n", ret);
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        if (!b_vpss_chn_enabled[i])
+            continue;
+
+        while (CVI_VPSS_GetChnFrame(VpssGrp, i, frame_info, 0) == CVI_SUCCESS)
+        {
+            CVI_S32 ret = CVI_VPSS_ReleaseChnFrame(VpssGrp, i, frame_info);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_VPSS_ReleaseChnFrame failed %x\n", ret);
+                break;
+            }
+        }
+    }
+
+    delete frame_info;
+}
+
+int capture_cvi_impl::retain(capture_cvi_frame* frame)
+{
+    if (!frame || frame->empty() || frame->source != 2 || frame->chn < 0 || frame->chn >= CAPTURE_CVI_STREAM_COUNT)
+    {
+        fprintf(stderr, "only vpss frames can be retained\n");
+        return -1;
+    }
+
+    if (frame->retained)
+        return 0;
+
+    // the pool of a stream outside retain_streams has no block to spare
+    if (!((options.retain_streams >> frame->chn) & 1))
+    {
+        __atomic_add_fetch(&stats.retain_denied, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    const unsigned int held = __atomic_add_fetch(&g_retained_frames[frame->chn], 1, __ATOMIC_RELAXED);
+    if (held > (unsigned int)options.retain_budget)
+    {
+        __atomic_sub_fetch(&g_retained_frames[frame->chn], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats.retain_denied, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    frame->retained = 1;
+    return 0;
+}
+
+// bt.601 weights over the r gr gb b zone averages, summing to 256
+static unsigned short bayer_luma(const CVI_U16* rggb)
+{
+    return (unsigned short)((rggb[ISP_BAYER_CHN_R] * 77 + rggb[ISP_BAYER_CHN_GR] * 75 + rggb[ISP_BAYER_CHN_GB] * 75 + rggb[ISP_BAYER_CHN_B] * 29) >> 8);
+}
+
+int capture_cvi_impl::get_3a_stats(capture_cvi_3a_stats* stats, int timeout_ms)
+{
+    if (!b_isp_inited)
+    {
+        fprintf(stderr, "isp not running\n");
+        return -1;
+    }
+
+    if (!CVI_ISP_GetAEStatistics || !CVI_ISP_GetWBStatistics || !CVI_ISP_GetFocusStatistics || !CVI_ISP_GetVDTimeOut)
+    {
+        fprintf(stderr, "libisp has no 3a statistics api\n");
+        return -1;
+    }
+
+    // the statistics are complete once the back end is done with the frame
+    if (timeout_ms > 0)
+    {
+        CVI_S32 ret = CVI_ISP_GetVDTimeOut(ViPipe, ISP_VD_BE_END, timeout_ms);
+        if (ret != CVI_SUCCESS)
+            return 1;
+    }
+
+    int ret_val = 0;
+
+    // tens of kilobytes each, too much for the stack of a capture thread
+    ISP_AE_STATISTICS_S* ae = new ISP_AE_STATISTICS_S;
+    ISP_WB_STATISTICS_S* wb = new ISP_WB_STATISTICS_S;
+    ISP_AF_STATISTICS_S* af = new ISP_AF_STATISTICS_S;
+
+    CVI_U32 frame_id = 0;
+
+    // the back end may finish the next frame while we read, then the three disagree
+    // read again until the isp frame count is the same before and after
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        CVI_U32 frame_id_after = 0;
+
+        if (CVI_ISP_GetFrameID)
+            CVI_ISP_GetFrameID(ViPipe, &frame_id);
+
+        {
+            CVI_S32 ret = CVI_ISP_GetAEStatistics(ViPipe, ae);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_ISP_GetAEStatistics failed %x\n", ret);
+                ret_val = -1;
+                goto OUT;
+            }
+        }
+
+        {
+            CVI_S32 ret = CVI_ISP_GetWBStatistics(ViPipe, wb);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_ISP_GetWBStatistics failed %x\n", ret);
+                ret_val = -1;
+                goto OUT;
+            }
+        }
+
+        {
+            CVI_S32 ret = CVI_ISP_GetFocusStatistics(ViPipe, af);
+            if (ret != CVI_SUCCESS)
+            {
+                fprintf(stderr, "CVI_ISP_GetFocusStatistics failed %x\n", ret);
+                ret_val = -1;
+                goto OUT;
+            }
+        }
 
-        // fprintf(stderr, "border %d %d %d %d\n", border_top, border_bottom, border_left, border_right);
+        if (CVI_ISP_GetFrameID)
+            CVI_ISP_GetFrameID(ViPipe, &frame_id_after);
 
-        void* mapped_ptr = CVI_SYS_MmapCache(phyaddr, length);
-        //CVI_SYS_IonInvalidateCache(phyaddr, mapped_ptr, length);
+        if (frame_id_after == frame_id)
+            break;
+    }
 
-        const unsigned char* ptr = (const unsigned char*)mapped_ptr + border_top * stride + border_left;
+    {
+        stats->frame_id = frame_id;
+        stats->pts = CVI_ISP_GetFrameID ? frame_id_pts(frame_id) : 0;
 
-        // copy to bgrdata
-        int h2 = output_height;
-        int w2 = output_width * 3;
-        if (stride == output_width * 3)
+        // front end statistics of the long exposure, the only one without wdr
+        for (int y = 0; y < AE_ZONE_ROW; y++)
         {
-            h2 = 1;
-            w2 = output_height * output_width * 3;
+            for (int x = 0; x < AE_ZONE_COLUMN; x++)
+            {
+                stats->ae_luma[y * AE_ZONE_COLUMN + x] = bayer_luma(ae->au16FEZoneAvg[ISP_CHANNEL_LE][0][y][x]);
+            }
         }
+        stats->ae_global_luma = bayer_luma(ae->au16FEGlobalAvg[ISP_CHANNEL_LE][0]);
 
-        for (int i = 0; i < h2; i++)
+        memcpy(stats->awb_r, wb->au16ZoneAvgR, sizeof(stats->awb_r));
+        memcpy(stats->awb_g, wb->au16ZoneAvgG, sizeof(stats->awb_g));
+        memcpy(stats->awb_b, wb->au16ZoneAvgB, sizeof(stats->awb_b));
+
+        for (int y = 0; y < AF_ZONE_ROW; y++)
         {
-#if __riscv_vector
-            int j = 0;
-            int n = w2;
-            while (n > 0) {
-                size_t vl = vsetvl_e8m8(n);
-                vuint8m8_t bgr = vle8_v_u8m8(ptr + j, vl);
-                vse8_v_u8m8(bgrdata, bgr, vl);
-                bgrdata += vl;
-                j += vl;
-                n -= vl;
+            for (int x = 0; x < AF_ZONE_COLUMN; x++)
+            {
+                const ISP_FOCUS_ZONE_S& zone = af->stFEAFStat.stZoneMetrics[y][x];
+                stats->af_fv[y * AF_ZONE_COLUMN + x] = zone.u64h0 + zone.u64h1 + zone.u32v0;
             }
-#else
-            memcpy(bgrdata, ptr, w2);
-            bgrdata += w2;
-#endif
-
-            ptr += stride;
         }
-
-        CVI_SYS_Munmap(mapped_ptr, length);
     }
 
 OUT:
+    delete ae;
+    delete wb;
+    delete af;
+
+    return ret_val;
+}
+
+int capture_cvi_impl::pause()
+{
+    if (b_paused)
+        return 0;
 
-    if (b_vpss_frame_got)
+    if (!b_vi_pipe_started)
     {
-        //added by jj
-        if (retain_image_ptr)
-        {
-            image_ptr = new VIDEO_FRAME_INFO_S;
-            memcpy(image_ptr, &stFrameInfo_bgr, sizeof(VIDEO_FRAME_INFO_S));
-        }
-        CVI_S32 ret = CVI_VPSS_ReleaseChnFrame(VpssGrp, VpssChn, &stFrameInfo_bgr);
-        if (ret != CVI_SUCCESS)
-        {
-            fprintf(stderr, "CVI_VPSS_ReleaseChnFrame failed %x\n", ret);
-            ret_val = -1;
-        }
+        fprintf(stderr, "not streaming\n");
+        return -1;
+    }
+
+    int ret_val = 0;
 
-        b_vpss_frame_got = 0;
+    // the thread would only keep timing out on a parked sensor
+    paused_ring_size = 0;
+    paused_keep_raw = 0;
+    if (b_capture_thread_created)
+    {
+        paused_ring_size = ring_size;
+        paused_keep_raw = capture_keep_raw;
+
+        ret_val = stop_capture_thread();
     }
 
-    if (b_vi_frame_got)
     {
-        CVI_S32 ret = CVI_VI_ReleaseChnFrame(ViPipe, ViChn, &stFrameInfo);
+        CVI_S32 ret = CVI_VI_StopPipe(ViPipe);
         if (ret != CVI_SUCCESS)
         {
-            fprintf(stderr, "CVI_VI_ReleaseChnFrame failed %x\n", ret);
-            ret_val = -1;
+            fprintf(stderr, "CVI_VI_StopPipe failed %x\n", ret);
+            return -1;
         }
 
-        b_vi_frame_got = 0;
+        b_vi_pipe_started = 0;
+    }
+
+    if (pstSnsObj->pfnStandby)
+    {
+        pstSnsObj->pfnStandby(ViPipe);
     }
+
+    // whatever is still queued was shot before the pause
+    drain_frames();
+
+    // the gap across the pause is not an overrun
+    last_pts = 0;
+    pts_history_count = 0;
+
+    b_paused = 1;
+
     return ret_val;
 }
 
-//added by jj
-void* capture_cvi_impl::getImagePtr() {
-    return image_ptr;
-}
+int capture_cvi_impl::resume()
+{
+    if (!b_paused)
+        return 0;
 
-void* capture_cvi_impl::getOriginalImagePtr() {
-    return original_image_ptr;
-}
+    if (pstSnsObj->pfnRestart)
+    {
+        pstSnsObj->pfnRestart(ViPipe);
+    }
+
+    {
+        CVI_S32 ret = CVI_VI_StartPipe(ViPipe);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VI_StartPipe failed %x\n", ret);
+            return -1;
+        }
 
-void capture_cvi_impl::releaseImagePtr() {
-    if(image_ptr) {
-        free(image_ptr);
-        image_ptr = nullptr;
+        b_vi_pipe_started = 1;
     }
-    if(original_image_ptr) {
-        free(original_image_ptr);
-        original_image_ptr = nullptr;
+
+    b_paused = 0;
+
+    if (paused_ring_size != 0)
+    {
+        int ret = start_capture_thread(paused_ring_size, paused_keep_raw);
+        if (ret != 0)
+            return ret;
+
+        paused_ring_size = 0;
+        paused_keep_raw = 0;
     }
+
+    return 0;
 }
 
 int capture_cvi_impl::stop_streaming()
 {
     int ret_val = 0;
 
+    //added by jj
+    if (b_capture_thread_created)
+    {
+        ret_val = stop_capture_thread();
+    }
+
+    if (b_vi_vpss_bound)
+    {
+        MMF_CHN_S stSrcChn;
+        stSrcChn.enModId = CVI_ID_VI;
+        stSrcChn.s32DevId = ViPipe;
+        stSrcChn.s32ChnId = ViChn;
+
+        MMF_CHN_S stDestChn;
+        stDestChn.enModId = CVI_ID_VPSS;
+        stDestChn.s32DevId = VpssGrp;
+        stDestChn.s32ChnId = 0;
+
+        CVI_S32 ret = CVI_SYS_UnBind(&stSrcChn, &stDestChn);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_SYS_UnBind failed %x\n", ret);
+            ret_val = -1;
+        }
+
+        b_vi_vpss_bound = 0;
+    }
+
     if (b_vpss_grp_started)
     {
         CVI_S32 ret = CVI_VPSS_StopGrp(VpssGrp);
@@ -3997,54 +6204,33 @@ int capture_cvi_impl::close()
 
     ret_val = stop_streaming();
 
-    if (b_vpss_frame_got)
-    {
-        CVI_S32 ret = CVI_VPSS_ReleaseChnFrame(VpssGrp, VpssChn, &stFrameInfo_bgr);
-        if (ret != CVI_SUCCESS)
-        {
-            fprintf(stderr, "CVI_VPSS_ReleaseChnFrame failed %x\n", ret);
-            ret_val = -1;
-        }
-
-        b_vpss_frame_got = 0;
-    }
-
-    if (b_vi_frame_got)
-    {
-        CVI_S32 ret = CVI_VI_ReleaseChnFrame(ViPipe, ViChn, &stFrameInfo);
-        if (ret != CVI_SUCCESS)
-        {
-            fprintf(stderr, "CVI_VI_ReleaseChnFrame failed %x\n", ret);
-            ret_val = -1;
-        }
-
-        b_vi_frame_got = 0;
-    }
-
     // vpss exit
     {
-        if (b_vpss_vbpool_attached)
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
         {
-            CVI_S32 ret = CVI_VPSS_DetachVbPool(VpssGrp, VpssChn);
-            if (ret != CVI_SUCCESS)
+            if (b_vpss_vbpool_attached[i])
             {
-                fprintf(stderr, "CVI_VPSS_DetachVbPool failed %x\n", ret);
-                ret_val = -1;
-            }
+                CVI_S32 ret = CVI_VPSS_DetachVbPool(VpssGrp, i);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_DetachVbPool failed %x\n", ret);
+                    ret_val = -1;
+                }
 
-            b_vpss_vbpool_attached = 0;
-        }
+                b_vpss_vbpool_attached[i] = 0;
+            }
 
-        if (b_vpss_chn_enabled)
-        {
-            CVI_S32 ret = CVI_VPSS_DisableChn(VpssGrp, VpssChn);
-            if (ret != CVI_SUCCESS)
+            if (b_vpss_chn_enabled[i])
             {
-                fprintf(stderr, "CVI_VPSS_DisableChn failed %x\n", ret);
-                ret_val = -1;
-            }
+                CVI_S32 ret = CVI_VPSS_DisableChn(VpssGrp, i);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VPSS_DisableChn failed %x\n", ret);
+                    ret_val = -1;
+                }
 
-            b_vpss_chn_enabled = 0;
+                b_vpss_chn_enabled[i] = 0;
+            }
         }
 
         if (b_vpss_grp_created)
@@ -4169,6 +6355,11 @@ int capture_cvi_impl::close()
         b_sensor_set = 0;
     }
 
+    //added by jj
+    // the cached block mappings must go before their pools do
+    // a frame the caller still holds keeps its mapping until it is released
+    g_vb_map_cache.clear();
+
     // vb pool exit
     {
         if (b_vb_pool0_created)
@@ -4183,16 +6374,19 @@ int capture_cvi_impl::close()
             b_vb_pool0_created = 0;
         }
 
-        if (b_vb_pool1_created)
+        for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
         {
-            CVI_S32 ret = CVI_VB_DestroyPool(VbPool1);
-            if (ret != CVI_SUCCESS)
+            if (b_vb_pool_chn_created[i])
             {
-                fprintf(stderr, "CVI_VB_DestroyPool failed %x\n", ret);
-                ret_val = -1;
-            }
+                CVI_S32 ret = CVI_VB_DestroyPool(VbPoolChn[i]);
+                if (ret != CVI_SUCCESS)
+                {
+                    fprintf(stderr, "CVI_VB_DestroyPool failed %x\n", ret);
+                    ret_val = -1;
+                }
 
-            b_vb_pool1_created = 0;
+                b_vb_pool_chn_created[i] = 0;
+            }
         }
     }
 
@@ -4238,16 +6432,19 @@ int capture_cvi_impl::close()
     output_width = 0;
     output_height = 0;
 
+    options = capture_cvi_options();
+    stats = capture_cvi_stats();
+    mode = CAPTURE_CVI_MODE_STILL;
+    frame_interval_us = 0;
+    last_pts = 0;
+    pts_history_count = 0;
+
     b_vb_inited = 0;
     b_sys_inited = 0;
     b_sys_vi_opened = 0;
 
     b_vb_pool0_created = 0;
-    b_vb_pool1_created = 0;
-    b_vb_pool1_created = 0;
     VbPool0 = VB_INVALID_POOLID;
-    VbPool1 = VB_INVALID_POOLID;
-    VbPool1 = VB_INVALID_POOLID;
 
     b_sensor_set = 0;
 
@@ -4257,7 +6454,6 @@ int capture_cvi_impl::close()
     b_vi_pipe_created = 0;
     b_vi_pipe_started = 0;
     b_vi_chn_enabled = 0;
-    b_vi_frame_got = 0;
 
     ViDev = 0;
     ViPipe = 0;
@@ -4271,14 +6467,29 @@ int capture_cvi_impl::close()
     isp_thread = 0;
 
     b_vpss_grp_created = 0;
-    b_vpss_chn_enabled = 0;
-    b_vpss_vbpool_attached = 0;
     b_vpss_grp_started = 0;
-    b_vpss_frame_got = 0;
+    b_vi_vpss_bound = 0;
 
     VpssGrp = 0;
     // VpssGrp = CVI_VPSS_GetAvailableGrp();
-    VpssChn = VPSS_CHN0;
+
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+    {
+        stream_width[i] = 0;
+        stream_height[i] = 0;
+        stream_block_size[i] = 0;
+
+        stream_crop_x[i] = 0;
+        stream_crop_y[i] = 0;
+        stream_crop_width[i] = 0;
+        stream_crop_height[i] = 0;
+
+        b_vb_pool_chn_created[i] = 0;
+        VbPoolChn[i] = VB_INVALID_POOLID;
+
+        b_vpss_chn_enabled[i] = 0;
+        b_vpss_vbpool_attached[i] = 0;
+    }
 
     return ret_val;
 }
@@ -4319,9 +6530,9 @@ capture_cvi::~capture_cvi()
     delete d;
 }
 
-int capture_cvi::open(int width, int height, float fps)
+int capture_cvi::open(int width, int height, float fps, const capture_cvi_options& options)
 {
-    return d->open(width, height, fps);
+    return d->open(width, height, fps, options);
 }
 
 int capture_cvi::get_width() const
@@ -4344,21 +6555,195 @@ int capture_cvi::start_streaming()
     return d->start_streaming();
 }
 
+int capture_cvi::read_frame(unsigned char* bgrdata)
+{
+    if (d->b_capture_thread_created)
+    {
+        fprintf(stderr, "read_frame while the capture thread runs\n");
+        return -1;
+    }
+
+    return d->read_frame(bgrdata);
+}
+
 //added by jj
-int capture_cvi::read_frame(unsigned char* bgrdata, bool retain_image_ptr) {
-    return d->read_frame(bgrdata, retain_image_ptr);
+int capture_cvi::read_frame(capture_cvi_frame* frame, capture_cvi_frame* raw_frame)
+{
+    if (d->b_capture_thread_created)
+    {
+        fprintf(stderr, "read_frame while the capture thread runs\n");
+        return -1;
+    }
+
+    return d->read_frame(frame, raw_frame);
+}
+
+int capture_cvi::set_stream(int stream, int width, int height)
+{
+    if (stream < 0 || stream >= CAPTURE_CVI_STREAM_COUNT)
+    {
+        fprintf(stderr, "invalid stream %d\n", stream);
+        return -1;
+    }
+
+    if (width < -1 || height < -1 || (width == -1) != (height == -1))
+    {
+        fprintf(stderr, "invalid %s stream size %d x %d\n", stream_names[stream], width, height);
+        return -1;
+    }
+
+    if (stream == CAPTURE_CVI_STREAM_MAIN && width > 0)
+    {
+        fprintf(stderr, "bgr stream size follows open()\n");
+        return -1;
+    }
+
+    d->stream_config_width[stream] = width;
+    d->stream_config_height[stream] = height;
+    return 0;
+}
+
+int capture_cvi::set_stream_crop(int stream, int x, int y, int width, int height)
+{
+    if (stream < 0 || stream >= CAPTURE_CVI_STREAM_COUNT)
+    {
+        fprintf(stderr, "invalid stream %d\n", stream);
+        return -1;
+    }
+
+    return d->set_stream_crop(stream, x, y, width, height);
+}
+
+int capture_cvi::get_stream_crop(int stream, int* x, int* y, int* width, int* height) const
+{
+    if (stream < 0 || stream >= CAPTURE_CVI_STREAM_COUNT || d->stream_width[stream] == 0)
+        return -1;
+
+    *x = d->stream_crop_x[stream];
+    *y = d->stream_crop_y[stream];
+    *width = d->stream_crop_width[stream];
+    *height = d->stream_crop_height[stream];
+    return 0;
+}
+
+int capture_cvi::set_stream_size(int stream, int width, int height)
+{
+    if (stream < 0 || stream >= CAPTURE_CVI_STREAM_COUNT)
+    {
+        fprintf(stderr, "invalid stream %d\n", stream);
+        return -1;
+    }
+
+    return d->set_stream_size(stream, width, height);
+}
+
+int capture_cvi::set_mode(int mode)
+{
+    return d->set_mode(mode);
+}
+
+int capture_cvi::get_mode() const
+{
+    return d->mode;
+}
+
+int capture_cvi::get_stream_width(int stream) const
+{
+    if (stream < 0 || stream >= CAPTURE_CVI_STREAM_COUNT)
+        return 0;
+
+    return d->stream_width[stream];
+}
+
+int capture_cvi::get_stream_height(int stream) const
+{
+    if (stream < 0 || stream >= CAPTURE_CVI_STREAM_COUNT)
+        return 0;
+
+    return d->stream_height[stream];
 }
 
-void* capture_cvi::getImagePtr() {
-    return d->getImagePtr();
+int capture_cvi::read_frames(capture_cvi_frame** frames, capture_cvi_frame* raw_frame)
+{
+    if (d->b_capture_thread_created)
+    {
+        fprintf(stderr, "read_frames while the capture thread runs\n");
+        return -1;
+    }
+
+    return d->read_frames(frames, raw_frame);
+}
+
+int capture_cvi::start_capture_thread(int ring_size, int keep_raw)
+{
+    return d->start_capture_thread(ring_size, keep_raw);
+}
+
+int capture_cvi::stop_capture_thread()
+{
+    return d->stop_capture_thread();
+}
+
+int capture_cvi::pop_frames(capture_cvi_frame** frames, capture_cvi_frame* raw_frame, int timeout_ms)
+{
+    return d->pop_frames(frames, raw_frame, timeout_ms);
+}
+
+int capture_cvi::get_stats(capture_cvi_stats* stats) const
+{
+    // the capture thread counts while we read, every counter it touches is atomic
+    const capture_cvi_stats& src = d->stats;
+    stats->frames = __atomic_load_n(&src.frames, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&src.dropped, __ATOMIC_RELAXED);
+    stats->overrun = __atomic_load_n(&src.overrun, __ATOMIC_RELAXED);
+    stats->empty = __atomic_load_n(&src.empty, __ATOMIC_RELAXED);
+    stats->vi_lost = src.vi_lost;
+    stats->vi_vb_fail = src.vi_vb_fail;
+    stats->ring_full = __atomic_load_n(&src.ring_full, __ATOMIC_RELAXED);
+    stats->ion_bytes = src.ion_bytes;
+    stats->retain_denied = __atomic_load_n(&src.retain_denied, __ATOMIC_RELAXED);
+
+    g_vb_map_cache.get_stats(stats);
+
+    stats->retained = 0;
+    for (int i = 0; i < CAPTURE_CVI_STREAM_COUNT; i++)
+        stats->retained += __atomic_load_n(&g_retained_frames[i], __ATOMIC_RELAXED);
+
+    if (d->b_vi_chn_enabled)
+    {
+        VI_CHN_STATUS_S stChnStatus;
+        CVI_S32 ret = CVI_VI_QueryChnStatus(d->ViPipe, d->ViChn, &stChnStatus);
+        if (ret != CVI_SUCCESS)
+        {
+            fprintf(stderr, "CVI_VI_QueryChnStatus failed %x\n", ret);
+            return -1;
+        }
+
+        stats->vi_lost = stChnStatus.u32LostFrame;
+        stats->vi_vb_fail = stChnStatus.u32VbFail;
+    }
+
+    return 0;
 }
 
-void* capture_cvi::getOriginalImagePtr() {
-    return d->getOriginalImagePtr();
+int capture_cvi::retain(capture_cvi_frame* frame)
+{
+    return d->retain(frame);
+}
+
+int capture_cvi::get_3a_stats(capture_cvi_3a_stats* stats, int timeout_ms)
+{
+    return d->get_3a_stats(stats, timeout_ms);
 }
 
-void capture_cvi::releaseImagePtr() {
-    d->releaseImagePtr();
+int capture_cvi::pause()
+{
+    return d->pause();
+}
+
+int capture_cvi::resume()
+{
+    return d->resume();
 }
 
 int capture_cvi::stop_streaming()
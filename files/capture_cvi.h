@@ -19,8 +19,183 @@
 
 #include <vector>
 
+#include <pthread.h>
+
 namespace cv {
 
+//added by jj
+// vpss outputs served from the same vi frame, the stream index is the vpss chn
+enum
+{
+    CAPTURE_CVI_STREAM_MAIN = 0,    // bgr at the open() size, center cropped
+    CAPTURE_CVI_STREAM_TDL = 1,     // rgb planar letterboxed, for CVI_TDL_*
+    CAPTURE_CVI_STREAM_MOTION = 2,  // y only, for change detection
+    CAPTURE_CVI_STREAM_FULL = 3,    // nv21 at sensor size, for encoding
+    CAPTURE_CVI_STREAM_COUNT = 4
+};
+
+// how read_frame() picks from the vi queue
+enum
+{
+    CAPTURE_CVI_POLICY_FIFO = 0,    // oldest queued frame, wait up to timeout_ms for one
+    CAPTURE_CVI_POLICY_LATEST = 1,  // freshest queued frame, the older ones are dropped
+    CAPTURE_CVI_POLICY_QUEUE = 2    // oldest queued frame, return 1 at once when nothing is queued
+};
+
+// sensor timing, switchable at runtime with set_mode()
+enum
+{
+    CAPTURE_CVI_MODE_STILL = 0,     // full sensor rate, every stream
+    CAPTURE_CVI_MODE_PREVIEW = 1    // preview_fps, the full resolution stream is switched off unless preview_full
+};
+
+// buffering, fixed at open()
+// the driver keeps at most vi_depth frames queued and overwrites the oldest on overflow
+class capture_cvi_options
+{
+public:
+    capture_cvi_options();
+
+public:
+    int vb_count;       // blocks in the common pool feeding vi, 4
+    int chn_vb_count;   // blocks in each vpss chn pool, 2, plus retain_budget for the retain_streams
+    int vi_depth;       // frames queued on the vi chn, 1
+    int vpss_depth;     // frames queued on each vpss chn, 1
+    int policy;         // CAPTURE_CVI_POLICY_FIFO
+    int timeout_ms;     // 2000
+    int bind_vpss;      // bind vi to vpss so frames reach vpss without a user space round trip, 0
+                        // vi_depth may then be 0, the vi frame of a set is only there with vi_depth > 0
+                        // falls back to the round trip when libsys has no CVI_SYS_Bind
+    float preview_fps;  // sensor rate in CAPTURE_CVI_MODE_PREVIEW, 10
+    int preview_full;   // keep scaling the full resolution stream in CAPTURE_CVI_MODE_PREVIEW, 0
+    int retain_budget;  // frames per vpss chn that retain() lets the caller hold on to, 1
+                        // keep chn_vb_count above ring size + 2, the retained frames get blocks of their own
+    int retain_streams; // bit per CAPTURE_CVI_STREAM_* whose frames may be retained, all
+};
+
+class capture_cvi_stats
+{
+public:
+    capture_cvi_stats();
+
+public:
+    unsigned int frames;        // frames handed out
+    unsigned int dropped;       // queued frames skipped by CAPTURE_CVI_POLICY_LATEST, ring slots too
+    unsigned int overrun;       // frames never dequeued, estimated from pts gaps
+    unsigned int empty;         // reads that found nothing queued
+    unsigned int vi_lost;       // driver lost frame count
+    unsigned int vi_vb_fail;    // driver vb allocation failures
+    unsigned int ring_full;     // new frame sets dropped on a full ring, LATEST drops the oldest instead
+    unsigned int map_hits;      // frame maps served from an existing vb block mapping
+    unsigned int map_misses;    // frame maps that had to mmap the block
+    unsigned int map_evictions; // mappings dropped to stay within the cache size
+    unsigned int mapped_bytes;  // vb memory currently mapped into user space
+    unsigned int ion_bytes;     // vb memory reserved by open()
+    unsigned int retained;      // frames currently held through retain(), all chns
+    unsigned int retain_denied; // retain() calls refused, chn budget used up or not a retain stream
+};
+
+//added by jj
+// 3a statistics grids of the isp, row major
+enum
+{
+    CAPTURE_CVI_AE_ZONE_ROW = 30,
+    CAPTURE_CVI_AE_ZONE_COLUMN = 34,
+    CAPTURE_CVI_AWB_ZONE_ROW = 30,
+    CAPTURE_CVI_AWB_ZONE_COLUMN = 34,
+    CAPTURE_CVI_AF_ZONE_ROW = 15,
+    CAPTURE_CVI_AF_ZONE_COLUMN = 17
+};
+
+// what the isp measured on one sensor frame, computed in hardware while the frame passed through
+// it is the last frame the isp back end finished when read
+class capture_cvi_3a_stats
+{
+public:
+    capture_cvi_3a_stats();
+
+public:
+    // isp frame count of that frame, and the pts of the vi frame with the same count
+    // pts is 0 when the frame was never read and is too far ahead of the frames that were,
+    // or libisp has no CVI_ISP_GetFrameID
+    unsigned int frame_id;
+    unsigned long long pts;
+
+    // mean luma of each ae zone and of the whole frame before white balance, 10 bit
+    unsigned short ae_luma[CAPTURE_CVI_AE_ZONE_ROW * CAPTURE_CVI_AE_ZONE_COLUMN];
+    unsigned short ae_global_luma;
+
+    // mean r g b of each awb zone, 10 bit
+    unsigned short awb_r[CAPTURE_CVI_AWB_ZONE_ROW * CAPTURE_CVI_AWB_ZONE_COLUMN];
+    unsigned short awb_g[CAPTURE_CVI_AWB_ZONE_ROW * CAPTURE_CVI_AWB_ZONE_COLUMN];
+    unsigned short awb_b[CAPTURE_CVI_AWB_ZONE_ROW * CAPTURE_CVI_AWB_ZONE_COLUMN];
+
+    // high-pass filter energy of each af zone, horizontal and vertical summed, higher is sharper
+    unsigned long long af_fv[CAPTURE_CVI_AF_ZONE_ROW * CAPTURE_CVI_AF_ZONE_COLUMN];
+};
+
+// a vi or vpss frame held from the driver
+// the vb block stays owned by us until release() hands it back
+class capture_cvi_frame
+{
+public:
+    capture_cvi_frame();
+    ~capture_cvi_frame();
+
+    bool empty() const;
+
+    //added by jj
+    // plane holding the luma samples for yuv formats, -1 for anything else
+    int luma_plane() const;
+
+    // map all planes into user space on first call, 0 on failure
+    // block mappings are cached across frames and only invalidated on reuse
+    unsigned char* map();
+
+    void release();
+
+    // exchange the held frames, the map lock stays with each object
+    void swap(capture_cvi_frame& other);
+
+public:
+    int width;
+    int height;
+    int pixel_format;
+    unsigned long long pts;
+
+    int plane_count;
+    int stride[3];
+    int length[3];
+    unsigned long long phyaddr[3];
+    unsigned char* viraddr[3];
+
+    // plane geometry in bytes / rows, offset is the crop border into the plane
+    int plane_width[3];
+    int plane_height[3];
+    int plane_elemsize[3];
+    int plane_offset[3];
+
+    // VIDEO_FRAME_INFO_S, suitable for passing to CVI_TDL_* / CVI_VENC_*
+    void* frame_info;
+
+    // 1 = vi chn, 2 = vpss chn
+    int source;
+    int dev;
+    int chn;
+
+    //added by jj
+    // counted against retain_budget until release()
+    int retained;
+
+private:
+    capture_cvi_frame(const capture_cvi_frame&);
+    capture_cvi_frame& operator=(const capture_cvi_frame&);
+
+    pthread_mutex_t map_lock;
+    void* mapped_ptr;
+    int mapped_length;
+};
+
 class capture_cvi_impl;
 class capture_cvi
 {
@@ -30,7 +205,7 @@ public:
     capture_cvi();
     ~capture_cvi();
 
-    int open(int width = 1920, int height = 1080, float fps = 30);
+    int open(int width = 1920, int height = 1080, float fps = 30, const capture_cvi_options& options = capture_cvi_options());
 
     int get_width() const;
     int get_height() const;
@@ -38,23 +213,74 @@ public:
 
     int start_streaming();
 
-    //modified by jj
-    int read_frame(unsigned char* bgrdata, bool retain_image_ptr);
+    int read_frame(unsigned char* bgrdata);
 
-    int stop_streaming();
+    //added by jj
+    // zero-copy read, frame receives the vpss output and raw_frame the vi frame it was made from
+    // raw_frame may be null, then the vi frame is handed back right away
+    int read_frame(capture_cvi_frame* frame, capture_cvi_frame* raw_frame);
 
-    int close();
+    // call before open(), 0 x 0 disables the stream and -1 x -1 picks its default size
+    // only the main stream is enabled by default, its size always follows open()
+    int set_stream(int stream, int width, int height);
+
+    // resolved size after open(), 0 for disabled streams
+    int get_stream_width(int stream) const;
+    int get_stream_height(int stream) const;
+
+    // after open(), change the sensor area a stream is scaled from, in sensor pixels
+    // 0 x 0 restores the whole view, coordinates are rounded down to even
+    int set_stream_crop(int stream, int x, int y, int width, int height);
+    int get_stream_crop(int stream, int* x, int* y, int* width, int* height) const;
+
+    // after open(), rescale a stream within the vb block size it was opened with
+    // the main stream always follows open()
+    int set_stream_size(int stream, int width, int height);
+
+    // CAPTURE_CVI_MODE_STILL after open(), a running capture thread keeps running
+    // sets already in its ring are handed out first, the full stream stays empty in
+    // sets of the preview mode
+    int set_mode(int mode);
+    int get_mode() const;
+
+    // one vi frame through all enabled streams, frames has CAPTURE_CVI_STREAM_COUNT entries
+    // null entries are fetched and dropped, entries of disabled streams are left empty
+    int read_frames(capture_cvi_frame** frames, capture_cvi_frame* raw_frame);
+
+    int get_stats(capture_cvi_stats* stats) const;
 
     //added by jj
-    void* getImagePtr();
-    void* getOriginalImagePtr();
-    void releaseImagePtr();
+    // count a vpss frame against its chn retain_budget so it may be held past later reads,
+    // 0 when retained, 1 when the budget is used up or the chn is not in retain_streams
+    // and the frame should be released soon
+    int retain(capture_cvi_frame* frame);
+
+    // after open(), the 3a statistics of the latest frame the isp finished
+    // timeout_ms > 0 first waits up to that long for the next frame to finish, returns 1 on timeout
+    int get_3a_stats(capture_cvi_3a_stats* stats, int timeout_ms);
+
+    // background capture, a thread reads frame sets ahead into a ring of ring_size slots
+    // keep_raw also holds the vi frame in every slot, one common pool block each
+    // read_frame() and read_frames() are unavailable while the thread runs
+    int start_capture_thread(int ring_size, int keep_raw);
+    int stop_capture_thread();
+
+    // take the oldest slot, or skip to the newest under CAPTURE_CVI_POLICY_LATEST
+    // single consumer only, timeout_ms 0 polls and -1 waits forever, returns 1 on timeout
+    int pop_frames(capture_cvi_frame** frames, capture_cvi_frame* raw_frame, int timeout_ms);
+
+    // stop the vi pipe and put the sensor in standby, vb pools, isp and vpss stay alive
+    // frames already handed out stay valid, a running capture thread is stopped and
+    // restarted by resume()
+    int pause();
+    int resume();
+
+    int stop_streaming();
+
+    int close();
 
 private:
     capture_cvi_impl* const d;
-    //added by jj
-    void* image_ptr;
-    void* original_image_ptr;
 };
 
 } // namespace cv
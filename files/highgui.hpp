@@ -59,6 +59,47 @@ enum VideoCaptureProperties
     CAP_PROP_FRAME_WIDTH        = 3,
     CAP_PROP_FRAME_HEIGHT       = 4,
     CAP_PROP_FPS                = 5,
+    //added by jj
+    CAP_PROP_BUFFERSIZE         = 38,       // frames queued in the driver
+
+    // buffering, set before open
+    CAP_PROP_CVI_VB_COUNT       = 0x1000,   // blocks in the pool feeding the sensor
+    CAP_PROP_CVI_CHN_VB_COUNT   = 0x1001,   // blocks per output stream pool
+    CAP_PROP_CVI_POLICY         = 0x1002,   // VideoCapturePolicies
+    CAP_PROP_CVI_TIMEOUT        = 0x1003,   // read timeout in ms
+    CAP_PROP_CVI_BIND_VPSS      = 0x1004,   // feed vpss from vi in hardware
+    CAP_PROP_CVI_PREVIEW_FPS    = 0x1005,   // sensor rate in CAP_MODE_PREVIEW
+    CAP_PROP_CVI_PREVIEW_FULL   = 0x1006,   // keep CAP_STREAM_FULL in CAP_MODE_PREVIEW
+    CAP_PROP_CVI_RETAIN_BUDGET  = 0x1007,   // frames per stream VideoCapture::retain accepts
+    CAP_PROP_CVI_RETAIN_STREAMS = 0x1008,   // bit per VideoCaptureStreams that may be retained, the pool of each
+                                            // gets CAP_PROP_CVI_RETAIN_BUDGET blocks on top of CAP_PROP_CVI_CHN_VB_COUNT
+
+    // counters, read only
+    CAP_PROP_CVI_FRAMES         = 0x1100,
+    CAP_PROP_CVI_DROPPED        = 0x1101,
+    CAP_PROP_CVI_OVERRUN        = 0x1102,
+    CAP_PROP_CVI_EMPTY          = 0x1103,
+    CAP_PROP_CVI_VI_LOST        = 0x1104,
+    CAP_PROP_CVI_ION_BYTES      = 0x1105,
+    CAP_PROP_CVI_MAP_HITS       = 0x1106,
+    CAP_PROP_CVI_MAP_MISSES     = 0x1107,
+    CAP_PROP_CVI_RETAINED       = 0x1108,
+    CAP_PROP_CVI_RETAIN_DENIED  = 0x1109,
+};
+
+//added by jj
+// sensor timing, see VideoCapture::set_mode
+enum VideoCaptureModes
+{
+    CAP_MODE_STILL              = 0,    // full sensor rate, every stream
+    CAP_MODE_PREVIEW            = 1,    // reduced rate, CAP_STREAM_FULL stays empty unless CAP_PROP_CVI_PREVIEW_FULL
+};
+
+enum VideoCapturePolicies
+{
+    CAP_POLICY_FIFO             = 0,    // every queued frame in order, reads block
+    CAP_POLICY_LATEST           = 1,    // freshest frame only, older ones are dropped
+    CAP_POLICY_QUEUE            = 2,    // every queued frame in order, reads never block
 };
 
 CV_EXPORTS_W Mat imread(const String& filename, int flags = IMREAD_COLOR);
@@ -73,6 +114,105 @@ CV_EXPORTS_W void imshow(const String& winname, InputArray mat);
 
 CV_EXPORTS_W int waitKey(int delay = 0);
 
+//added by jj
+// a captured frame that still sits in the driver buffer, nothing is copied
+// move-only, use share() to hand out extra references, the buffer returns to
+// the capture pipeline once the last reference is released
+class FrameRefImpl;
+class CV_EXPORTS_W FrameRef
+{
+public:
+    FrameRef();
+
+    ~FrameRef();
+
+    FrameRef(FrameRef&& other);
+
+    FrameRef& operator=(FrameRef&& other);
+
+    FrameRef share() const;
+
+    void release();
+
+    bool empty() const;
+
+    int refcount() const;
+
+    int width() const;
+
+    int height() const;
+
+    // backend pixel format, PIXEL_FORMAT_E on cvi
+    int pixel_format() const;
+
+    int plane_count() const;
+
+    int stride(int plane = 0) const;
+
+    unsigned long long phy_addr(int plane = 0) const;
+
+    // mapped into user space on first access
+    unsigned char* vir_addr(int plane = 0) const;
+
+    // presentation timestamp in microseconds
+    unsigned long long pts() const;
+
+    // Mat header over one plane, valid while this reference is held
+    Mat mat(int plane = 0) const;
+
+    // CV_8UC1 header over the luma plane of a yuv frame with its real stride, no copy
+    // empty for rgb frames, valid while this reference is held
+    Mat gray() const;
+
+    // VIDEO_FRAME_INFO_S on cvi, 0 elsewhere
+    void* frame_info() const;
+
+private:
+    FrameRef(const FrameRef&) = delete;
+    FrameRef& operator=(const FrameRef&) = delete;
+
+    explicit FrameRef(FrameRefImpl* impl);
+
+    FrameRefImpl* d;
+
+    friend class VideoCapture;
+};
+
+//added by jj
+// outputs produced from one sensor frame, see VideoCapture::set_stream
+enum VideoCaptureStreams
+{
+    CAP_STREAM_MAIN             = 0,    // bgr at the open size
+    CAP_STREAM_TDL              = 1,    // rgb planar letterboxed, for detection
+    CAP_STREAM_MOTION           = 2,    // y only, for change detection
+    CAP_STREAM_FULL             = 3,    // nv21 at sensor size, for encoding
+    CAP_STREAM_COUNT            = 4
+};
+
+struct CV_EXPORTS_W FrameSet
+{
+    FrameRef main;
+    FrameRef tdl;
+    FrameRef motion;
+    FrameRef full;
+    FrameRef raw;       // empty when vi is bound to vpss, see CAP_PROP_CVI_BIND_VPSS
+
+    void release();
+};
+
+//added by jj
+// 3a statistics the isp computed in hardware on one sensor frame, see VideoCapture::read_isp_stats
+// each grid spans the whole sensor view, zone (0, 0) is top left. They belong to the frame the isp
+// finished last, wait for the next one with read_isp_stats timeout_ms
+struct CV_EXPORTS_W IspStats
+{
+    unsigned long long pts;     // FrameRef::pts of that frame, 0 when it cannot be told
+    Mat ae_luma;                // CV_16UC1 30 x 34, mean luma per zone before white balance, 10 bit
+    Mat awb;                    // CV_16UC3 30 x 34, mean r g b per zone, 10 bit
+    Mat af;                     // CV_32FC1 15 x 17, focus value per zone, higher is sharper
+    int global_luma;            // mean luma of the frame, 10 bit
+};
+
 class VideoCaptureImpl;
 class CV_EXPORTS_W VideoCapture
 {
@@ -90,14 +230,58 @@ public:
     VideoCapture& operator>>(Mat& bgr_image);
 
     //added by jj
-    std::pair<void*, void*> capture(Mat& image);
-    void releaseImagePtr();
+    // zero-copy read, frame is the scaled output and raw_frame the sensor frame it came from
+    bool capture(FrameRef& frame);
+    bool capture(FrameRef& frame, FrameRef& raw_frame);
+
+    // call before open, 0 x 0 disables a stream and -1 x -1 picks its default size
+    bool set_stream(int stream, int width, int height);
+
+    // call after open, takes effect from the next frame
+    // roi is in sensor pixels, an empty roi restores the whole view
+    bool set_crop(int stream, const Rect& roi);
+    Rect get_crop(int stream) const;
+
+    // call after open, at most the size the stream was opened with
+    bool set_output_size(int stream, int width, int height);
+
+    // VideoCaptureModes, switch after open, sets the capture thread already queued come first
+    bool set_mode(int mode);
+    int get_mode() const;
+
+    // one sensor frame through every enabled stream, disabled ones stay empty
+    // pops from the ring while the capture thread runs
+    bool read_frames(FrameSet& frames);
+
+    // background capture, a thread reads frame sets ahead into a ring of ring_size entries
+    // keep_raw also keeps the sensor frame of every set
+    bool start_capture_thread(int ring_size = 2, bool keep_raw = false);
+
+    void stop_capture_thread();
+
+    // next set from the ring, timeout_ms 0 polls and -1 waits forever
+    bool pop_frames(FrameSet& frames, int timeout_ms = -1);
+
+    // park the sensor without tearing the pipeline down, reads fail until resume
+    bool pause();
+    bool resume();
+
+    // hold a frame past the next reads, e.g. until a slow stage decides whether to keep it
+    // false when its stream already holds CAP_PROP_CVI_RETAIN_BUDGET frames or is not one of
+    // CAP_PROP_CVI_RETAIN_STREAMS, release it soon then
+    bool retain(FrameRef& frame);
+
+    // 3a statistics of the latest frame the isp finished, no pixel is touched on the cpu
+    // timeout_ms > 0 first waits for the next frame, 0 returns what the last one left
+    bool read_isp_stats(IspStats& stats, int timeout_ms = 0);
 
     bool set(int propId, double value);
 
     double get(int propId) const;
 
 private:
+    bool fetch_frames(FrameSet& frames, bool pop, int timeout_ms);
+
     VideoCaptureImpl* const d;
     
 };
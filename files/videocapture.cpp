@@ -57,6 +57,9 @@ public:
 #endif
 #if CV_WITH_CVI
     capture_cvi cap_cvi;
+    //added by jj
+    capture_cvi_options cvi_options;
+    bool capture_thread_started;
 #endif
 #if defined __linux__
     capture_v4l2 cap_v4l2;
@@ -69,6 +72,238 @@ VideoCaptureImpl::VideoCaptureImpl()
     width = 640;
     height = 480;
     fps = 30;
+#if CV_WITH_CVI
+    capture_thread_started = false;
+#endif
+}
+
+//added by jj
+class FrameRefImpl
+{
+public:
+    FrameRefImpl();
+
+public:
+    int refcount;
+
+#if CV_WITH_CVI
+    capture_cvi_frame frame;
+#endif
+    // backends without driver buffers fall back to a plain copy
+    Mat image;
+};
+
+FrameRefImpl::FrameRefImpl()
+{
+    refcount = 1;
+}
+
+FrameRef::FrameRef() : d(0)
+{
+}
+
+FrameRef::FrameRef(FrameRefImpl* impl) : d(impl)
+{
+}
+
+FrameRef::~FrameRef()
+{
+    release();
+}
+
+FrameRef::FrameRef(FrameRef&& other) : d(other.d)
+{
+    other.d = 0;
+}
+
+FrameRef& FrameRef::operator=(FrameRef&& other)
+{
+    if (this != &other)
+    {
+        release();
+        d = other.d;
+        other.d = 0;
+    }
+    return *this;
+}
+
+FrameRef FrameRef::share() const
+{
+    if (d)
+        CV_XADD(&d->refcount, 1);
+    return FrameRef(d);
+}
+
+void FrameRef::release()
+{
+    if (d && CV_XADD(&d->refcount, -1) == 1)
+        delete d;
+    d = 0;
+}
+
+bool FrameRef::empty() const
+{
+    if (!d)
+        return true;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+        return false;
+#endif
+    return d->image.empty();
+}
+
+int FrameRef::refcount() const
+{
+    return d ? d->refcount : 0;
+}
+
+int FrameRef::width() const
+{
+    if (!d)
+        return 0;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+        return d->frame.width;
+#endif
+    return d->image.cols;
+}
+
+int FrameRef::height() const
+{
+    if (!d)
+        return 0;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+        return d->frame.height;
+#endif
+    return d->image.rows;
+}
+
+int FrameRef::pixel_format() const
+{
+    if (!d)
+        return -1;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+        return d->frame.pixel_format;
+#endif
+    return d->image.type();
+}
+
+int FrameRef::plane_count() const
+{
+    if (!d)
+        return 0;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+        return d->frame.plane_count;
+#endif
+    return d->image.empty() ? 0 : 1;
+}
+
+int FrameRef::stride(int plane) const
+{
+    if (!d || plane < 0 || plane >= plane_count())
+        return 0;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+        return d->frame.stride[plane];
+#endif
+    return (int)d->image.step[0];
+}
+
+unsigned long long FrameRef::phy_addr(int plane) const
+{
+    if (!d || plane < 0 || plane >= plane_count())
+        return 0;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+        return d->frame.phyaddr[plane];
+#endif
+    return 0;
+}
+
+unsigned char* FrameRef::vir_addr(int plane) const
+{
+    if (!d || plane < 0 || plane >= plane_count())
+        return 0;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+    {
+        if (!d->frame.map())
+            return 0;
+        return d->frame.viraddr[plane];
+    }
+#endif
+    return d->image.data;
+}
+
+unsigned long long FrameRef::pts() const
+{
+    if (!d)
+        return 0;
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+        return d->frame.pts;
+#endif
+    return 0;
+}
+
+Mat FrameRef::mat(int plane) const
+{
+    if (!d || plane < 0 || plane >= plane_count())
+        return Mat();
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+    {
+        if (!d->frame.map())
+            return Mat();
+
+        const capture_cvi_frame& f = d->frame;
+        return Mat(f.plane_height[plane], f.plane_width[plane], CV_MAKETYPE(CV_8U, f.plane_elemsize[plane]), f.viraddr[plane] + f.plane_offset[plane], f.stride[plane]);
+    }
+#endif
+    return d->image;
+}
+
+Mat FrameRef::gray() const
+{
+    if (!d)
+        return Mat();
+#if CV_WITH_CVI
+    if (!d->frame.empty())
+    {
+        const int plane = d->frame.luma_plane();
+        if (plane < 0)
+            return Mat();
+
+        return mat(plane);
+    }
+#endif
+    if (d->image.channels() != 1)
+        return Mat();
+
+    return d->image;
+}
+
+void* FrameRef::frame_info() const
+{
+    if (!d)
+        return 0;
+#if CV_WITH_CVI
+    return d->frame.frame_info;
+#else
+    return 0;
+#endif
+}
+
+void FrameSet::release()
+{
+    main.release();
+    tdl.release();
+    motion.release();
+    full.release();
+    raw.release();
 }
 
 VideoCapture::VideoCapture() : d(new VideoCaptureImpl)
@@ -138,7 +373,7 @@ bool VideoCapture::open(int index)
 #if CV_WITH_CVI
     if (capture_cvi::supported())
     {
-        int ret = d->cap_cvi.open(d->width, d->height, d->fps);
+        int ret = d->cap_cvi.open(d->width, d->height, d->fps, d->cvi_options);
         if (ret == 0)
         {
             d->width = d->cap_cvi.get_width();
@@ -197,6 +432,9 @@ void VideoCapture::release()
     if (!d->is_opened)
         return;
 
+    //added by jj
+    stop_capture_thread();
+
 #if CV_WITH_AW
     if (capture_v4l2_aw_isp::supported())
     {
@@ -243,55 +481,386 @@ void VideoCapture::release()
 }
 
 //added by jj
-std::pair<void*, void*> VideoCapture::capture(Mat& image) {
+bool VideoCapture::capture(FrameRef& frame)
+{
+    frame.release();
+
     if (!d->is_opened)
-        return {};
+        return false;
 
-#if CV_WITH_AW
-    if (capture_v4l2_aw_isp::supported())
-    {
-        image.create(d->height, d->width, CV_8UC3);
+    FrameRefImpl* impl = new FrameRefImpl;
 
-        d->cap_v4l2_aw_isp.read_frame((unsigned char*)image.data);
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        if (d->cap_cvi.read_frame(&impl->frame, 0) != 0)
+        {
+            delete impl;
+            return false;
+        }
     }
     else
 #endif
-#if CV_WITH_RK
-    if (capture_v4l2_rk_aiq::supported())
     {
-        image.create(d->height, d->width, CV_8UC3);
+        *this >> impl->image;
 
-        d->cap_v4l2_rk_aiq.read_frame((unsigned char*)image.data);
+        if (impl->image.empty())
+        {
+            delete impl;
+            return false;
+        }
+    }
+
+    frame = FrameRef(impl);
+    return true;
+}
+
+bool VideoCapture::capture(FrameRef& frame, FrameRef& raw_frame)
+{
+    frame.release();
+    raw_frame.release();
+
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        FrameRefImpl* impl = new FrameRefImpl;
+        FrameRefImpl* raw_impl = new FrameRefImpl;
+
+        if (d->cap_cvi.read_frame(&impl->frame, &raw_impl->frame) != 0)
+        {
+            delete impl;
+            delete raw_impl;
+            return false;
+        }
+
+        frame = FrameRef(impl);
+        raw_frame = FrameRef(raw_impl);
+        return true;
     }
-    else
 #endif
+
+    // no separate sensor frame on the other backends
+    if (!capture(frame))
+        return false;
+
+    raw_frame = frame.share();
+    return true;
+}
+
+bool VideoCapture::set_stream(int stream, int width, int height)
+{
+    if (d->is_opened)
+        return false;
+
 #if CV_WITH_CVI
     if (capture_cvi::supported())
     {
-        image.create(d->height, d->width, CV_8UC3);
-        d->cap_cvi.read_frame((unsigned char*)image.data, true);
-        void* image_ptr = d->cap_cvi.getImagePtr();
-        void* original_image_ptr = d->cap_cvi.getOriginalImagePtr();
-        return std::make_pair(image_ptr, original_image_ptr);
+        return d->cap_cvi.set_stream(stream, width, height) == 0;
     }
-    else
 #endif
-#if defined __linux__
-    if (capture_v4l2::supported())
+
+    // the other backends only have the main stream
+    if (stream == CAP_STREAM_MAIN)
+        return width == -1 && height == -1;
+
+    return width == 0 && height == 0;
+}
+
+bool VideoCapture::set_crop(int stream, const Rect& roi)
+{
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
     {
-        image.create(d->height, d->width, CV_8UC3);
+        return d->cap_cvi.set_stream_crop(stream, roi.x, roi.y, roi.width, roi.height) == 0;
+    }
+#endif
 
-        d->cap_v4l2.read_frame((unsigned char*)image.data);
+    return false;
+}
+
+Rect VideoCapture::get_crop(int stream) const
+{
+    if (!d->is_opened)
+        return Rect();
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+        if (d->cap_cvi.get_stream_crop(stream, &x, &y, &width, &height) != 0)
+            return Rect();
+
+        return Rect(x, y, width, height);
     }
-    else
 #endif
+
+    return Rect();
+}
+
+bool VideoCapture::set_output_size(int stream, int width, int height)
+{
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        return d->cap_cvi.set_stream_size(stream, width, height) == 0;
+    }
+#endif
+
+    return false;
+}
+
+bool VideoCapture::set_mode(int mode)
+{
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        return d->cap_cvi.set_mode(mode) == 0;
+    }
+#endif
+
+    return mode == CAP_MODE_STILL;
+}
+
+int VideoCapture::get_mode() const
+{
+#if CV_WITH_CVI
+    if (d->is_opened && capture_cvi::supported())
+    {
+        return d->cap_cvi.get_mode();
+    }
+#endif
+
+    return CAP_MODE_STILL;
+}
+
+bool VideoCapture::read_frames(FrameSet& frames)
+{
+#if CV_WITH_CVI
+    if (d->capture_thread_started)
+        return fetch_frames(frames, true, -1);
+#endif
+
+    return fetch_frames(frames, false, 0);
+}
+
+bool VideoCapture::start_capture_thread(int ring_size, bool keep_raw)
+{
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
     {
+        if (d->cap_cvi.start_capture_thread(ring_size, keep_raw ? 1 : 0) != 0)
+            return false;
+
+        d->capture_thread_started = true;
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+void VideoCapture::stop_capture_thread()
+{
+#if CV_WITH_CVI
+    if (d->capture_thread_started)
+    {
+        d->cap_cvi.stop_capture_thread();
+        d->capture_thread_started = false;
+    }
+#endif
+}
+
+bool VideoCapture::pause()
+{
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        return d->cap_cvi.pause() == 0;
+    }
+#endif
+
+    return false;
+}
+
+bool VideoCapture::resume()
+{
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        return d->cap_cvi.resume() == 0;
+    }
+#endif
+
+    return false;
+}
+
+bool VideoCapture::retain(FrameRef& frame)
+{
+    if (frame.empty())
+        return false;
+
+#if CV_WITH_CVI
+    if (!frame.d->frame.empty())
+    {
+        return d->cap_cvi.retain(&frame.d->frame) == 0;
+    }
+#endif
+
+    // a copied frame holds no driver buffer
+    return true;
+}
+
+bool VideoCapture::read_isp_stats(IspStats& stats, int timeout_ms)
+{
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        capture_cvi_3a_stats* s = new capture_cvi_3a_stats;
+        if (d->cap_cvi.get_3a_stats(s, timeout_ms) != 0)
+        {
+            delete s;
+            return false;
+        }
+
+        stats.pts = s->pts;
+        stats.global_luma = s->ae_global_luma;
+        Mat(CAPTURE_CVI_AE_ZONE_ROW, CAPTURE_CVI_AE_ZONE_COLUMN, CV_16UC1, s->ae_luma).copyTo(stats.ae_luma);
+
+        stats.awb.create(CAPTURE_CVI_AWB_ZONE_ROW, CAPTURE_CVI_AWB_ZONE_COLUMN, CV_16UC3);
+        for (int y = 0; y < CAPTURE_CVI_AWB_ZONE_ROW; y++)
+        {
+            unsigned short* p = stats.awb.ptr<unsigned short>(y);
+            for (int x = 0; x < CAPTURE_CVI_AWB_ZONE_COLUMN; x++)
+            {
+                const int i = y * CAPTURE_CVI_AWB_ZONE_COLUMN + x;
+                p[x * 3] = s->awb_r[i];
+                p[x * 3 + 1] = s->awb_g[i];
+                p[x * 3 + 2] = s->awb_b[i];
+            }
+        }
+
+        stats.af.create(CAPTURE_CVI_AF_ZONE_ROW, CAPTURE_CVI_AF_ZONE_COLUMN, CV_32FC1);
+        for (int y = 0; y < CAPTURE_CVI_AF_ZONE_ROW; y++)
+        {
+            float* p = stats.af.ptr<float>(y);
+            for (int x = 0; x < CAPTURE_CVI_AF_ZONE_COLUMN; x++)
+            {
+                p[x] = (float)s->af_fv[y * CAPTURE_CVI_AF_ZONE_COLUMN + x];
+            }
+        }
+
+        delete s;
+        return true;
     }
-    return {};
+#endif
+
+    return false;
 }
 
-void VideoCapture::releaseImagePtr() {
-    return d->cap_cvi.releaseImagePtr();
+bool VideoCapture::pop_frames(FrameSet& frames, int timeout_ms)
+{
+#if CV_WITH_CVI
+    if (d->capture_thread_started)
+        return fetch_frames(frames, true, timeout_ms);
+#endif
+
+    frames.release();
+    return false;
+}
+
+bool VideoCapture::fetch_frames(FrameSet& frames, bool pop, int timeout_ms)
+{
+    frames.release();
+
+    if (!d->is_opened)
+        return false;
+
+#if CV_WITH_CVI
+    if (capture_cvi::supported())
+    {
+        FrameRef* refs[CAP_STREAM_COUNT] = { &frames.main, &frames.tdl, &frames.motion, &frames.full };
+
+        FrameRefImpl* impls[CAP_STREAM_COUNT] = { 0, 0, 0, 0 };
+        capture_cvi_frame* cvi_frames[CAP_STREAM_COUNT] = { 0, 0, 0, 0 };
+        for (int i = 0; i < CAP_STREAM_COUNT; i++)
+        {
+            if (d->cap_cvi.get_stream_width(i) == 0)
+                continue;
+
+            impls[i] = new FrameRefImpl;
+            cvi_frames[i] = &impls[i]->frame;
+        }
+
+        FrameRefImpl* raw_impl = new FrameRefImpl;
+
+        // with vi bound to vpss the sensor frame costs an extra dequeue, use capture(frame, raw_frame) for it
+        capture_cvi_frame* raw_frame = d->cvi_options.bind_vpss ? 0 : &raw_impl->frame;
+
+        int ret = pop ? d->cap_cvi.pop_frames(cvi_frames, &raw_impl->frame, timeout_ms)
+                      : d->cap_cvi.read_frames(cvi_frames, raw_frame);
+        if (ret != 0)
+        {
+            for (int i = 0; i < CAP_STREAM_COUNT; i++)
+                delete impls[i];
+            delete raw_impl;
+            return false;
+        }
+
+        for (int i = 0; i < CAP_STREAM_COUNT; i++)
+        {
+            // streams switched off by the capture mode come back empty
+            if (impls[i] && impls[i]->frame.empty())
+            {
+                delete impls[i];
+                impls[i] = 0;
+            }
+
+            if (impls[i])
+                *refs[i] = FrameRef(impls[i]);
+        }
+
+        // the ring only carries the sensor frame with keep_raw
+        if (raw_impl->frame.empty())
+            delete raw_impl;
+        else
+            frames.raw = FrameRef(raw_impl);
+
+        return true;
+    }
+#endif
+
+    if (!capture(frames.main))
+        return false;
+
+    frames.raw = frames.main.share();
+    return true;
 }
 
 VideoCapture& VideoCapture::operator>>(Mat& image)
@@ -322,7 +891,7 @@ VideoCapture& VideoCapture::operator>>(Mat& image)
     {
         image.create(d->height, d->width, CV_8UC3);
 
-        d->cap_cvi.read_frame((unsigned char*)image.data, false);
+        d->cap_cvi.read_frame((unsigned char*)image.data);
     }
     else
 #endif
@@ -360,6 +929,69 @@ bool VideoCapture::set(int propId, double value)
         return true;
     }
 
+    //added by jj
+#if CV_WITH_CVI
+    if (propId == CAP_PROP_BUFFERSIZE)
+    {
+        d->cvi_options.vi_depth = (int)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_VB_COUNT)
+    {
+        d->cvi_options.vb_count = (int)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_CHN_VB_COUNT)
+    {
+        d->cvi_options.chn_vb_count = (int)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_POLICY)
+    {
+        d->cvi_options.policy = (int)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_TIMEOUT)
+    {
+        d->cvi_options.timeout_ms = (int)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_BIND_VPSS)
+    {
+        d->cvi_options.bind_vpss = (int)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_PREVIEW_FPS)
+    {
+        d->cvi_options.preview_fps = (float)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_PREVIEW_FULL)
+    {
+        d->cvi_options.preview_full = (int)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_RETAIN_BUDGET)
+    {
+        d->cvi_options.retain_budget = (int)value;
+        return true;
+    }
+
+    if (propId == CAP_PROP_CVI_RETAIN_STREAMS)
+    {
+        d->cvi_options.retain_streams = (int)value;
+        return true;
+    }
+#endif
+
     fprintf(stderr, "ignore unsupported cv cap propId %d = %f\n", propId, value);
     return true;
 }
@@ -381,6 +1013,57 @@ double VideoCapture::get(int propId) const
         return (double)d->fps;
     }
 
+    //added by jj
+#if CV_WITH_CVI
+    if (propId == CAP_PROP_BUFFERSIZE)
+        return (double)d->cvi_options.vi_depth;
+
+    if (propId == CAP_PROP_CVI_VB_COUNT)
+        return (double)d->cvi_options.vb_count;
+
+    if (propId == CAP_PROP_CVI_CHN_VB_COUNT)
+        return (double)d->cvi_options.chn_vb_count;
+
+    if (propId == CAP_PROP_CVI_POLICY)
+        return (double)d->cvi_options.policy;
+
+    if (propId == CAP_PROP_CVI_TIMEOUT)
+        return (double)d->cvi_options.timeout_ms;
+
+    if (propId == CAP_PROP_CVI_BIND_VPSS)
+        return (double)d->cvi_options.bind_vpss;
+
+    if (propId == CAP_PROP_CVI_PREVIEW_FPS)
+        return (double)d->cvi_options.preview_fps;
+
+    if (propId == CAP_PROP_CVI_PREVIEW_FULL)
+        return (double)d->cvi_options.preview_full;
+
+    if (propId == CAP_PROP_CVI_RETAIN_BUDGET)
+        return (double)d->cvi_options.retain_budget;
+
+    if (propId == CAP_PROP_CVI_RETAIN_STREAMS)
+        return (double)d->cvi_options.retain_streams;
+
+    if (propId >= CAP_PROP_CVI_FRAMES && propId <= CAP_PROP_CVI_RETAIN_DENIED)
+    {
+        capture_cvi_stats stats;
+        if (d->is_opened && capture_cvi::supported())
+            d->cap_cvi.get_stats(&stats);
+
+        if (propId == CAP_PROP_CVI_FRAMES) return (double)stats.frames;
+        if (propId == CAP_PROP_CVI_DROPPED) return (double)stats.dropped;
+        if (propId == CAP_PROP_CVI_OVERRUN) return (double)stats.overrun;
+        if (propId == CAP_PROP_CVI_EMPTY) return (double)stats.empty;
+        if (propId == CAP_PROP_CVI_VI_LOST) return (double)stats.vi_lost;
+        if (propId == CAP_PROP_CVI_MAP_HITS) return (double)stats.map_hits;
+        if (propId == CAP_PROP_CVI_MAP_MISSES) return (double)stats.map_misses;
+        if (propId == CAP_PROP_CVI_RETAINED) return (double)stats.retained;
+        if (propId == CAP_PROP_CVI_RETAIN_DENIED) return (double)stats.retain_denied;
+        return (double)stats.ion_bytes;
+    }
+#endif
+
     fprintf(stderr, "ignore unsupported cv cap propId %d\n", propId);
     return 0.0;
 }
@@ -0,0 +1,213 @@
+#include "http_client.h"
+
+#include <cstdio>
+#include <iostream>
+
+namespace {
+
+size_t appendBody(void* contents, size_t size, size_t nmemb, void* body) {
+    size_t totalSize = size * nmemb;
+    static_cast<std::string*>(body)->append(static_cast<char*>(contents), totalSize);
+    return totalSize;
+}
+
+size_t readBody(char* buffer, size_t size, size_t nmemb, void* reader) {
+    return (*static_cast<const HttpBodyReader*>(reader))(buffer, size * nmemb);
+}
+
+// no 100-continue round trip before the body, the remote takes every upload anyway
+struct curl_slist* headerList(const std::vector<std::string>& headers) {
+    struct curl_slist* list = nullptr;
+    for (const std::string& header : headers)
+        list = curl_slist_append(list, header.c_str());
+    return curl_slist_append(list, "Expect:");
+}
+
+double average(double sum, uint64_t n) {
+    return n ? sum / n : 0;
+}
+
+} // namespace
+
+const size_t HttpClient::READ_ABORT;
+
+HttpClient::HttpClient(const HttpClientConfig& config) : config(config) {
+    share = curl_share_init();
+    if (!share) {
+        std::cerr << "http client: no share handle, every request resolves and handshakes on its own" << std::endl;
+        return;
+    }
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    // 7.57, before that every handle keeps its own connections
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+HttpClient::~HttpClient() {
+    for (CURL* handle : idle)
+        curl_easy_cleanup(handle);
+    idle.clear();
+    if (share)
+        curl_share_cleanup(share);
+}
+
+void HttpClient::lockShare(CURL*, curl_lock_data data, curl_lock_access, void* client) {
+    static_cast<HttpClient*>(client)->shareMutexes[data].lock();
+}
+
+void HttpClient::unlockShare(CURL*, curl_lock_data data, void* client) {
+    static_cast<HttpClient*>(client)->shareMutexes[data].unlock();
+}
+
+CURL* HttpClient::acquire() {
+    CURL* handle = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idle.empty()) {
+            handle = idle.back();
+            idle.pop_back();
+        }
+    }
+    if (handle) {
+        // drops the options of the last request, the connections stay open
+        curl_easy_reset(handle);
+    } else {
+        handle = curl_easy_init();
+        if (!handle)
+            return nullptr;
+    }
+    if (share)
+        curl_easy_setopt(handle, CURLOPT_SHARE, share);
+    // no SIGALRM for resolver timeouts, we are called from several threads
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, config.dnsCacheTimeoutS);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, config.keepAliveIdleS);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, config.keepAliveIdleS);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, config.connectTimeoutMs);
+    return handle;
+}
+
+void HttpClient::release(CURL* handle) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < config.maxIdleHandles) {
+            idle.push_back(handle);
+            return;
+        }
+    }
+    curl_easy_cleanup(handle);
+}
+
+HttpResult HttpClient::perform(CURL* handle, long timeoutMs) {
+    HttpResult result;
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, timeoutMs > 0 ? timeoutMs : config.timeoutMs);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, appendBody);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &result.body);
+    CURLcode res = curl_easy_perform(handle);
+    result.ok = res == CURLE_OK;
+    if (result.ok) {
+        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &result.statusCode);
+    } else {
+        result.error = curl_easy_strerror(res);
+    }
+    long connects = 0;
+    double dns = 0, connect = 0, tls = 0, firstByte = 0, total = 0;
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME, &dns);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME, &connect);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME, &tls);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &firstByte);
+    curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total);
+    result.reused = result.ok && connects == 0;
+    result.timings.dnsMs = dns * 1000;
+    result.timings.connectMs = connect * 1000;
+    result.timings.tlsMs = tls * 1000;
+    result.timings.firstByteMs = firstByte * 1000;
+    result.timings.totalMs = total * 1000;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    requests++;
+    if (!result.ok) {
+        failures++;
+        return result;
+    }
+    if (result.reused) {
+        reusedCount++;
+    } else {
+        connectMsSum += result.timings.connectMs;
+        tlsMsSum += result.timings.tlsMs;
+    }
+    firstByteMsSum += result.timings.firstByteMs;
+    totalMsSum += result.timings.totalMs;
+    return result;
+}
+
+HttpResult HttpClient::get(const std::string& url, long timeoutMs) {
+    CURL* handle = acquire();
+    if (!handle) {
+        HttpResult result;
+        result.error = "Failed to initialize libcurl";
+        return result;
+    }
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+    HttpResult result = perform(handle, timeoutMs);
+    release(handle);
+    return result;
+}
+
+HttpResult HttpClient::post(const std::string& url, const void* data, size_t size,
+                            const std::vector<std::string>& headers, long timeoutMs) {
+    CURL* handle = acquire();
+    if (!handle) {
+        HttpResult result;
+        result.error = "Failed to initialize libcurl";
+        return result;
+    }
+    struct curl_slist* list = headerList(headers);
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, list);
+    curl_easy_setopt(handle, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDS, data);
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)size);
+    HttpResult result = perform(handle, timeoutMs);
+    curl_slist_free_all(list);
+    release(handle);
+    return result;
+}
+
+HttpResult HttpClient::postStream(const std::string& url, const HttpBodyReader& read,
+                                  const std::vector<std::string>& headers, long timeoutMs) {
+    CURL* handle = acquire();
+    if (!handle) {
+        HttpResult result;
+        result.error = "Failed to initialize libcurl";
+        return result;
+    }
+    struct curl_slist* list = headerList(headers);
+    list = curl_slist_append(list, "Transfer-Encoding: chunked");
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, list);
+    curl_easy_setopt(handle, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle, CURLOPT_READFUNCTION, readBody);
+    curl_easy_setopt(handle, CURLOPT_READDATA, &read);
+    HttpResult result = perform(handle, timeoutMs);
+    curl_slist_free_all(list);
+    release(handle);
+    return result;
+}
+
+void HttpClient::print() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint64_t opened = requests - failures - reusedCount;
+    std::printf("  %-8s requests: %llu failed: %llu reused: %llu connect: %.1f ms tls: %.1f ms first byte: %.1f ms total: %.1f ms\n",
+                "http", (unsigned long long)requests, (unsigned long long)failures, (unsigned long long)reusedCount,
+                average(connectMsSum, opened), average(tlsMsSum, opened),
+                average(firstByteMsSum, requests - failures), average(totalMsSum, requests - failures));
+}
@@ -0,0 +1,80 @@
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <curl/curl.h>
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "http_result.h"
+
+struct HttpClientConfig {
+    size_t maxIdleHandles = 4;          // handles kept between requests, each with its open connections
+    long connectTimeoutMs = 10000;
+    long timeoutMs = 10000;             // whole request, unless the call passes its own
+    long keepAliveIdleS = 30;           // TCP keepalive probes on connections waiting in the pool
+    long dnsCacheTimeoutS = 600;        // how long a resolved name is shared by every handle
+};
+
+// Fills up to size bytes of buffer with the next part of a request body and
+// returns how many it wrote, 0 at the end of the body or
+// HttpClient::READ_ABORT to fail the request. May block until data is there.
+typedef std::function<size_t(char* buffer, size_t size)> HttpBodyReader;
+
+// HTTP requests over persistent connections. Every call borrows an easy
+// handle from a pool and gives it back afterwards with its connections still
+// open, so the next request to the same host skips the TCP and TLS
+// handshakes. All handles share one DNS cache and TLS session cache, and the
+// connection cache too where libcurl supports it. Safe to call from several
+// threads, curl_global_init() has to run first.
+class HttpClient {
+public:
+    static const size_t READ_ABORT = CURL_READFUNC_ABORT;
+
+    explicit HttpClient(const HttpClientConfig& config);
+    ~HttpClient();
+
+    // timeoutMs 0 takes the config's
+    HttpResult get(const std::string& url, long timeoutMs = 0);
+
+    // data is sent as is and has to stay valid during the call, headers are
+    // full lines like "Content-Type: application/json"
+    HttpResult post(const std::string& url, const void* data, size_t size,
+                    const std::vector<std::string>& headers = std::vector<std::string>(), long timeoutMs = 0);
+
+    // The body is pulled from read while the request is on the wire and goes
+    // out with chunked transfer encoding, so its size need not be known
+    HttpResult postStream(const std::string& url, const HttpBodyReader& read,
+                          const std::vector<std::string>& headers = std::vector<std::string>(), long timeoutMs = 0);
+
+    void print() const;
+
+private:
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    CURL* acquire();
+    void release(CURL* handle);
+    HttpResult perform(CURL* handle, long timeoutMs);
+
+    static void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* client);
+    static void unlockShare(CURL* handle, curl_lock_data data, void* client);
+
+    HttpClientConfig config;
+    CURLSH* share = nullptr;
+    std::mutex shareMutexes[CURL_LOCK_DATA_LAST];
+    mutable std::mutex mutex;
+    std::vector<CURL*> idle;
+    uint64_t requests = 0;
+    uint64_t failures = 0;
+    uint64_t reusedCount = 0;
+    double connectMsSum = 0;    // over requests that opened a connection
+    double tlsMsSum = 0;
+    double firstByteMsSum = 0;
+    double totalMsSum = 0;
+};
+
+#endif // HTTP_CLIENT_H
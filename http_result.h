@@ -0,0 +1,29 @@
+#ifndef HTTP_RESULT_H
+#define HTTP_RESULT_H
+
+#include <string>
+
+// What HttpClient reports about a request, without the libcurl headers so
+// code that only reads results builds without them.
+
+// When each phase of a request was done, in ms from its start as libcurl
+// counts them, so connect includes the name lookup and so on. A request over
+// a connection that was already open has connect and tls close to 0.
+struct HttpTimings {
+    double dnsMs = 0;
+    double connectMs = 0;
+    double tlsMs = 0;           // 0 for plain http
+    double firstByteMs = 0;
+    double totalMs = 0;
+};
+
+struct HttpResult {
+    bool ok = false;            // the exchange completed, whatever the status code
+    long statusCode = 0;
+    std::string body;
+    std::string error;          // libcurl's message when !ok
+    bool reused = false;        // no new connection had to be opened
+    HttpTimings timings;
+};
+
+#endif // HTTP_RESULT_H
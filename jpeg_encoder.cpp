@@ -0,0 +1,243 @@
+#include "jpeg_encoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "cvi_venc.h"
+
+namespace {
+
+// VENC crops have to start on a 16 pixel column
+constexpr int CROP_X_ALIGN = 16;
+
+int clampQuality(int quality) {
+    return std::min(std::max(quality, 1), 99);
+}
+
+} // namespace
+
+JpegEncoder::~JpegEncoder() {
+    close();
+}
+
+bool JpegEncoder::open() {
+    if (opened)
+        return true;
+    if (config.width <= 0 || config.height <= 0) {
+        std::cerr << "jpeg encoder: no frame size, using the software encoder" << std::endl;
+        return false;
+    }
+    VENC_CHN_ATTR_S attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.stVencAttr.enType = PT_JPEG;
+    attr.stVencAttr.u32MaxPicWidth = config.width;
+    attr.stVencAttr.u32MaxPicHeight = config.height;
+    attr.stVencAttr.u32PicWidth = config.width;
+    attr.stVencAttr.u32PicHeight = config.height;
+    attr.stVencAttr.u32BufSize = config.bufferBytes;
+    attr.stVencAttr.bByFrame = CVI_TRUE;
+    attr.stVencAttr.stAttrJpege.bSupportDCF = CVI_FALSE;
+    attr.stVencAttr.stAttrJpege.enReceiveMode = VENC_PIC_RECEIVE_SINGLE;
+    CVI_S32 ret = CVI_VENC_CreateChn(config.channel, &attr);
+    if (ret != CVI_SUCCESS) {
+        std::fprintf(stderr, "CVI_VENC_CreateChn failed %x, using the software encoder\n", ret);
+        return false;
+    }
+    VENC_JPEG_PARAM_S param;
+    ret = CVI_VENC_GetJpegParam(config.channel, &param);
+    if (ret == CVI_SUCCESS) {
+        param.u32Qfactor = clampQuality(config.quality);
+        ret = CVI_VENC_SetJpegParam(config.channel, &param);
+    }
+    if (ret != CVI_SUCCESS) {
+        std::fprintf(stderr, "CVI_VENC_SetJpegParam failed %x, using the software encoder\n", ret);
+        CVI_VENC_DestroyChn(config.channel);
+        return false;
+    }
+    VENC_RECV_PIC_PARAM_S recv;
+    recv.s32RecvPicNum = -1;
+    ret = CVI_VENC_StartRecvFrame(config.channel, &recv);
+    if (ret != CVI_SUCCESS) {
+        std::fprintf(stderr, "CVI_VENC_StartRecvFrame failed %x, using the software encoder\n", ret);
+        CVI_VENC_DestroyChn(config.channel);
+        return false;
+    }
+    opened = true;
+    channelQuality = clampQuality(config.quality);
+    channelCrop = cv::Rect(0, 0, config.width, config.height);
+    return true;
+}
+
+void JpegEncoder::close() {
+    if (!opened)
+        return;
+    CVI_VENC_StopRecvFrame(config.channel);
+    CVI_VENC_ResetChn(config.channel);
+    CVI_VENC_DestroyChn(config.channel);
+    opened = false;
+}
+
+cv::Rect JpegEncoder::alignRegion(const cv::Rect& region, const cv::Size& frameSize) {
+    const cv::Rect frameRect(0, 0, frameSize.width & ~1, frameSize.height & ~1);
+    cv::Rect r = region & frameRect;
+    if (r.empty())
+        return cv::Rect();
+    int x1 = r.x / CROP_X_ALIGN * CROP_X_ALIGN;
+    int y1 = r.y & ~1;
+    int x2 = std::min((r.x + r.width + 1) & ~1, frameRect.width);
+    int y2 = std::min((r.y + r.height + 1) & ~1, frameRect.height);
+    return cv::Rect(x1, y1, x2 - x1, y2 - y1);
+}
+
+bool JpegEncoder::encode(const cv::FrameRef& frame, const cv::Rect& region, const YuvJpegParams& params,
+                         std::vector<uchar>& jpeg) {
+    return encodeRegion(frame, region, params, &jpeg, nullptr);
+}
+
+bool JpegEncoder::encodeChunked(const cv::FrameRef& frame, const cv::Rect& region, const YuvJpegParams& params,
+                                const JpegChunkSink& sink) {
+    return encodeRegion(frame, region, params, nullptr, &sink);
+}
+
+bool JpegEncoder::encodeRegion(const cv::FrameRef& frame, const cv::Rect& region, const YuvJpegParams& params,
+                               std::vector<uchar>* jpeg, const JpegChunkSink* sink) {
+    const cv::Rect aligned = alignRegion(region, cv::Size(frame.width(), frame.height()));
+    if (aligned.empty()) {
+        std::cerr << "jpeg encoder: region outside the frame" << std::endl;
+        return false;
+    }
+    const int quality = clampQuality(params.quality);
+    // the channel is sized for one frame size and only does full size colour, anything else takes the CPU
+    if (opened && frame.frame_info() && frame.width() == config.width && frame.height() == config.height
+        && params.downscale <= 1 && !params.gray) {
+        std::vector<uchar> bitstream;
+        if (encodeHardware(frame, aligned, quality, jpeg ? *jpeg : bitstream)) {
+            hardwareCount++;
+            return jpeg ? true : (*sink)(bitstream.data(), bitstream.size());
+        }
+        fallbackCount++;
+    }
+    Yuv420Image image;
+    if (!mapRegion(frame, aligned, image)) {
+        std::cerr << "Failed to map NV21 frame." << std::endl;
+        return false;
+    }
+    YuvJpegParams cpuParams = params;
+    cpuParams.quality = quality;
+    if (sink && cpuParams.restartInterval <= 0) {
+        cpuParams.restartInterval = config.restartInterval;
+    }
+    bool encoded = jpeg ? encodeYuv420Jpeg(image, cpuParams, *jpeg) : encodeYuv420Jpeg(image, cpuParams, *sink);
+    if (!encoded) {
+        std::cerr << "Failed to encode image." << std::endl;
+        return false;
+    }
+    softwareCount++;
+    return true;
+}
+
+bool JpegEncoder::encodeHardware(const cv::FrameRef& frame, const cv::Rect& region, int quality, std::vector<uchar>& jpeg) {
+    const VENC_CHN chn = config.channel;
+    if (quality != channelQuality) {
+        VENC_JPEG_PARAM_S param;
+        CVI_S32 ret = CVI_VENC_GetJpegParam(chn, &param);
+        if (ret == CVI_SUCCESS) {
+            param.u32Qfactor = quality;
+            ret = CVI_VENC_SetJpegParam(chn, &param);
+        }
+        if (ret != CVI_SUCCESS) {
+            std::fprintf(stderr, "CVI_VENC_SetJpegParam failed %x\n", ret);
+            return false;
+        }
+        channelQuality = quality;
+    }
+    if (region != channelCrop) {
+        VENC_CHN_PARAM_S param;
+        CVI_S32 ret = CVI_VENC_GetChnParam(chn, &param);
+        if (ret == CVI_SUCCESS) {
+            param.stCropCfg.bEnable = region != cv::Rect(0, 0, config.width, config.height);
+            param.stCropCfg.stRect.s32X = region.x;
+            param.stCropCfg.stRect.s32Y = region.y;
+            param.stCropCfg.stRect.u32Width = region.width;
+            param.stCropCfg.stRect.u32Height = region.height;
+            ret = CVI_VENC_SetChnParam(chn, &param);
+        }
+        if (ret != CVI_SUCCESS) {
+            std::fprintf(stderr, "CVI_VENC_SetChnParam crop failed %x\n", ret);
+            // the channel may have taken part of it, set it again next time
+            channelCrop = cv::Rect();
+            return false;
+        }
+        channelCrop = region;
+    }
+
+    CVI_S32 ret = CVI_VENC_SendFrame(chn, reinterpret_cast<const VIDEO_FRAME_INFO_S*>(frame.frame_info()), config.timeoutMs);
+    if (ret != CVI_SUCCESS) {
+        std::fprintf(stderr, "CVI_VENC_SendFrame failed %x\n", ret);
+        return false;
+    }
+    VENC_CHN_STATUS_S status;
+    ret = CVI_VENC_QueryStatus(chn, &status);
+    if (ret != CVI_SUCCESS || status.u32CurPacks == 0) {
+        std::fprintf(stderr, "CVI_VENC_QueryStatus failed %x\n", ret);
+        return false;
+    }
+    std::vector<VENC_PACK_S> packs(status.u32CurPacks);
+    VENC_STREAM_S stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.pstPack = packs.data();
+    ret = CVI_VENC_GetStream(chn, &stream, config.timeoutMs);
+    if (ret != CVI_SUCCESS) {
+        std::fprintf(stderr, "CVI_VENC_GetStream failed %x\n", ret);
+        return false;
+    }
+    jpeg.clear();
+    for (CVI_U32 i = 0; i < stream.u32PackCount; i++) {
+        const VENC_PACK_S& pack = stream.pstPack[i];
+        jpeg.insert(jpeg.end(), pack.pu8Addr + pack.u32Offset, pack.pu8Addr + pack.u32Len);
+    }
+    CVI_VENC_ReleaseStream(chn, &stream);
+    if (jpeg.empty()) {
+        std::cerr << "jpeg encoder: empty bitstream" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool JpegEncoder::mapRegion(const cv::FrameRef& frame, const cv::Rect& region, Yuv420Image& image) {
+    // -------------------
+    // The frame is still held in its VB block, the planes are mapped on first access
+    // and unmapped when the last reference goes away.
+    // -------------------
+    const unsigned char* src_y = frame.vir_addr(0);
+    const unsigned char* src_uv = frame.vir_addr(1);
+    if (!src_y || !src_uv)
+        return false;
+    const int stride_y = frame.stride(0);
+    const int stride_uv = frame.stride(1);
+    // -------------------
+    // Determine cropping offsets.
+    // For the Y plane, use the full-resolution offsets.
+    // For the UV plane (subsampled vertically by 2), use border_top/2,
+    // V comes first in each interleaved pair.
+    // -------------------
+    const int border_top = (frame.mat(0).data - src_y) / stride_y + region.y;
+    const int border_left = (frame.mat(0).data - src_y) % stride_y + region.x;
+    image.y = src_y + border_top * stride_y + border_left;
+    image.strideY = stride_y;
+    image.v = src_uv + (border_top / 2) * stride_uv + border_left;
+    image.u = image.v + 1;
+    image.strideUV = stride_uv;
+    image.chromaStep = 2;
+    image.width = region.width;
+    image.height = region.height;
+    return true;
+}
+
+void JpegEncoder::print() const {
+    std::printf("  %-8s %s hardware: %llu software: %llu fallbacks: %llu\n", "jpeg", opened ? "venc" : "cpu",
+                (unsigned long long)hardwareCount, (unsigned long long)softwareCount,
+                (unsigned long long)fallbackCount);
+}
@@ -0,0 +1,83 @@
+#ifndef JPEG_ENCODER_H
+#define JPEG_ENCODER_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "yuv_jpeg.h"
+
+struct JpegEncoderConfig {
+    int channel = 0;                    // VENC channel, not shared with anything else
+    int width = 0;                      // size of the frames handed to encode()
+    int height = 0;
+    int quality = 95;                   // 1..99
+    uint32_t bufferBytes = 3u << 20;    // bitstream buffer, the largest JPEG the hardware can return
+    int timeoutMs = 2000;
+    int restartInterval = 160;          // MCUs per piece of encodeChunked(), one MCU row at 2560 wide
+};
+
+// JPEG from NV21 frames still held in their VB blocks. The SoC's VENC does
+// the work when its channel could be opened, the frame goes to it by
+// physical address and only the bitstream is copied out. Without it, or
+// when the hardware fails on a frame, the region is encoded on the CPU
+// straight from the NV21 planes, see yuv_jpeg.h. Downscaled and gray
+// pages always take the CPU.
+class JpegEncoder {
+public:
+    explicit JpegEncoder(const JpegEncoderConfig& config) : config(config) {}
+    ~JpegEncoder();
+
+    // Create the VENC JPEG channel, false keeps the encoder on the software path.
+    bool open();
+
+    void close();
+
+    bool hardware() const { return opened; }
+
+    // VENC crops start on a multiple of 16 pixels. The region grown to what
+    // encode() actually cuts out, with even size and inside the frame.
+    static cv::Rect alignRegion(const cv::Rect& region, const cv::Size& frameSize);
+
+    // Encode region of frame, the region is aligned first. Restart markers
+    // are only written by the CPU encoder. Not thread safe.
+    bool encode(const cv::FrameRef& frame, const cv::Rect& region, const YuvJpegParams& params, std::vector<uchar>& jpeg);
+
+    bool encode(const cv::FrameRef& frame, const cv::Rect& region, int quality, std::vector<uchar>& jpeg) {
+        YuvJpegParams params;
+        params.quality = quality;
+        return encode(frame, region, params, jpeg);
+    }
+
+    bool encode(const cv::FrameRef& frame, const cv::Rect& region, std::vector<uchar>& jpeg) {
+        return encode(frame, region, config.quality, jpeg);
+    }
+
+    // Same as encode(), with the JPEG handed to sink while it is being
+    // encoded, each piece ending on a restart marker, every config
+    // restartInterval MCUs unless params sets its own. The CPU encoder works
+    // that way, the VENC bitstream arrives in one piece when it is done.
+    bool encodeChunked(const cv::FrameRef& frame, const cv::Rect& region, const YuvJpegParams& params,
+                       const JpegChunkSink& sink);
+
+    void print() const;
+
+private:
+    // into jpeg when it is set, otherwise to sink
+    bool encodeRegion(const cv::FrameRef& frame, const cv::Rect& region, const YuvJpegParams& params,
+                      std::vector<uchar>* jpeg, const JpegChunkSink* sink);
+    bool encodeHardware(const cv::FrameRef& frame, const cv::Rect& region, int quality, std::vector<uchar>& jpeg);
+    bool mapRegion(const cv::FrameRef& frame, const cv::Rect& region, Yuv420Image& image);
+
+    JpegEncoderConfig config;
+    bool opened = false;
+    int channelQuality = -1;
+    cv::Rect channelCrop;
+    uint64_t hardwareCount = 0;
+    uint64_t softwareCount = 0;
+    uint64_t fallbackCount = 0;
+};
+
+#endif // JPEG_ENCODER_H
@@ -3,7 +3,10 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/objdetect.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -24,6 +27,7 @@
 #include <ctime>
 #include <functional>
 #include <map>
+#include <memory>
 #include <curl/curl.h>
 #include <sys/ioctl.h>
 #include <linux/if.h>
@@ -34,38 +38,149 @@
 
 // Custom includes
 #include "cvi_tdl.h"
-
-// Forward declarations
-void sendMat(cv::Mat image);
+#include "change_detector.h"
+#include "pipeline.h"
+#include "upload_spool.h"
+#include "detection_crops.h"
+#include "page_cache.h"
+#include "stability_estimator.h"
+#include "sharpness.h"
+#include "jpeg_encoder.h"
+#include "http_client.h"
+#include "upload_controller.h"
+#include "stream_upload.h"
 
 // Constants
 constexpr const char* WIFI_CONFIG_FILE_NAME = "wifi_config";
 constexpr const char* WPA_SUPPLICANT_PATH = "/etc/jotter_wpa_supplicant.conf";
-constexpr const int NO_CHANGE_FRAME_LIMIT = 10;
-constexpr const double CHANGE_THRESHOLD_PERCENT = 0.10;
+constexpr const char* STABILITY_CONFIG_FILE_NAME = "stability_config";
+// defaults of the stability estimator, the config file above overrides them at startup and on SIGHUP
+constexpr const float STABLE_ENTER_THRESHOLD = 0.01f;
+constexpr const float STABLE_EXIT_THRESHOLD = 0.05f;
+constexpr const int MIN_STABLE_FRAMES = 2;
+constexpr const int MAX_STABLE_FRAMES = 10;
+constexpr const int PIXEL_DIFF_THRESHOLD = 30;
+constexpr const int MOTION_MIN_AREA = 4;
+constexpr const int MOTION_TILES_X = 4;
+constexpr const int MOTION_TILES_Y = 3;
+// opencv, hardware, fused or scalar, JOTTER_CHANGE_DETECTOR overrides it
+constexpr const char* CHANGE_DETECTOR_BACKEND = "hardware";
 constexpr const char* INTERFACE_NAME = "wlan0";
 constexpr const char* USER_LED_PATH = "/sys/class/leds/led-user";
 
 // YOLO defines
 constexpr const char* MODEL_FILE_NAME = "detect.cvimodel";
 constexpr const int MODEL_CLASS_CNT = 3;  // underline, highlight, pen
+const std::vector<std::string> MODEL_CLASS_NAMES = { "underline", "highlight", "pen" };
 constexpr const double MODEL_THRESH = 0.5;
 constexpr const double MODEL_NMS_THRESH = 0.5;
 constexpr const int INPUT_FRAME_WIDTH = 320;
 constexpr const int INPUT_FRAME_HEIGHT = 320;
 constexpr const int MAX_FRAME_WIDTH = 2560;
 constexpr const int MAX_FRAME_HEIGHT = 1440;
+constexpr const int MOTION_FRAME_WIDTH = 160;
+constexpr const int MOTION_FRAME_HEIGHT = 90;
+constexpr const int CAPTURE_RING_SIZE = 2;
+constexpr const float PREVIEW_FPS = 10.f;
+// a settled page left alone this long parks the sensor, it wakes up every IDLE_PAUSE_MS
+// for one frame to look for a change
+constexpr const int IDLE_AFTER_MS = 20000;
+constexpr const int IDLE_PAUSE_MS = 2000;
+// frames of the tdl and full streams the loop, the detect and the encode stages may hold
+// past the set they came with, each is an extra VB block in the pool of its stream
+constexpr const int RETAIN_BUDGET = 4;
+constexpr const int DETECT_QUEUE_DEPTH = 1;
+constexpr const int ENCODE_QUEUE_DEPTH = 1;
+// full-res frames of the last sets before a page settles, the settled one included, the
+// sharpest goes to the detector. A candidate that does not fit the retain budget is skipped
+constexpr const int STILL_CANDIDATES = 3;
+// full-res frames taken per still when no frame of the settled page could be kept
+constexpr const int STILL_BURST_FRAMES = 3;
+constexpr const int SHARPNESS_STEP = 4;
+// crops: only the detected regions plus a JSON sidecar, the whole frame for a page without
+// detections, full: always the whole frame, downscaled when the link needs it.
+// JOTTER_UPLOAD_MODE overrides it
+constexpr const char* UPLOAD_MODE = "crops";
+constexpr const int CROP_PADDING = 48;
+constexpr const char* CROPS_BOUNDARY = "jotter-page-crops";
+// stills are encoded by VENC on this channel, by OpenCV when it is not available
+constexpr const int JPEG_QUALITY = 95;
+constexpr const int JPEG_VENC_CHANNEL = 0;
+constexpr const uint32_t JPEG_BUFFER_BYTES = 3u << 20;
+// a page within this many hash bits of a recent upload, with no new marks, is not sent again
+constexpr const int PAGE_CACHE_SIZE = 16;
+constexpr const int PAGE_HASH_MAX_DISTANCE = 8;
+constexpr const float PAGE_MARK_MIN_OVERLAP = 0.5f;
+constexpr const char* SPOOL_DIR_NAME = "spool";
+constexpr const uint64_t SPOOL_MAX_BYTES = 64u << 20;
+constexpr const uint64_t SPOOL_SEGMENT_BYTES = 4u << 20;
+constexpr const int UPLOAD_RETRY_MIN_MS = 1000;
+constexpr const int UPLOAD_RETRY_MAX_MS = 60000;
+// remote calls reuse connections, one idle handle for the upload stage and one for the rest
+constexpr const int HTTP_IDLE_HANDLES = 2;
+constexpr const long HTTP_TIMEOUT_MS = 10000;
+constexpr const long HTTP_CONNECT_TIMEOUT_MS = 10000;
+// a hung request would hold up every page behind it in the spool
+constexpr const long UPLOAD_TIMEOUT_MS = 60000;
+// full frames go out while they are encoded when nothing older waits in the spool,
+// at most this many restart intervals are buffered between the encoder and the socket
+constexpr const bool STREAM_UPLOADS = true;
+constexpr const int STREAM_QUEUE_CHUNKS = 8;
+// quality, size and crops of each page are picked so it is on the remote within this
+// over the link measured from the last uploads
+constexpr const double UPLOAD_TARGET_MS = 3000;
 
 // Use volatile sig_atomic_t for safe signal flag updates.
 volatile sig_atomic_t interrupted = 0;
+volatile sig_atomic_t reloadRequested = 0;
 
 // Global variables
 std::string remoteBaseUrl = "";
 cv::VideoCapture cap;
 cv::QRCodeDetector qrDecoder;
 cvitdl_handle_t tdl_handle = nullptr;
+// the hardware change detector runs on the loop thread while detection runs on its own,
+// they do not share a handle
+cvitdl_handle_t motion_tdl_handle = nullptr;
 std::string modelFilePath = "";
 std::string wifiConfigFilePath = "";
+std::string spoolDirectoryPath = "";
+std::string stabilityConfigFilePath = "";
+bool uploadCrops = true;
+
+// Pipeline queues and per-stage counters
+// a stable page for the model, with the hash of its motion frame and the full-res
+// frame of the same set, empty when the retain budget was used up
+struct DetectJob {
+    cv::FrameRef frame;
+    cv::FrameRef full;
+    uint64_t pageHash;
+};
+BoundedQueue<DetectJob> detectQueue("detect", DETECT_QUEUE_DEPTH);
+// pages uploaded lately
+std::unique_ptr<PageCache> pageCache;
+// the still, the detections to crop out of it and the page hash to remember once it is out
+struct EncodeJob {
+    cv::FrameRef frame;
+    std::vector<Detection> detections;
+    uint64_t pageHash;
+};
+BoundedQueue<EncodeJob> encodeQueue("encode", ENCODE_QUEUE_DEPTH);
+// a job without its frame yet, the still to take for the last stable page when its own frame was not kept
+BoundedQueue<EncodeJob> stillQueue("still", 1);
+// NV21 stills to JPEG, used by the encode stage only
+std::unique_ptr<JpegEncoder> jpegEncoder;
+// encoded pages wait on disk until the remote has them
+std::unique_ptr<UploadSpool> uploadSpool;
+// how each page is encoded, from the encode stage and the uploads
+std::unique_ptr<UploadController> uploadController;
+StageStats captureStats("capture");
+StageStats analysisStats("analysis");
+StageStats detectStats("detect");
+StageStats encodeStats("encode");
+StageStats uploadStats("upload");
+// every request to the remote goes through it
+std::unique_ptr<HttpClient> httpClient;
 
 // For http requests
 struct HttpResponse {
@@ -89,6 +204,10 @@ void interruptHandler(int signum) {
     interrupted = 1;
 }
 
+void reloadHandler(int signum) {
+    reloadRequested = 1;
+}
+
 bool runSystemCommand(const std::string& command) {
     int status = std::system(command.c_str());
     if (status != 0) {
@@ -124,60 +243,20 @@ std::string getExecutableDirectory() {
     return "";
 }
 
-// Callback for libcurl to collect HTTP response data.
-size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-    size_t totalSize = size * nmemb;
-    static_cast<std::string*>(userp)->append(static_cast<char*>(contents), totalSize);
-    return totalSize;
-}
-
 HttpResponse httpGet(const std::string& url) {
-    HttpResponse response{ "", 0 };
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        std::cerr << "Failed to initialize libcurl." << std::endl;
-        return response;
-    }
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response.body);
-    // Set timeout options
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);           // Timeout for the entire request (in seconds)
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);     // Timeout for the connection phase (in seconds)
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        std::cerr << "libcurl error: " << curl_easy_strerror(res) << std::endl;
-    } else {
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.statusCode);
+    HttpResult result = httpClient->get(url);
+    if (!result.ok) {
+        std::cerr << "libcurl error: " << result.error << std::endl;
     }
-    curl_easy_cleanup(curl);
-    return response;
+    return HttpResponse{ result.body, result.statusCode };
 }
 
 HttpResponse httpPost(const std::string& url, const std::string& postBody) {
-    HttpResponse response { "", 0 };
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        std::cerr << "Failed to initialize libcurl." << std::endl;
-        return response;
-    }
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postBody.c_str());
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, postBody.size());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response.body);
-    // Set timeout options
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);           // Timeout for the entire request (in seconds)
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);     // Timeout for the connection phase (in seconds)
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        std::cerr << "HTTP POST failed: " << curl_easy_strerror(res) << std::endl;
-    } else {
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.statusCode);
+    HttpResult result = httpClient->post(url, postBody.data(), postBody.size());
+    if (!result.ok) {
+        std::cerr << "HTTP POST failed: " << result.error << std::endl;
     }
-    curl_easy_cleanup(curl);
-    return response;
+    return HttpResponse{ result.body, result.statusCode };
 }
 
 // Set user LED on|off
@@ -241,6 +320,11 @@ void cleanUp() {
         CVI_TDL_DestroyHandle(tdl_handle);
         tdl_handle = nullptr;
     }
+    if (motion_tdl_handle != nullptr) {
+        CVI_TDL_DestroyHandle(motion_tdl_handle);
+        motion_tdl_handle = nullptr;
+    }
+    httpClient.reset();
     curl_global_cleanup();
     controlUserLED("off", 0);
 }
@@ -294,11 +378,37 @@ void openCamera(int width, int height) {
         }
         cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
         cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
+        // one ISP pass feeds every consumer: bgr for QR, letterboxed rgb for the model,
+        // a small Y plane for change detection and NV21 at upload size
+        cap.set_stream(cv::CAP_STREAM_TDL, INPUT_FRAME_WIDTH, INPUT_FRAME_HEIGHT);
+        cap.set_stream(cv::CAP_STREAM_MOTION, MOTION_FRAME_WIDTH, MOTION_FRAME_HEIGHT);
+        cap.set_stream(cv::CAP_STREAM_FULL, MAX_FRAME_WIDTH, MAX_FRAME_HEIGHT);
+        // always hand out the freshest frame, whatever queued up while we were busy is dropped
+        cap.set(cv::CAP_PROP_CVI_POLICY, cv::CAP_POLICY_LATEST);
+        // VI feeds VPSS in hardware and we only dequeue the VPSS outputs, so VI queues
+        // nothing and its pool holds the frame being written and the one in VPSS
+        cap.set(cv::CAP_PROP_CVI_BIND_VPSS, 1);
+        cap.set(cv::CAP_PROP_BUFFERSIZE, 0);
+        cap.set(cv::CAP_PROP_CVI_VB_COUNT, 2);
+        // while the page moves the sensor runs slower and VPSS writes no full-res frame,
+        // a 5.5 MB NV21 frame each would be about 55 MB/s of DRAM traffic at PREVIEW_FPS.
+        // The loop switches to still mode from the first still frame until the page went to
+        // the detector, so the settled set still carries the frame the model sees
+        cap.set(cv::CAP_PROP_CVI_PREVIEW_FPS, PREVIEW_FPS);
+        cap.set(cv::CAP_PROP_CVI_PREVIEW_FULL, 0);
+        // every ring entry pins one block per stream, plus the set the loop is working on
+        // and the one VPSS is writing. Only the tdl and full frames are retained, by the
+        // still candidates and the detect and encode stages, their pools get RETAIN_BUDGET
+        // blocks more: 8 full blocks, about 46 MB of ION against 23 MB without retention
+        cap.set(cv::CAP_PROP_CVI_CHN_VB_COUNT, CAPTURE_RING_SIZE + 2);
+        cap.set(cv::CAP_PROP_CVI_RETAIN_BUDGET, RETAIN_BUDGET);
+        cap.set(cv::CAP_PROP_CVI_RETAIN_STREAMS, (1 << cv::CAP_STREAM_TDL) | (1 << cv::CAP_STREAM_FULL));
         cap.open(0);
         if (!cap.isOpened()) {
             std::cerr << "Failed to open camera; retrying in 3 seconds..." << std::endl;
             flashUserLED(3, 1000);
         } else {
+            printf("camera opened, %.0f bytes of VB reserved\n", cap.get(cv::CAP_PROP_CVI_ION_BYTES));
             cv::Mat dummy;
             for (int i = 0; i < 15 && !interrupted; ++i)
                 cap >> dummy;
@@ -463,188 +573,346 @@ void initModel() {
     }
 }
 
-cv::Mat convertNV21FrameToBGR(const VIDEO_FRAME_INFO_S &stFrameInfo, int output_width, int output_height, bool gray)
-{
-    const VIDEO_FRAME_S &vf = stFrameInfo.stVFrame;
-    // -------------------
-    // Map the Y plane
-    // -------------------
-    CVI_U64 phyaddr_y = vf.u64PhyAddr[0];
-    const int stride_y = vf.u32Stride[0];
-    const int length_y = vf.u32Length[0];
-    void* mapped_ptr_y = CVI_SYS_MmapCache(phyaddr_y, length_y);
-    if (!mapped_ptr_y)
-        throw std::runtime_error("Failed to map Y plane.");
-    // -------------------
-    // Map the UV plane
-    // -------------------
-    CVI_U64 phyaddr_uv = vf.u64PhyAddr[1];
-    const int stride_uv = vf.u32Stride[1];
-    const int length_uv = vf.u32Length[1];
-    void* mapped_ptr_uv = CVI_SYS_MmapCache(phyaddr_uv, length_uv);
-    if (!mapped_ptr_uv) {
-        CVI_SYS_Munmap(mapped_ptr_y, length_y);
-        throw std::runtime_error("Failed to map UV plane.");
-    }
-    // -------------------
-    // Determine cropping offsets.
-    // For the Y plane, use the full-resolution offsets.
-    // For the UV plane (subsampled vertically by 2), use border_top/2.
-    // -------------------
-    int border_top   = vf.s16OffsetTop;
-    int border_left  = vf.s16OffsetLeft;
-    // (We ignore border_bottom and border_right here.)
-    // -------------------
-    // Allocate a contiguous buffer for the NV21 data.
-    // NV21 consists of: 
-    //   - Y plane: output_height rows, each output_width bytes.
-    //   - UV plane: output_height/2 rows, each output_width bytes.
-    // Total size = output_height + output_height/2 rows * output_width.
-    // -------------------
-    int nv21_rows = output_height + output_height / 2;
-    int nv21_size = nv21_rows * output_width;
-    unsigned char* nv21_buffer = new unsigned char[nv21_size];
-    // Pointer to the destination buffer.
-    unsigned char* dst = nv21_buffer;
-    // -------------------
-    // Copy Y plane:
-    // For each row in the cropped Y region:
-    //   - The source row starts at mapped_ptr_y plus (border_top + i)*stride_y + border_left.
-    //   - Copy output_width bytes.
-    // -------------------
-    const unsigned char* src_y = static_cast<const unsigned char*>(mapped_ptr_y);
-    for (int i = 0; i < output_height; i++)
-    {
-        const unsigned char* src_row = src_y + (border_top + i) * stride_y + border_left;
-        memcpy(dst, src_row, output_width);
-        dst += output_width;
-    }
-    // -------------------
-    // Copy UV plane:
-    // NV21 has the UV plane at half the vertical resolution.
-    // For the cropped region, we use (border_top/2) as the starting row.
-    // Each row in the UV plane has output_width bytes.
-    // -------------------
-    const unsigned char* src_uv = static_cast<const unsigned char*>(mapped_ptr_uv);
-    int uv_border_top = border_top / 2; // assuming even values for proper alignment
-    for (int i = 0; i < output_height / 2; i++)
-    {
-        const unsigned char* src_row = src_uv + (uv_border_top + i) * stride_uv + border_left;
-        memcpy(dst, src_row, output_width);
-        dst += output_width;
-    }
-    // -------------------
-    // Create an OpenCV Mat from the NV21 buffer.
-    // The Mat has (output_height + output_height/2) rows and output_width columns.
-    // -------------------
-    cv::Mat nv21(nv21_rows, output_width, CV_8UC1, nv21_buffer);
-    // Convert NV21 to BGR.
-    cv::Mat bgr;
-    if (gray) {
-        cv::cvtColor(nv21, bgr, cv::COLOR_YUV2GRAY_NV21);
+// Wrap the crops and their sidecar into one multipart/form-data body, so a page
+// stays a single spool record and a single request.
+void buildCropsPage(const std::string& meta, const std::vector<std::vector<uchar>>& crops, std::vector<uchar>& page) {
+    const std::string boundary = std::string("--") + CROPS_BOUNDARY;
+    auto append = [&page](const std::string& text) { page.insert(page.end(), text.begin(), text.end()); };
+    page.clear();
+    append(boundary + "\r\nContent-Disposition: form-data; name=\"meta\"; filename=\"meta.json\"\r\n"
+           "Content-Type: application/json\r\n\r\n" + meta + "\r\n");
+    for (size_t i = 0; i < crops.size(); i++) {
+        std::string name = "crop" + std::to_string(i);
+        append(boundary + "\r\nContent-Disposition: form-data; name=\"" + name + "\"; filename=\"" + name + ".jpg\"\r\n"
+               "Content-Type: image/jpeg\r\n\r\n");
+        page.insert(page.end(), crops[i].begin(), crops[i].end());
+        append("\r\n");
     }
-    else {
-        cv::cvtColor(nv21, bgr, cv::COLOR_YUV2BGR_NV21);
+    append(boundary + "--\r\n");
+}
+
+// The merged detection regions as the encoder will cut them out of the still,
+// the sidecar has to describe exactly that.
+std::vector<cv::Rect> cropRegions(const std::vector<Detection>& detections, const cv::Size& frameSize) {
+    std::vector<cv::Rect> regions = mergeDetectionRegions(detections, CROP_PADDING, frameSize);
+    for (cv::Rect& region : regions) {
+        region = JpegEncoder::alignRegion(region, frameSize);
     }
-    // Clean up:
-    delete[] nv21_buffer;
-    CVI_SYS_Munmap(mapped_ptr_y, length_y);
-    CVI_SYS_Munmap(mapped_ptr_uv, length_uv);
-    return bgr;
+    return regions;
 }
 
-void sendMat(cv::Mat image) {
+// Cut the regions out of the still and encode each one.
+bool encodeCropsPage(const cv::FrameRef& frame, const std::vector<Detection>& detections,
+                     const std::vector<cv::Rect>& regions, const YuvJpegParams& params, std::vector<uchar>& page) {
+    const cv::Size frameSize(frame.width(), frame.height());
+    std::vector<std::vector<uchar>> crops(regions.size());
+    for (size_t i = 0; i < regions.size(); i++) {
+        if (!jpegEncoder->encode(frame, regions[i], params, crops[i])) {
+            return false;
+        }
+    }
+    buildCropsPage(describeDetectionCrops(detections, regions, frameSize, MODEL_CLASS_NAMES), crops, page);
+    return true;
+}
+
+// Send an encoded page via HTTP POST, true once the remote accepted it.
+// A bare JPEG is a full frame for /upload, anything else a crops page for /upload/crops.
+bool uploadPage(const std::vector<uchar>& buffer) {
     // if (getIPAddress().empty()){
     //     printf("no ip address\n");
     //     return;
     // }
-    //printf("encoding image\n");
-    auto start = std::chrono::high_resolution_clock::now();
-    std::vector<uchar> buffer;
-    std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, 95 };
-    if (!cv::imencode(".jpg", image, buffer, params)) {
-        std::cerr << "Failed to encode image." << std::endl;
-        return;
-    }
-    auto end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> duration = end - start;
-    std::cout << "execution time: " << duration.count() << " seconds" << std::endl;
-    // std::vector<int> params = { cv::IMWRITE_WEBP_QUALITY, 90 };
-    // if (!cv::imencode(".webp", image, buffer, {})) {
-    //     std::cerr << "Failed to encode image to WebP format." << std::endl;
-    //     return;
-    // }
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        std::cerr << "Failed to initialize libcurl" << std::endl;
-        return;
-    }
     printf("sending image now\n");
-    start = std::chrono::high_resolution_clock::now();
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "Content-Type: application/octet-stream");
+    const bool isJpeg = buffer.size() >= 2 && buffer[0] == 0xff && buffer[1] == 0xd8;
+    std::vector<std::string> headers;
     std::string url = remoteBaseUrl + "/upload";
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, buffer.data());
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, buffer.size());
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        std::cerr << "Image upload failed: " << curl_easy_strerror(res) << std::endl;
+    if (isJpeg) {
+        headers.push_back("Content-Type: application/octet-stream");
     } else {
-        long httpCode = 0;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
-        std::cout << "image sent: " << httpCode << std::endl;
+        headers.push_back(std::string("Content-Type: multipart/form-data; boundary=") + CROPS_BOUNDARY);
+        url += "/crops";
     }
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    end = std::chrono::high_resolution_clock::now();
-    duration = end - start;
-    std::cout << "execution time: " << duration.count() << " seconds" << std::endl;
+    HttpResult result = httpClient->post(url, buffer.data(), buffer.size(), headers, UPLOAD_TIMEOUT_MS);
+    uploadController->recordUpload(buffer.size(), result, false);
+    if (!result.ok) {
+        std::cerr << "Image upload failed: " << result.error << std::endl;
+        return false;
+    }
+    printf("image sent: %ld %s connect: %.0f ms first byte: %.0f ms total: %.0f ms\n", result.statusCode,
+           result.reused ? "reused" : "new", result.timings.connectMs, result.timings.firstByteMs,
+           result.timings.totalMs);
+    return result.statusCode >= 200 && result.statusCode < 300;
 }
 
-// Capture an image, encode it to JPEG, and send it via HTTP POST.
-void sendImage() {
-    flashUserLED(2, 150);
-    cv::Mat frame;
-    std::pair<void*, void*> imagePtrs = cap.capture(frame);
-    if (frame.empty()) {
-        cap.releaseImagePtr();
+// Encode a full frame straight onto the wire. The encoder hands its restart intervals
+// to a StreamUpload that posts them as they come, so the page is on the remote soon
+// after the last one is encoded. buffer gets the whole JPEG as well, to spool it when
+// the send failed. False when the frame could not be encoded.
+bool streamFullFrame(const cv::FrameRef& frame, const YuvJpegParams& params, std::vector<uchar>& buffer, bool& sent) {
+    auto start = std::chrono::steady_clock::now();
+    StreamUpload upload(*httpClient, remoteBaseUrl + "/upload", { "Content-Type: application/octet-stream" },
+                        UPLOAD_TIMEOUT_MS, STREAM_QUEUE_CHUNKS);
+    buffer.clear();
+    bool streaming = true;
+    bool encoded = jpegEncoder->encodeChunked(frame, cv::Rect(0, 0, MAX_FRAME_WIDTH, MAX_FRAME_HEIGHT), params,
+                                              [&](const uint8_t* data, size_t size) {
+        buffer.insert(buffer.end(), data, data + size);
+        // refused once the send gave up, the encode still finishes for the spool
+        if (streaming) {
+            streaming = upload.write(data, size);
+        }
+        return true;
+    });
+    HttpResult result = encoded ? upload.finish() : upload.abort();
+    uploadStats.record(start);
+    if (encoded) {
+        // while the socket keeps up with the encoder the upload time says little about the link
+        uploadController->recordUpload(buffer.size(), result, !upload.networkBound());
+    }
+    sent = encoded && result.ok && result.statusCode >= 200 && result.statusCode < 300;
+    if (!result.ok) {
+        std::cerr << "Image stream failed: " << result.error << std::endl;
+    } else {
+        printf("image streamed: %ld %s first byte: %.0f ms total: %.0f ms\n", result.statusCode,
+               result.reused ? "reused" : "new", result.timings.firstByteMs, result.timings.totalMs);
+    }
+    return encoded;
+}
+
+// Pipeline stages. The main loop owns the camera and does the stability analysis,
+// detection and encoding each run on their own thread behind a bounded queue and
+// the upload drains the spool. The loop never blocks on a queue, a busy stage makes
+// it drop work instead, so a slow upload cannot hold up the next page.
+
+// Wait for a stable page and run the model on it. On a hit the sharpest full-res frame of the
+// last sets goes to the encoder, without one the loop is asked for a still.
+void detectStage() {
+    DetectJob job;
+    while (detectQueue.pop(job)) {
+        auto start = std::chrono::steady_clock::now();
+        VIDEO_FRAME_INFO_S *frameInfo = reinterpret_cast<VIDEO_FRAME_INFO_S*>(job.frame.frame_info());
+        if (frameInfo == nullptr) {
+            std::cerr << "frameInfo is nullptr" << std::endl;
+            job.frame.release();
+            continue;
+        }
+        cvtdl_object_t obj_meta = {0};
+        CVI_TDL_Detection(tdl_handle, frameInfo, CVI_TDL_SUPPORTED_MODEL_YOLOV8_DETECTION, &obj_meta);
+        job.frame.release();
+        //check for detections
+        if (obj_meta.size > 0) {
+            // the model sees the frame letterboxed into its input, undo that for the full-res stream
+            VIDEO_FRAME_INFO_S fullInfo = {};
+            fullInfo.stVFrame.u32Width = MAX_FRAME_WIDTH;
+            fullInfo.stVFrame.u32Height = MAX_FRAME_HEIGHT;
+            CVI_TDL_RescaleMetaCenter(&fullInfo, &obj_meta);
+            std::vector<Detection> detections;
+            for (uint32_t i = 0; i < obj_meta.size; i++) {
+                const cvtdl_bbox_t& box = obj_meta.info[i].bbox;
+                detections.push_back({ box.x1, box.y1, box.x2, box.y2, box.score, obj_meta.info[i].classes });
+            }
+            std::printf("Detected %d objects\n", obj_meta.size);
+            if (pageCache->seen(job.pageHash, detections)) {
+                printf("same page as a recent upload, skipping\n");
+            } else if (!job.full.empty()) {
+                flashUserLED(2, 150);
+                if (!encodeQueue.tryPush(EncodeJob{ std::move(job.full), std::move(detections), job.pageHash })) {
+                    std::cerr << "encoder busy, dropping page" << std::endl;
+                }
+            } else {
+                flashUserLED(2, 150);
+                stillQueue.tryPush(EncodeJob{ cv::FrameRef(), std::move(detections), job.pageHash });
+            }
+        }
+        // nothing to upload, give the full-res block back
+        job.full.release();
+        CVI_TDL_Free(&obj_meta);
+        detectStats.record(start);
+    }
+}
+
+// Encode the full-res NV21 stills to JPEG and spool them for upload, or stream
+// a full frame to the remote directly while the spool is empty.
+void encodeStage() {
+    EncodeJob job;
+    while (encodeQueue.pop(job)) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<uchar> buffer;
+        try {
+            const cv::Size frameSize(job.frame.width(), job.frame.height());
+            std::vector<cv::Rect> regions = cropRegions(job.detections, frameSize);
+            if (uploadCrops && !job.detections.empty() && regions.empty()) {
+                std::cerr << "no detection inside the frame" << std::endl;
+                job.frame.release();
+                continue;
+            }
+            UploadPageInfo page;
+            page.framePixels = (uint64_t)frameSize.area();
+            for (const cv::Rect& region : regions) {
+                page.cropPixels += (uint64_t)region.area();
+            }
+            UploadDecision decision = uploadController->decide(page);
+            printf("upload: %s\n", decision.reason.c_str());
+            YuvJpegParams params;
+            params.quality = decision.quality;
+            params.downscale = decision.downscale;
+            params.gray = decision.gray;
+            if (decision.cropsOnly) {
+                bool encoded = encodeCropsPage(job.frame, job.detections, regions, params, buffer);
+                job.frame.release();
+                if (!encoded) {
+                    continue;
+                }
+                // the sidecar is a small part of the page
+                uploadController->recordEncoded(page, decision, buffer.size());
+            } else if (STREAM_UPLOADS && uploadSpool->pendingCount() == 0) {
+                // only this stage appends, the spool stays empty while we stream
+                bool sent = false;
+                bool encoded = streamFullFrame(job.frame, params, buffer, sent);
+                job.frame.release();
+                if (!encoded) {
+                    continue;
+                }
+                uploadController->recordEncoded(page, decision, buffer.size());
+                if (sent) {
+                    pageCache->remember(job.pageHash, job.detections);
+                    encodeStats.record(start);
+                    continue;
+                }
+            } else {
+                bool encoded = jpegEncoder->encode(job.frame, cv::Rect(0, 0, MAX_FRAME_WIDTH, MAX_FRAME_HEIGHT), params,
+                                                   buffer);
+                job.frame.release();
+                if (!encoded) {
+                    continue;
+                }
+                uploadController->recordEncoded(page, decision, buffer.size());
+            }
+        }
+        catch (const std::exception& ex) {
+            std::cerr << "encode failed: " << ex.what() << std::endl;
+            job.frame.release();
+            continue;
+        }
+        encodeStats.record(start);
+        if (!uploadSpool->append(buffer)) {
+            std::cerr << "Unable to spool image, it is lost" << std::endl;
+            continue;
+        }
+        pageCache->remember(job.pageHash, job.detections);
+    }
+}
+
+// Send the spooled pages in order, failed ones are retried with backoff.
+void uploadStage() {
+    uploadSpool->run([](const std::vector<uchar>& buffer) {
+        auto start = std::chrono::steady_clock::now();
+        bool sent = uploadPage(buffer);
+        uploadStats.record(start);
+        return sent;
+    });
+}
+
+// Keep the sharpest of the retained full-res frames, release the others. Empty when there
+// are none.
+cv::FrameRef takeSharpest(std::deque<cv::FrameRef>& candidates) {
+    cv::FrameRef best;
+    double bestScore = -1;
+    int bestIndex = -1;
+    const int count = static_cast<int>(candidates.size());
+    for (int i = 0; i < count; i++) {
+        double score = frameSharpness(candidates[i].gray(), SHARPNESS_STEP);
+        if (score > bestScore) {
+            best = std::move(candidates[i]);
+            bestScore = score;
+            bestIndex = i;
+        }
+    }
+    candidates.clear();
+    if (!best.empty()) {
+        printf("frame %d of the last %d picked, sharpness %.0f\n", bestIndex + 1, count, bestScore);
+    }
+    return best;
+}
+
+// No frame of the settled page could be kept: take a short burst of full-res frames, hand
+// the sharpest to the encoder and go back to preview. The capture thread keeps running
+// through the mode switches, the preview sets still in its ring are skipped.
+void captureStill(EncodeJob job) {
+    cap.set_mode(cv::CAP_MODE_STILL);
+    // only the best frame so far and the one being scored hold a block
+    cv::FrameRef best;
+    double bestScore = -1;
+    int taken = 0;
+    for (int reads = 0; taken < STILL_BURST_FRAMES && reads < STILL_BURST_FRAMES + CAPTURE_RING_SIZE && !interrupted;
+         reads++) {
+        cv::FrameSet frames;
+        if (!cap.read_frames(frames) || frames.full.empty()) {
+            continue;
+        }
+        taken++;
+        double score = frameSharpness(frames.full.gray(), SHARPNESS_STEP);
+        // the best one outlives the next reads
+        if (score > bestScore && cap.retain(frames.full)) {
+            best = std::move(frames.full);
+            bestScore = score;
+        }
+    }
+    cap.set_mode(cv::CAP_MODE_PREVIEW);
+    if (best.empty()) {
         std::cerr << "Captured empty frame!" << std::endl;
         return;
     }
-    if (imagePtrs.second == nullptr) {
-        printf("sengImage() imagePtrs.second is nullptr\n");
-        cap.releaseImagePtr();
-        return;
+    printf("still picked from %d frames, sharpness %.0f\n", taken, bestScore);
+    job.frame = std::move(best);
+    if (!encodeQueue.tryPush(std::move(job))) {
+        std::cerr << "encoder busy, dropping still" << std::endl;
     }
-    void* original_image_ptr = imagePtrs.second;
-    VIDEO_FRAME_INFO_S *frameInfo = reinterpret_cast<VIDEO_FRAME_INFO_S*>(original_image_ptr);
-    if (frameInfo == nullptr) {
-        std::cerr << "sendImage() frameInfo is nullptr" << std::endl;
-        cap.releaseImagePtr();
-        original_image_ptr = nullptr;
-        return;
+}
+
+// Full sensor rate and the full-res stream while a page settles, preview while it moves
+// and once it went to the detector. Returns whether still mode is now on.
+bool setStillMode(bool still) {
+    if (!cap.set_mode(still ? cv::CAP_MODE_STILL : cv::CAP_MODE_PREVIEW)) {
+        std::cerr << "unable to switch to " << (still ? "still" : "preview") << " mode" << std::endl;
+        return !still;
     }
-    // Convert the NV21 frame to BGR cv::Mat.
-    // printf("converting frame info to bgr\n");
-    auto start = std::chrono::high_resolution_clock::now();
-    cv::Mat image = convertNV21FrameToBGR(*frameInfo, MAX_FRAME_WIDTH, MAX_FRAME_HEIGHT, false);
-    if (image.empty()) {
-        std::cerr << "sendImage() image is empty" << std::endl;
-        cap.releaseImagePtr();
-        original_image_ptr = nullptr;
-        return;
+    return still;
+}
+
+// Park the sensor for IDLE_PAUSE_MS. VB, ISP and VPSS stay up, so the first frame after
+// is there within a frame time or two. False when pausing is not supported.
+bool idleSensor() {
+    if (!cap.pause()) {
+        return false;
+    }
+    auto wake = std::chrono::steady_clock::now() + std::chrono::milliseconds(IDLE_PAUSE_MS);
+    while (!interrupted && std::chrono::steady_clock::now() < wake) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
-    cap.releaseImagePtr();
-    original_image_ptr = nullptr;
-    //printf("conversion is done\n");
-    auto end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> duration = end - start;
-    // Print the duration in seconds
-    std::cout << "execution time: " << duration.count() << " seconds" << std::endl;
-    sendMat(image);
+    if (!cap.resume()) {
+        throw std::runtime_error("Failed to resume the camera.");
+    }
+    return true;
+}
+
+void printPipelineStats() {
+    printf("frames: %.0f dropped: %.0f overrun: %.0f map hits: %.0f misses: %.0f retained: %.0f denied: %.0f\n",
+           cap.get(cv::CAP_PROP_CVI_FRAMES), cap.get(cv::CAP_PROP_CVI_DROPPED), cap.get(cv::CAP_PROP_CVI_OVERRUN),
+           cap.get(cv::CAP_PROP_CVI_MAP_HITS), cap.get(cv::CAP_PROP_CVI_MAP_MISSES),
+           cap.get(cv::CAP_PROP_CVI_RETAINED), cap.get(cv::CAP_PROP_CVI_RETAIN_DENIED));
+    captureStats.print();
+    analysisStats.print();
+    detectStats.print();
+    encodeStats.print();
+    jpegEncoder->print();
+    uploadStats.print();
+    httpClient->print();
+    uploadController->print();
+    detectQueue.print();
+    pageCache->print();
+    encodeQueue.print();
+    uploadSpool->print();
 }
 
 // Setup before running main logics
@@ -735,95 +1003,224 @@ void setup() {
     }
 }
 
-// Main processing loop: compare frames and trigger detection if no significant change.
+// Main processing loop: compare frames and hand stable pages to the detect stage.
 void loop() {
-    int changedThreshold = 0;
-    int noChangeCount = 0;
     int totalPixels = 0;
-    cv::Mat previousNoChangeFrame;
 
     openCamera(INPUT_FRAME_WIDTH, INPUT_FRAME_HEIGHT);
     initModel();
-    
+    const char* backendName = std::getenv("JOTTER_CHANGE_DETECTOR");
+    ChangeDetectorBackend backend = parseChangeDetectorBackend(backendName ? backendName : CHANGE_DETECTOR_BACKEND);
+    if (backend == ChangeDetectorBackend::Hardware) {
+        CVI_S32 ret = CVI_TDL_CreateHandle(&motion_tdl_handle);
+        if (ret != CVI_SUCCESS) {
+            throw std::runtime_error("Create motion TDL handle failed with error code: " + std::to_string(ret));
+        }
+    }
+    ChangeDetectorConfig changeConfig;
+    changeConfig.pixelThreshold = PIXEL_DIFF_THRESHOLD;
+    changeConfig.minArea = MOTION_MIN_AREA;
+    changeConfig.tilesX = MOTION_TILES_X;
+    changeConfig.tilesY = MOTION_TILES_Y;
+    std::unique_ptr<ChangeDetector> changeDetector = createChangeDetector(backend, changeConfig, motion_tdl_handle);
+    std::cout << "change detector: " << changeDetector->name() << std::endl;
+    StabilityConfig stabilityConfig;
+    stabilityConfig.enterThreshold = STABLE_ENTER_THRESHOLD;
+    stabilityConfig.exitThreshold = STABLE_EXIT_THRESHOLD;
+    stabilityConfig.minStableFrames = MIN_STABLE_FRAMES;
+    stabilityConfig.maxStableFrames = MAX_STABLE_FRAMES;
+    loadStabilityConfig(stabilityConfigFilePath, stabilityConfig);
+    StabilityEstimator stability(stabilityConfig);
+    const char* uploadMode = std::getenv("JOTTER_UPLOAD_MODE");
+    uploadCrops = std::string(uploadMode ? uploadMode : UPLOAD_MODE) == "crops";
+    const bool previewAvailable = cap.set_mode(cv::CAP_MODE_PREVIEW);
+    if (!previewAvailable) {
+        std::cerr << "preview mode not available, staying at full rate" << std::endl;
+    }
+    // capture and VPSS run ahead on their own thread while we diff and infer
+    if (!cap.start_capture_thread(CAPTURE_RING_SIZE)) {
+        std::cerr << "capture thread not available, reading frames inline" << std::endl;
+    }
+    // pages a crash or reboot left behind go out first
+    UploadSpoolConfig spoolConfig;
+    spoolConfig.directory = spoolDirectoryPath;
+    spoolConfig.maxBytes = SPOOL_MAX_BYTES;
+    spoolConfig.segmentBytes = SPOOL_SEGMENT_BYTES;
+    spoolConfig.retryMinMs = UPLOAD_RETRY_MIN_MS;
+    spoolConfig.retryMaxMs = UPLOAD_RETRY_MAX_MS;
+    uploadSpool.reset(new UploadSpool(spoolConfig));
+    if (!uploadSpool->open()) {
+        throw std::runtime_error("Failed to open upload spool.");
+    }
+    PageCacheConfig pageCacheConfig;
+    pageCacheConfig.capacity = PAGE_CACHE_SIZE;
+    pageCacheConfig.maxHashDistance = PAGE_HASH_MAX_DISTANCE;
+    pageCacheConfig.minBoxOverlap = PAGE_MARK_MIN_OVERLAP;
+    pageCache.reset(new PageCache(pageCacheConfig));
+    JpegEncoderConfig jpegConfig;
+    jpegConfig.channel = JPEG_VENC_CHANNEL;
+    jpegConfig.width = MAX_FRAME_WIDTH;
+    jpegConfig.height = MAX_FRAME_HEIGHT;
+    jpegConfig.quality = JPEG_QUALITY;
+    jpegConfig.bufferBytes = JPEG_BUFFER_BYTES;
+    jpegEncoder.reset(new JpegEncoder(jpegConfig));
+    std::cout << "jpeg encoder: " << (jpegEncoder->open() ? "venc" : "cpu") << std::endl;
+    UploadControllerConfig uploadConfig;
+    uploadConfig.targetMs = UPLOAD_TARGET_MS;
+    uploadConfig.sendCrops = uploadCrops;
+    uploadController.reset(new UploadController(uploadConfig));
+    // the stages stop and are joined when we leave, also when an exception unwinds
+    StageThreads stages;
+    stages.closeOnExit(detectQueue);
+    stages.closeOnExit(encodeQueue);
+    stages.onExit([] { uploadSpool->stop(); });
+    stages.start(detectStage);
+    stages.start(encodeStage);
+    stages.start(uploadStage);
+
+    auto lastMotion = std::chrono::steady_clock::now();
+    bool idleAvailable = true;
+    bool stillMode = false;
+    // retained full-res frames of the last sets while the page settles, oldest first
+    std::deque<cv::FrameRef> stillCandidates;
     while (!interrupted) {
-        cv::Mat img;
-        //capture() method will set image_ptr and original_image_ptr
-        std::pair<void*, void*> imagePtrs = cap.capture(img);
-        if (img.empty()) {
+        if (reloadRequested) {
+            reloadRequested = 0;
+            StabilityConfig config = stability.getConfig();
+            if (loadStabilityConfig(stabilityConfigFilePath, config)) {
+                stability.setConfig(config);
+                printf("stability config reloaded\n");
+            } else {
+                std::cerr << "Unable to read " << stabilityConfigFilePath << std::endl;
+            }
+        }
+        EncodeJob still;
+        if (stillQueue.tryPop(still)) {
+            // skip it when the page moved while the model was running
+            if (stability.stable()) {
+                captureStill(std::move(still));
+            }
+        } else if (idleAvailable && stability.stable()
+                   && std::chrono::steady_clock::now() - lastMotion > std::chrono::milliseconds(IDLE_AFTER_MS)) {
+            // the next frame is compared with the last one before the pause
+            idleAvailable = idleSensor();
+            if (!idleAvailable) {
+                std::cerr << "sensor cannot be paused, staying awake" << std::endl;
+            }
+        }
+        // the frames stay in their VB blocks until they go out of scope, the change detector
+        // reads the Y plane of the motion stream in place
+        auto waitStart = std::chrono::steady_clock::now();
+        cv::FrameSet frames;
+        if (!cap.read_frames(frames)) {
             printf("loop img is empty\n");
-            cap.releaseImagePtr();
             continue;
         }
-        if (imagePtrs.first == nullptr) {
-            std::cerr << "main.cpp imagePtrs.first is nullptr" << std::endl;
-            cap.releaseImagePtr();
+        captureStats.record(waitStart);
+        if (frames.motion.empty()) {
+            printf("loop img is empty\n");
             continue;
         }
-        void* image_ptr = imagePtrs.first;
+        auto start = std::chrono::steady_clock::now();
         if (totalPixels == 0) {
-            totalPixels = img.cols * img.rows;
+            totalPixels = frames.motion.width() * frames.motion.height();
         }
-        if (changedThreshold == 0) {
-            changedThreshold = static_cast<int>(totalPixels * CHANGE_THRESHOLD_PERCENT);
+        if (!changeDetector->hasReference()) {
+            changeDetector->setReference(frames.motion);
+            continue;
         }
-        cv::Mat grayFrame;
-        cv::cvtColor(img, grayFrame, cv::COLOR_BGR2GRAY);
-        if (previousNoChangeFrame.empty()) {
-            previousNoChangeFrame = grayFrame.clone();
-            cap.releaseImagePtr();
-            image_ptr = nullptr;
+        // frame to frame motion, the estimator does the smoothing over time
+        int nonZeroCount = changeDetector->compare(frames.motion);
+        std::vector<int> tiles = changeDetector->tileCounts();
+        changeDetector->setReference(frames.motion);
+        if (nonZeroCount < 0) {
+            std::cerr << "change detection failed, starting over from this frame" << std::endl;
+            stability.reset();
             continue;
         }
-        cv::Mat diff, thresh;
-        cv::absdiff(grayFrame, previousNoChangeFrame, diff);
-        cv::threshold(diff, thresh, 30, 255, cv::THRESH_BINARY);
-        int nonZeroCount = cv::countNonZero(thresh);
-        if (nonZeroCount < changedThreshold) {
-            noChangeCount++;
-            if (noChangeCount != NO_CHANGE_FRAME_LIMIT) {
-                cap.releaseImagePtr();
-                image_ptr = nullptr;
-                continue;
+        // the opencv backend has no tiles, it reports the whole frame as one
+        if (tiles.empty()) {
+            tiles.assign(1, nonZeroCount);
+        }
+        StabilityEstimator::Event event = stability.update(tiles, totalPixels / static_cast<int>(tiles.size()));
+        analysisStats.record(start);
+        // the page went quiet, have the full-res stream running by the time it settles
+        if (previewAvailable && !stillMode && !stability.stable() && stability.stillFrames() > 0) {
+            stillMode = setStillMode(true);
+        } else if (stillMode && stability.energy() > stability.getConfig().exitThreshold) {
+            stillCandidates.clear();
+            stillMode = setStillMode(false);
+        }
+        if (event != StabilityEstimator::Settled && stillMode && !frames.full.empty()) {
+            // room for the settled set's own frame
+            while (static_cast<int>(stillCandidates.size()) >= STILL_CANDIDATES - 1) {
+                stillCandidates.pop_front();
             }
-            std::cout << "No significant change detected." << std::endl;
-            //convert image_ptr to VIDEO_FRAME_INFO_S*
-            VIDEO_FRAME_INFO_S *frameInfo = reinterpret_cast<VIDEO_FRAME_INFO_S*>(image_ptr);
-            if (frameInfo == nullptr) {
-                std::cerr << "frameInfo is nullptr" << std::endl;
-                cap.releaseImagePtr();
-                image_ptr = nullptr;
-                continue;
+            if (cap.retain(frames.full)) {
+                stillCandidates.push_back(std::move(frames.full));
             }
-            cvtdl_object_t obj_meta = {0};
-            CVI_TDL_Detection(tdl_handle, frameInfo, CVI_TDL_SUPPORTED_MODEL_YOLOV8_DETECTION, &obj_meta);
-            cap.releaseImagePtr();
-            image_ptr = nullptr;
-            //check for detections
-            if (obj_meta.size == 0) {
-                continue;
+        }
+        if (event == StabilityEstimator::Moved) {
+            lastMotion = std::chrono::steady_clock::now();
+            int percent = static_cast<int>(stability.energy() * 100);
+            std::cout << "Change detected: " << percent << "%";
+            if (tiles.size() > 1) {
+                int busiest = std::max_element(tiles.begin(), tiles.end()) - tiles.begin();
+                std::cout << " mostly in tile " << busiest % MOTION_TILES_X << "," << busiest / MOTION_TILES_X;
             }
-            std::printf("Detected %d objects\n", obj_meta.size);
-            sendImage();
-        } else {
-            int percent = static_cast<int>((static_cast<float>(nonZeroCount) / totalPixels) * 100);
-            std::cout << "Change detected: " << percent << "%" << std::endl;
-            noChangeCount = 0;
-            cap.releaseImagePtr();
-            image_ptr = nullptr;
+            std::cout << std::endl;
+            continue;
+        }
+        if (event != StabilityEstimator::Settled) {
+            continue;
+        }
+        printf("Page settled after %d still frames, noise floor %.4f\n", stability.stillFrames(), stability.noiseFloor());
+        printPipelineStats();
+        // back to preview until the next page, this set keeps its frames and a still burst
+        // switches over on its own
+        if (stillMode) {
+            stillMode = setStillMode(false);
+        }
+        // the hash comes from the tiny Y plane we already have mapped, not from the model input
+        uint64_t hash = pageHash(frames.motion.gray());
+        // the frames handed on outlive this set, they have to fit the retain budget or VPSS runs dry
+        if (!cap.retain(frames.tdl)) {
+            std::cerr << "detector busy, skipping this page" << std::endl;
+            stillCandidates.clear();
+            continue;
+        }
+        if (!frames.full.empty()) {
+            if (cap.retain(frames.full)) {
+                stillCandidates.push_back(std::move(frames.full));
+            } else {
+                frames.full.release();
+            }
+        }
+        // without any the detect stage falls back to a still burst
+        cv::FrameRef sharpest = takeSharpest(stillCandidates);
+        if (!detectQueue.tryPush(DetectJob{ std::move(frames.tdl), std::move(sharpest), hash })) {
+            std::cerr << "detector busy, skipping this page" << std::endl;
         }
-        previousNoChangeFrame = grayFrame.clone();
     }
 }
 
 int main() {
     modelFilePath = getExecutableDirectory() + "/" + std::string(MODEL_FILE_NAME);
     wifiConfigFilePath = getExecutableDirectory() + "/" + std::string(WIFI_CONFIG_FILE_NAME);
+    spoolDirectoryPath = getExecutableDirectory() + "/" + std::string(SPOOL_DIR_NAME);
+    stabilityConfigFilePath = getExecutableDirectory() + "/" + std::string(STABILITY_CONFIG_FILE_NAME);
     controlUserLED("on", 0);
     if(curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
         std::cerr << "curl_global_init() failed" << std::endl;
         return -1;
     }
+    HttpClientConfig httpConfig;
+    httpConfig.maxIdleHandles = HTTP_IDLE_HANDLES;
+    httpConfig.timeoutMs = HTTP_TIMEOUT_MS;
+    httpConfig.connectTimeoutMs = HTTP_CONNECT_TIMEOUT_MS;
+    httpClient.reset(new HttpClient(httpConfig));
     signal(SIGINT, interruptHandler);
+    signal(SIGHUP, reloadHandler);
     try {
         setup();
         loop();
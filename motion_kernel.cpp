@@ -0,0 +1,115 @@
+#include "motion_kernel.h"
+
+#include <cstring>
+
+#if __riscv_vector
+#include <riscv_vector.h>
+#endif
+
+namespace {
+
+typedef int (*CountRowFunc)(const uint8_t* a, const uint8_t* b, int n, int step, int threshold);
+
+int countRowScalar(const uint8_t* a, const uint8_t* b, int n, int step, int threshold) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        int d = (int)a[i * step] - (int)b[i * step];
+        if (d < 0)
+            d = -d;
+        count += d > threshold;
+    }
+    return count;
+}
+
+#if __riscv_vector
+// |a - b| as max - min, compare against the threshold into a mask and pop-count it,
+// nothing is written back to memory
+int countRowRVV(const uint8_t* a, const uint8_t* b, int n, int step, int threshold) {
+    int count = 0;
+    if (step == 1) {
+        while (n > 0) {
+            size_t vl = vsetvl_e8m8(n);
+            vuint8m8_t va = vle8_v_u8m8(a, vl);
+            vuint8m8_t vb = vle8_v_u8m8(b, vl);
+            vuint8m8_t vd = vsub_vv_u8m8(vmaxu_vv_u8m8(va, vb, vl), vminu_vv_u8m8(va, vb, vl), vl);
+            vbool1_t changed = vmsgtu_vx_u8m8_b1(vd, (uint8_t)threshold, vl);
+            count += (int)vpopc_m_b1(changed, vl);
+            a += vl;
+            b += vl;
+            n -= vl;
+        }
+    } else {
+        while (n > 0) {
+            size_t vl = vsetvl_e8m8(n);
+            vuint8m8_t va = vlse8_v_u8m8(a, step, vl);
+            vuint8m8_t vb = vlse8_v_u8m8(b, step, vl);
+            vuint8m8_t vd = vsub_vv_u8m8(vmaxu_vv_u8m8(va, vb, vl), vminu_vv_u8m8(va, vb, vl), vl);
+            vbool1_t changed = vmsgtu_vx_u8m8_b1(vd, (uint8_t)threshold, vl);
+            count += (int)vpopc_m_b1(changed, vl);
+            a += vl * step;
+            b += vl * step;
+            n -= vl;
+        }
+    }
+    return count;
+}
+#endif
+
+int countChanged(CountRowFunc countRow, const uint8_t* a, int strideA, const uint8_t* b, int strideB,
+                 int width, int height, int threshold, int step,
+                 int tilesX, int tilesY, int* tileCounts) {
+    if (step < 1)
+        step = 1;
+    if (tilesX < 1 || tilesY < 1 || tileCounts == nullptr) {
+        tilesX = 1;
+        tilesY = 1;
+        tileCounts = nullptr;
+    }
+    if (tileCounts != nullptr)
+        memset(tileCounts, 0, sizeof(int) * tilesX * tilesY);
+    if (threshold > 255)
+        return 0;
+    if (threshold < 0)
+        threshold = -1;
+
+    int total = 0;
+    for (int y = 0; y < height; y += step) {
+        const uint8_t* rowA = a + (size_t)y * strideA;
+        const uint8_t* rowB = b + (size_t)y * strideB;
+        int* tileRow = tileCounts != nullptr ? tileCounts + (y * tilesY / height) * tilesX : nullptr;
+        for (int tx = 0; tx < tilesX; tx++) {
+            // first sampled column at or after the tile start
+            int x0 = (tx * width / tilesX + step - 1) / step * step;
+            int x1 = (tx + 1) * width / tilesX;
+            if (x0 >= x1)
+                continue;
+            int n = (x1 - x0 + step - 1) / step;
+            int count = threshold < 0 ? n : countRow(rowA + x0, rowB + x0, n, step, threshold);
+            if (tileRow != nullptr)
+                tileRow[tx] += count;
+            total += count;
+        }
+    }
+    return total;
+}
+
+} // namespace
+
+int countChangedPixelsScalar(const uint8_t* a, int strideA, const uint8_t* b, int strideB,
+                             int width, int height, int threshold, int step,
+                             int tilesX, int tilesY, int* tileCounts) {
+    return countChanged(countRowScalar, a, strideA, b, strideB, width, height, threshold, step,
+                        tilesX, tilesY, tileCounts);
+}
+
+int countChangedPixels(const uint8_t* a, int strideA, const uint8_t* b, int strideB,
+                       int width, int height, int threshold, int step,
+                       int tilesX, int tilesY, int* tileCounts) {
+#if __riscv_vector
+    return countChanged(countRowRVV, a, strideA, b, strideB, width, height, threshold, step,
+                        tilesX, tilesY, tileCounts);
+#else
+    return countChanged(countRowScalar, a, strideA, b, strideB, width, height, threshold, step,
+                        tilesX, tilesY, tileCounts);
+#endif
+}
@@ -0,0 +1,21 @@
+#ifndef MOTION_KERNEL_H
+#define MOTION_KERNEL_H
+
+#include <cstdint>
+
+// Fused absdiff + threshold + count over two 8-bit planes in a single pass.
+//
+// Counts the pixels where |a - b| > threshold, looking at every step-th row
+// and column only. The plane is split into tilesX x tilesY tiles and the
+// count of each tile is written row-major to tileCounts, which may be null
+// when only the total is wanted. Returns the total count.
+int countChangedPixels(const uint8_t* a, int strideA, const uint8_t* b, int strideB,
+                       int width, int height, int threshold, int step,
+                       int tilesX, int tilesY, int* tileCounts);
+
+// Portable version of the above, also used when the build has no RVV.
+int countChangedPixelsScalar(const uint8_t* a, int strideA, const uint8_t* b, int strideB,
+                             int width, int height, int threshold, int step,
+                             int tilesX, int tilesY, int* tileCounts);
+
+#endif // MOTION_KERNEL_H
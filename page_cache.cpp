@@ -0,0 +1,97 @@
+#include "page_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+float iou(const Detection& a, const Detection& b) {
+    float w = std::min(a.x2, b.x2) - std::max(a.x1, b.x1);
+    float h = std::min(a.y2, b.y2) - std::max(a.y1, b.y1);
+    if (w <= 0 || h <= 0)
+        return 0;
+    float inter = w * h;
+    float areaA = (a.x2 - a.x1) * (a.y2 - a.y1);
+    float areaB = (b.x2 - b.x1) * (b.y2 - b.y1);
+    return inter / (areaA + areaB - inter);
+}
+
+} // namespace
+
+uint64_t pageHash(const cv::Mat& gray) {
+    if (gray.empty() || gray.cols < 9 || gray.rows < 8)
+        return 0;
+    // box average over the cells, integer sums only, the input is a small preview plane
+    uint32_t cells[8][9];
+    for (int cy = 0; cy < 8; cy++) {
+        const int y0 = cy * gray.rows / 8;
+        const int y1 = (cy + 1) * gray.rows / 8;
+        for (int cx = 0; cx < 9; cx++) {
+            const int x0 = cx * gray.cols / 9;
+            const int x1 = (cx + 1) * gray.cols / 9;
+            uint32_t sum = 0;
+            for (int y = y0; y < y1; y++) {
+                const uint8_t* row = gray.ptr<uint8_t>(y);
+                for (int x = x0; x < x1; x++)
+                    sum += row[x];
+            }
+            cells[cy][cx] = sum / ((y1 - y0) * (x1 - x0));
+        }
+    }
+    uint64_t hash = 0;
+    for (int cy = 0; cy < 8; cy++)
+        for (int cx = 0; cx < 8; cx++)
+            hash = (hash << 1) | (cells[cy][cx] > cells[cy][cx + 1]);
+    return hash;
+}
+
+int hammingDistance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
+
+bool PageCache::sameMarks(const std::vector<Detection>& cached, const std::vector<Detection>& detections) const {
+    for (const Detection& d : detections) {
+        bool found = false;
+        for (const Detection& c : cached) {
+            if (c.classId == d.classId && iou(c, d) >= config.minBoxOverlap) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+bool PageCache::seen(uint64_t hash, const std::vector<Detection>& detections) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    checked++;
+    for (const Page& page : pages) {
+        if (hammingDistance(page.hash, hash) <= config.maxHashDistance && sameMarks(page.detections, detections)) {
+            suppressedCount++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PageCache::remember(uint64_t hash, const std::vector<Detection>& detections) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = pages.begin(); it != pages.end(); ++it) {
+        if (hammingDistance(it->hash, hash) <= config.maxHashDistance) {
+            // the same page with new marks, the upload had all of them
+            pages.erase(it);
+            break;
+        }
+    }
+    pages.push_front({ hash, detections });
+    if (pages.size() > config.capacity)
+        pages.pop_back();
+}
+
+void PageCache::print() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::printf("  %-8s pages: %zu/%zu checked: %llu suppressed: %llu\n", "dedup", pages.size(), config.capacity,
+                (unsigned long long)checked, (unsigned long long)suppressedCount);
+}
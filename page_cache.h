@@ -0,0 +1,60 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <vector>
+
+#include "detection_crops.h"
+
+// 64-bit difference hash of a gray image: the image is averaged down to 9x8
+// cells and every bit says whether a cell is brighter than its right
+// neighbour. Stable under small exposure changes and a few pixels of shift.
+uint64_t pageHash(const cv::Mat& gray);
+
+int hammingDistance(uint64_t a, uint64_t b);
+
+struct PageCacheConfig {
+    size_t capacity = 16;           // pages remembered, least recently seen is forgotten first
+    int maxHashDistance = 8;        // bits two hashes of the same page may differ in
+    float minBoxOverlap = 0.5f;     // IoU a mark needs with a same-class mark of the cached page
+};
+
+// Recently uploaded pages, to avoid sending the same page again while the
+// user is still reading it. A page counts as seen when its hash is close to
+// a cached one and every mark on it overlaps a mark of the same class there,
+// so a new underline on a known page still goes out. Only pages that were
+// really handed to the upload are remembered, one dropped on the way is
+// tried again the next time it settles.
+class PageCache {
+public:
+    explicit PageCache(const PageCacheConfig& config) : config(config) {}
+
+    // True when the page matches a cached one. Changes nothing but the counters.
+    bool seen(uint64_t hash, const std::vector<Detection>& detections) const;
+
+    // The page went out, or waits in the spool. It becomes the most recent,
+    // replacing the cached page it matches if there is one.
+    void remember(uint64_t hash, const std::vector<Detection>& detections);
+
+    void print() const;
+
+private:
+    struct Page {
+        uint64_t hash;
+        std::vector<Detection> detections;
+    };
+
+    bool sameMarks(const std::vector<Detection>& cached, const std::vector<Detection>& detections) const;
+
+    PageCacheConfig config;
+    mutable std::mutex mutex;
+    std::list<Page> pages;      // most recent first
+    mutable uint64_t checked = 0;
+    mutable uint64_t suppressedCount = 0;
+};
+
+#endif // PAGE_CACHE_H
@@ -0,0 +1,166 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Latency counters of one pipeline stage, written by the stage thread and
+// read from anywhere for logging.
+class StageStats {
+public:
+    explicit StageStats(const char* name) : name(name) {}
+
+    // One item done, started at start.
+    void record(std::chrono::steady_clock::time_point start) {
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        items.fetch_add(1, std::memory_order_relaxed);
+        totalUs.fetch_add(us, std::memory_order_relaxed);
+        uint64_t max = maxUs.load(std::memory_order_relaxed);
+        while (us > max && !maxUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+        }
+    }
+
+    void print() const {
+        uint64_t n = items.load(std::memory_order_relaxed);
+        uint64_t total = totalUs.load(std::memory_order_relaxed);
+        std::printf("  %-8s items: %llu avg: %.1f ms max: %.1f ms\n", name, (unsigned long long)n,
+                    n ? total / 1000.0 / n : 0.0, maxUs.load(std::memory_order_relaxed) / 1000.0);
+    }
+
+private:
+    const char* name;
+    std::atomic<uint64_t> items{0};
+    std::atomic<uint64_t> totalUs{0};
+    std::atomic<uint64_t> maxUs{0};
+};
+
+// Fixed capacity queue between two stages. push() applies backpressure by
+// blocking while full, tryPush() lets a producer that must not stall drop
+// the item instead. close() wakes everybody up, pop() then drains what is
+// left and returns false.
+template <typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(const char* name, size_t capacity) : name(name), capacity(capacity) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        enqueue(std::move(item));
+        return true;
+    }
+
+    bool tryPush(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (closed || items.size() >= capacity) {
+            dropped++;
+            return false;
+        }
+        enqueue(std::move(item));
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Non-blocking pop for a stage that polls between its own work.
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+    // A failed tryPush() was a closed queue rather than a full one.
+    bool isClosed() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed;
+    }
+
+    void print() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::printf("  %-8s depth: %zu/%zu max: %zu dropped: %llu\n", name, items.size(), capacity, maxDepth,
+                    (unsigned long long)dropped);
+    }
+
+private:
+    void enqueue(T item) {
+        items.push_back(std::move(item));
+        if (items.size() > maxDepth)
+            maxDepth = items.size();
+        notEmpty.notify_one();
+    }
+
+    const char* name;
+    const size_t capacity;
+    mutable std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> items;
+    bool closed = false;
+    size_t maxDepth = 0;
+    uint64_t dropped = 0;
+};
+
+// Owns the stage threads. On destruction, including unwinding from an
+// exception, the queues are closed so every stage sees end of input, and
+// the threads are joined before the queues they use go away.
+class StageThreads {
+public:
+    ~StageThreads() {
+        for (auto& close : closers)
+            close();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    template <typename T>
+    void closeOnExit(BoundedQueue<T>& queue) {
+        closers.push_back([&queue] { queue.close(); });
+    }
+
+    // For stages that wait on something other than a queue.
+    void onExit(std::function<void()> stop) {
+        closers.push_back(std::move(stop));
+    }
+
+    void start(std::function<void()> body) {
+        threads.emplace_back(std::move(body));
+    }
+
+private:
+    std::vector<std::function<void()>> closers;
+    std::vector<std::thread> threads;
+};
+
+#endif // PIPELINE_H
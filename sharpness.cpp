@@ -0,0 +1,24 @@
+#include "sharpness.h"
+
+#include <cstdint>
+
+double frameSharpness(const cv::Mat& gray, int step) {
+    if (step < 1)
+        step = 1;
+    if (gray.empty() || gray.rows < 3 || gray.cols < 3)
+        return 0;
+    uint64_t sum = 0;
+    uint64_t count = 0;
+    for (int y = 1; y < gray.rows - 1; y += step) {
+        const uint8_t* r0 = gray.ptr<uint8_t>(y - 1);
+        const uint8_t* r1 = gray.ptr<uint8_t>(y);
+        const uint8_t* r2 = gray.ptr<uint8_t>(y + 1);
+        for (int x = 1; x < gray.cols - 1; x += step) {
+            int gx = (r0[x + 1] + 2 * r1[x + 1] + r2[x + 1]) - (r0[x - 1] + 2 * r1[x - 1] + r2[x - 1]);
+            int gy = (r2[x - 1] + 2 * r2[x] + r2[x + 1]) - (r0[x - 1] + 2 * r0[x] + r0[x + 1]);
+            sum += (uint64_t)(gx * gx + gy * gy);
+            count++;
+        }
+    }
+    return count ? (double)sum / count : 0;
+}
@@ -0,0 +1,11 @@
+#ifndef SHARPNESS_H
+#define SHARPNESS_H
+
+#include <opencv2/core.hpp>
+
+// Tenengrad focus measure: mean squared Sobel gradient magnitude, sampled on
+// every step-th row and column of an 8-bit plane. Only meaningful for
+// comparing frames of the same scene, higher is sharper.
+double frameSharpness(const cv::Mat& gray, int step);
+
+#endif // SHARPNESS_H
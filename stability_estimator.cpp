@@ -0,0 +1,106 @@
+#include "stability_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+std::string trimmed(const std::string& s) {
+    size_t start = s.find_first_not_of(" \t\r\n");
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return (start == std::string::npos || end == std::string::npos) ? "" : s.substr(start, end - start + 1);
+}
+
+} // namespace
+
+bool loadStabilityConfig(const std::string& path, StabilityConfig& config) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+    StabilityConfig loaded = config;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t pos = line.find(':');
+        if (pos == std::string::npos)
+            continue;
+        std::string key = trimmed(line.substr(0, pos));
+        std::string value = trimmed(line.substr(pos + 1));
+        char* end = nullptr;
+        double number = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || number < 0) {
+            std::cerr << "stability config: bad value for " << key << ": " << value << std::endl;
+            continue;
+        }
+        if (key == "emaAlpha")
+            loaded.emaAlpha = (float)number;
+        else if (key == "enterThreshold")
+            loaded.enterThreshold = (float)number;
+        else if (key == "exitThreshold")
+            loaded.exitThreshold = (float)number;
+        else if (key == "minStableFrames")
+            loaded.minStableFrames = (int)number;
+        else if (key == "maxStableFrames")
+            loaded.maxStableFrames = (int)number;
+        else if (key == "noiseAlpha")
+            loaded.noiseAlpha = (float)number;
+        else if (key == "noiseMargin")
+            loaded.noiseMargin = (float)number;
+        else
+            std::cerr << "stability config: unknown key " << key << std::endl;
+    }
+    loaded.emaAlpha = std::min(std::max(loaded.emaAlpha, 0.01f), 1.f);
+    loaded.noiseAlpha = std::min(loaded.noiseAlpha, 1.f);
+    loaded.exitThreshold = std::max(loaded.exitThreshold, loaded.enterThreshold);
+    loaded.minStableFrames = std::max(loaded.minStableFrames, 1);
+    loaded.maxStableFrames = std::max(loaded.maxStableFrames, loaded.minStableFrames);
+    config = loaded;
+    return true;
+}
+
+int StabilityEstimator::requiredFrames() const {
+    float ratio = config.enterThreshold > 0 ? std::min(noise / config.enterThreshold, 1.f) : 1.f;
+    return config.minStableFrames + (int)std::lround((config.maxStableFrames - config.minStableFrames) * ratio);
+}
+
+StabilityEstimator::Event StabilityEstimator::update(const std::vector<int>& tileCounts, int tilePixels) {
+    if (tileCounts.empty() || tilePixels <= 0)
+        return None;
+    // a new tile layout starts from the current frame instead of ramping up from zero
+    const bool first = ema.size() != tileCounts.size();
+    if (first)
+        ema.assign(tileCounts.size(), 0.f);
+    peakEnergy = 0.f;
+    for (size_t i = 0; i < tileCounts.size(); i++) {
+        float e = (float)tileCounts[i] / tilePixels;
+        ema[i] = first ? e : ema[i] + config.emaAlpha * (e - ema[i]);
+        peakEnergy = std::max(peakEnergy, ema[i]);
+    }
+    if (peakEnergy < config.exitThreshold)
+        noise += config.noiseAlpha * (peakEnergy - noise);
+
+    if (isStable) {
+        if (peakEnergy > config.exitThreshold) {
+            isStable = false;
+            stillCount = 0;
+            return Moved;
+        }
+        return None;
+    }
+    const float stillLevel = std::min(std::max(config.enterThreshold, noise * config.noiseMargin), config.exitThreshold);
+    stillCount = peakEnergy < stillLevel ? stillCount + 1 : 0;
+    if (stillCount >= requiredFrames()) {
+        isStable = true;
+        return Settled;
+    }
+    return None;
+}
+
+void StabilityEstimator::reset() {
+    ema.clear();
+    peakEnergy = 0.f;
+    stillCount = 0;
+    isStable = false;
+}
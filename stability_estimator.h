@@ -0,0 +1,74 @@
+#ifndef STABILITY_ESTIMATOR_H
+#define STABILITY_ESTIMATOR_H
+
+#include <string>
+#include <vector>
+
+struct StabilityConfig {
+    float emaAlpha = 0.7f;          // weight of the newest frame in the per-tile motion average
+    float enterThreshold = 0.01f;   // changed fraction of the busiest tile below which the page counts as still
+    float exitThreshold = 0.05f;    // changed fraction above which a still page counts as moving again
+    int minStableFrames = 2;        // still frames needed on a quiet scene
+    int maxStableFrames = 10;       // still frames needed once the noise floor reaches enterThreshold
+    float noiseAlpha = 0.05f;       // how fast the noise floor follows the still scene
+    float noiseMargin = 2.f;        // the still level is raised to this many times the noise floor
+};
+
+// Reads "key: value" lines named like the fields above, unknown keys and
+// bad values are reported and skipped. False when the file cannot be read.
+bool loadStabilityConfig(const std::string& path, StabilityConfig& config);
+
+// Decides from frame to frame motion whether the page is held still.
+//
+// Each tile keeps an exponential moving average of its changed pixel
+// fraction and the busiest tile stands for the frame, so a hand in one
+// corner is not averaged away by a still page. The page becomes stable
+// after enough frames below the still level and only stops being stable
+// above the higher exit level. While the scene is not moving, a slow
+// average of the motion tracks the sensor and lighting noise; a noisy
+// scene raises the still level and needs more still frames before it
+// counts, a quiet one fires after minStableFrames.
+class StabilityEstimator {
+public:
+    enum Event {
+        None,
+        Settled,    // became stable on this frame
+        Moved       // stopped being stable on this frame
+    };
+
+    explicit StabilityEstimator(const StabilityConfig& config) : config(config) {}
+
+    // Changed pixel counts per tile of one frame against the previous one,
+    // tilePixels being the pixels compared per tile.
+    Event update(const std::vector<int>& tileCounts, int tilePixels);
+
+    // Forget the history, the next frame starts over as moving.
+    void reset();
+
+    bool stable() const { return isStable; }
+
+    // Smoothed changed fraction of the busiest tile after the last update.
+    float energy() const { return peakEnergy; }
+
+    float noiseFloor() const { return noise; }
+
+    int stillFrames() const { return stillCount; }
+
+    // Still frames currently needed to settle.
+    int requiredFrames() const;
+
+    // Takes effect on the next update, the history is kept.
+    void setConfig(const StabilityConfig& newConfig) { config = newConfig; }
+
+    const StabilityConfig& getConfig() const { return config; }
+
+private:
+    StabilityConfig config;
+    std::vector<float> ema;
+    float peakEnergy = 0.f;
+    float noise = 0.f;
+    int stillCount = 0;
+    bool isStable = false;
+};
+
+#endif // STABILITY_ESTIMATOR_H
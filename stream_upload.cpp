@@ -0,0 +1,63 @@
+#include "stream_upload.h"
+
+#include <algorithm>
+#include <cstring>
+
+StreamUpload::StreamUpload(HttpClient& client, const std::string& url, const std::vector<std::string>& headers,
+                           long timeoutMs, size_t queueChunks)
+    : chunks("stream", queueChunks) {
+    sender = std::thread([this, &client, url, headers, timeoutMs] {
+        std::vector<uint8_t> chunk;
+        size_t offset = 0;
+        HttpBodyReader read = [&](char* out, size_t size) -> size_t {
+            while (offset == chunk.size()) {
+                if (!chunks.pop(chunk))
+                    return aborted ? HttpClient::READ_ABORT : 0;
+                offset = 0;
+            }
+            size_t n = std::min(size, chunk.size() - offset);
+            memcpy(out, chunk.data() + offset, n);
+            offset += n;
+            return n;
+        };
+        result = client.postStream(url, read, headers, timeoutMs);
+        // the producer must not block on a send that gave up
+        chunks.close();
+    });
+}
+
+StreamUpload::~StreamUpload() {
+    if (!ended)
+        end(false);
+}
+
+bool StreamUpload::write(const uint8_t* data, size_t size) {
+    if (chunks.tryPush(std::vector<uint8_t>(data, data + size)))
+        return true;
+    // refused because the send gave up, not because the link is behind
+    if (chunks.isClosed())
+        return false;
+    if (!chunks.push(std::vector<uint8_t>(data, data + size)))
+        return false;
+    waited = true;
+    return true;
+}
+
+HttpResult StreamUpload::finish() {
+    return end(true);
+}
+
+HttpResult StreamUpload::abort() {
+    return end(false);
+}
+
+HttpResult StreamUpload::end(bool complete) {
+    if (ended)
+        return result;
+    if (!complete)
+        aborted = true;
+    chunks.close();
+    sender.join();
+    ended = true;
+    return result;
+}
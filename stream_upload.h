@@ -0,0 +1,53 @@
+#ifndef STREAM_UPLOAD_H
+#define STREAM_UPLOAD_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_client.h"
+#include "pipeline.h"
+
+// A POST whose body goes out while it is still being produced. The
+// producer hands pieces to write(), a sender thread feeds them to
+// HttpClient::postStream() as libcurl asks for them, with chunked transfer
+// encoding. At most queueChunks pieces wait between the two.
+class StreamUpload {
+public:
+    StreamUpload(HttpClient& client, const std::string& url, const std::vector<std::string>& headers,
+                 long timeoutMs, size_t queueChunks);
+
+    // Aborts the request unless finish() or abort() ran.
+    ~StreamUpload();
+
+    // Queue the next piece, blocks while the sender is behind. False once
+    // the send gave up, further pieces are dropped then.
+    bool write(const uint8_t* data, size_t size);
+
+    // End of the body, waits for the answer.
+    HttpResult finish();
+
+    // The body is incomplete, the request fails.
+    HttpResult abort();
+
+    // write() had to wait for the sender at least once, so the upload time
+    // is what the link took rather than what the producer did.
+    bool networkBound() const { return waited; }
+
+private:
+    StreamUpload(const StreamUpload&) = delete;
+    StreamUpload& operator=(const StreamUpload&) = delete;
+
+    HttpResult end(bool complete);
+
+    BoundedQueue<std::vector<uint8_t>> chunks;
+    std::atomic<bool> aborted{false};
+    bool waited = false;
+    bool ended = false;
+    HttpResult result;
+    std::thread sender;
+};
+
+#endif // STREAM_UPLOAD_H
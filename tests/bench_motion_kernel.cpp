@@ -0,0 +1,92 @@
+// Time per frame of the change detection kernel, dispatched (RVV when built
+// for it) against the scalar loop, at the sizes the app compares. Built with
+// OpenCV, absdiff + threshold + countNonZero as the opencv backend runs them
+// is timed too, it always looks at every pixel.
+//
+//   bench_motion_kernel [iterations]
+
+#include "motion_kernel.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if HAVE_OPENCV
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
+
+namespace {
+
+typedef int (*CountFunc)(const uint8_t* a, int strideA, const uint8_t* b, int strideB,
+                         int width, int height, int threshold, int step,
+                         int tilesX, int tilesY, int* tileCounts);
+
+double usPerCall(CountFunc count, const std::vector<uint8_t>& a, const std::vector<uint8_t>& b,
+                 int width, int height, int step, int iterations, int& sink) {
+    int tiles[12];
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        sink += count(a.data(), width, b.data(), width, width, height, 30, step, 4, 3, tiles);
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    return (double)us / iterations;
+}
+
+#if HAVE_OPENCV
+double usPerCallOpenCV(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, int width, int height,
+                       int iterations, int& sink) {
+    const cv::Mat planeA(height, width, CV_8UC1, const_cast<uint8_t*>(a.data()));
+    const cv::Mat planeB(height, width, CV_8UC1, const_cast<uint8_t*>(b.data()));
+    cv::Mat diff, thresh;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        cv::absdiff(planeA, planeB, diff);
+        cv::threshold(diff, thresh, 30, 255, cv::THRESH_BINARY);
+        sink += cv::countNonZero(thresh);
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    return (double)us / iterations;
+}
+#endif
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const int iterations = argc > 1 ? std::atoi(argv[1]) : 200;
+#if __riscv_vector
+    const char* dispatched = "rvv";
+#else
+    const char* dispatched = "scalar";
+#endif
+    const int sizes[][2] = { { 160, 90 }, { 320, 180 }, { 640, 360 } };
+    int sink = 0;
+    std::printf("%-10s %4s %12s %12s %8s", "size", "step", dispatched, "scalar", "speedup");
+#if HAVE_OPENCV
+    std::printf(" %12s %8s", "opencv", "speedup");
+#endif
+    std::printf("\n");
+    for (const auto& size : sizes) {
+        std::vector<uint8_t> a((size_t)size[0] * size[1]);
+        std::vector<uint8_t> b(a.size());
+        for (size_t i = 0; i < a.size(); i++) {
+            a[i] = (uint8_t)std::rand();
+            b[i] = (uint8_t)(a[i] + std::rand() % 61 - 30);
+        }
+        for (int step = 1; step <= 2; step++) {
+            double fast = usPerCall(countChangedPixels, a, b, size[0], size[1], step, iterations, sink);
+            double scalar = usPerCall(countChangedPixelsScalar, a, b, size[0], size[1], step, iterations, sink);
+            char name[16];
+            std::snprintf(name, sizeof(name), "%dx%d", size[0], size[1]);
+            std::printf("%-10s %4d %9.1f us %9.1f us %7.2fx", name, step, fast, scalar, fast > 0 ? scalar / fast : 0.0);
+#if HAVE_OPENCV
+            double opencv = usPerCallOpenCV(a, b, size[0], size[1], iterations, sink);
+            std::printf(" %9.1f us %7.2fx", opencv, fast > 0 ? opencv / fast : 0.0);
+#endif
+            std::printf("\n");
+        }
+    }
+    // keeps the calls from being optimized away
+    return sink == 42 ? 1 : 0;
+}
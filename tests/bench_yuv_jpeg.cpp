@@ -0,0 +1,105 @@
+// Time per frame of the CPU JPEG encoder, dispatched (RVV transform when
+// built for it) against the scalar one, on an NV21 page at the sizes the
+// upload ladder produces from the full-res stream. With OpenCV on the host
+// also the path the app took before: cvtColor to BGR (or gray), resize and
+// imencode.
+//
+//   bench_yuv_jpeg [iterations]
+
+#include "page_fixture.h"
+#include "yuv_jpeg.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if HAVE_OPENCV
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
+
+namespace {
+
+typedef bool (*EncodeFunc)(const Yuv420Image& image, const YuvJpegParams& params, std::vector<uint8_t>& jpeg);
+
+double msPerCall(EncodeFunc encode, const Yuv420Image& image, const YuvJpegParams& params, int iterations,
+                 size_t& bytes) {
+    std::vector<uint8_t> jpeg;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        encode(image, params, jpeg);
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    bytes = jpeg.size();
+    return us / 1000.0 / iterations;
+}
+
+#if HAVE_OPENCV
+double msPerCallOpenCV(const Yuv420Image& image, const YuvJpegParams& params, int iterations, size_t& bytes) {
+    // cvtColor wants NV21 as one Mat of 3/2 height, the padded planes are copied together once
+    cv::Mat nv21(image.height * 3 / 2, image.width, CV_8UC1);
+    for (int r = 0; r < image.height; r++)
+        std::copy(image.y + (size_t)r * image.strideY, image.y + (size_t)r * image.strideY + image.width, nv21.ptr(r));
+    for (int r = 0; r < image.height / 2; r++)
+        std::copy(image.v + (size_t)r * image.strideUV, image.v + (size_t)r * image.strideUV + image.width,
+                  nv21.ptr(image.height + r));
+    const std::vector<int> flags = { cv::IMWRITE_JPEG_QUALITY, params.quality };
+    cv::Mat converted, scaled;
+    std::vector<uchar> jpeg;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        cv::cvtColor(nv21, converted, params.gray ? cv::COLOR_YUV2GRAY_NV21 : cv::COLOR_YUV2BGR_NV21);
+        if (params.downscale > 1)
+            cv::resize(converted, scaled, cv::Size(image.width / params.downscale, image.height / params.downscale), 0,
+                       0, cv::INTER_AREA);
+        cv::imencode(".jpg", params.downscale > 1 ? scaled : converted, jpeg, flags);
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    bytes = jpeg.size();
+    return us / 1000.0 / iterations;
+}
+#endif
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const int iterations = argc > 1 ? std::atoi(argv[1]) : 5;
+#if __riscv_vector
+    const char* dispatched = "rvv";
+#else
+    const char* dispatched = "scalar";
+#endif
+    const int width = 2560;
+    const int height = 1440;
+    const PageFrame page(width, height, 1);
+    const Yuv420Image image = page.image(NV21);
+
+    const int steps[][3] = { { 95, 1, 0 }, { 75, 1, 0 }, { 85, 2, 0 }, { 75, 2, 1 }, { 60, 4, 1 } };
+    std::printf("%-14s %12s %12s %8s %10s", "step", dispatched, "scalar", "speedup", "size");
+#if HAVE_OPENCV
+    std::printf(" %12s %8s %10s", "opencv", "speedup", "size");
+#endif
+    std::printf("\n");
+    for (const auto& step : steps) {
+        YuvJpegParams params;
+        params.quality = step[0];
+        params.downscale = step[1];
+        params.gray = step[2] != 0;
+        size_t bytes = 0;
+        double fast = msPerCall(encodeYuv420Jpeg, image, params, iterations, bytes);
+        double scalar = msPerCall(encodeYuv420JpegScalar, image, params, iterations, bytes);
+        char name[32];
+        std::snprintf(name, sizeof(name), "q%d 1/%d%s", step[0], step[1], step[2] ? " gray" : "");
+        std::printf("%-14s %9.1f ms %9.1f ms %7.2fx %7zu kB", name, fast, scalar, fast > 0 ? scalar / fast : 0.0,
+                    bytes / 1000);
+#if HAVE_OPENCV
+        double opencv = msPerCallOpenCV(image, params, iterations, bytes);
+        std::printf(" %9.1f ms %7.2fx %7zu kB", opencv, fast > 0 ? opencv / fast : 0.0, bytes / 1000);
+#endif
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <cstdio>
+
+// Just enough for the host tests: a failed check prints where it was and
+// the test keeps going, main() returns checkResult() at the end.
+static int checkFailures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            checkFailures++;                                                         \
+        }                                                                            \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                               \
+    do {                                                                             \
+        long long checkA = (long long)(a);                                           \
+        long long checkB = (long long)(b);                                           \
+        if (checkA != checkB) {                                                      \
+            std::fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n",   \
+                         __FILE__, __LINE__, #a, #b, checkA, checkB);                \
+            checkFailures++;                                                         \
+        }                                                                            \
+    } while (0)
+
+static inline int checkResult() {
+    if (checkFailures)
+        std::fprintf(stderr, "%d checks failed\n", checkFailures);
+    return checkFailures ? 1 : 0;
+}
+
+#endif // TESTS_CHECK_H
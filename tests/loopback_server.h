@@ -0,0 +1,205 @@
+#ifndef TESTS_LOOPBACK_SERVER_H
+#define TESTS_LOOPBACK_SERVER_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Just enough HTTP/1.1 for the host tests: listens on 127.0.0.1, keeps
+// connections open between requests unless told to close them, takes bodies
+// with Content-Length or chunked transfer encoding and answers every request
+// with 200 and the same body. Records what it received.
+class LoopbackServer {
+public:
+    struct Request {
+        std::string method;
+        std::string path;
+        std::string body;
+        bool chunked = false;
+        int chunks = 0;             // chunks of a chunked body, the last empty one not counted
+        int connection = 0;         // 1 for the first connection accepted, and so on
+    };
+
+    std::string responseBody = "ok";
+    int responseDelayMs = 0;        // wait this long after the body before answering
+    bool closeAfterResponse = false;
+
+    LoopbackServer() {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0
+            || getsockname(listener, (sockaddr*)&addr, &length) != 0) {
+            std::perror("loopback server");
+            std::exit(1);
+        }
+        port = ntohs(addr.sin_port);
+        acceptor = std::thread(&LoopbackServer::acceptLoop, this);
+    }
+
+    ~LoopbackServer() {
+        stopping = true;
+        shutdown(listener, SHUT_RDWR);
+        acceptor.join();
+        close(listener);
+        std::vector<std::thread> running;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int fd : sockets)
+                shutdown(fd, SHUT_RDWR);
+            running.swap(workers);
+        }
+        for (std::thread& worker : running)
+            worker.join();
+    }
+
+    std::string url(const std::string& path = "/") const {
+        return "http://127.0.0.1:" + std::to_string(port) + path;
+    }
+
+    int connections() const { return accepted; }
+
+    std::vector<Request> requests() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return received;
+    }
+
+private:
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    void acceptLoop() {
+        while (!stopping) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0)
+                break;
+            // a client that stops sending does not hang the test
+            timeval timeout = { 5, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            std::lock_guard<std::mutex> lock(mutex);
+            sockets.push_back(fd);
+            workers.push_back(std::thread(&LoopbackServer::serve, this, fd, ++accepted));
+        }
+    }
+
+    // bytes from the connection, buffered in pending
+    bool fill(int fd, std::string& pending) {
+        char buffer[16384];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return false;
+        pending.append(buffer, (size_t)n);
+        return true;
+    }
+
+    bool readLine(int fd, std::string& pending, std::string& line) {
+        size_t end;
+        while ((end = pending.find("\r\n")) == std::string::npos) {
+            if (!fill(fd, pending))
+                return false;
+        }
+        line = pending.substr(0, end);
+        pending.erase(0, end + 2);
+        return true;
+    }
+
+    bool readBytes(int fd, std::string& pending, size_t size, std::string& out) {
+        while (pending.size() < size) {
+            if (!fill(fd, pending))
+                return false;
+        }
+        out.append(pending, 0, size);
+        pending.erase(0, size);
+        return true;
+    }
+
+    bool readRequest(int fd, std::string& pending, Request& request) {
+        std::string line;
+        if (!readLine(fd, pending, line))
+            return false;
+        size_t space = line.find(' ');
+        request.method = line.substr(0, space);
+        request.path = line.substr(space + 1, line.find(' ', space + 1) - space - 1);
+        size_t contentLength = 0;
+        while (readLine(fd, pending, line) && !line.empty()) {
+            std::string name = line.substr(0, line.find(':'));
+            for (char& c : name)
+                c = (char)std::tolower((unsigned char)c);
+            std::string value = line.substr(line.find(':') + 1);
+            if (name == "content-length")
+                contentLength = (size_t)std::strtoull(value.c_str(), nullptr, 10);
+            if (name == "transfer-encoding" && value.find("chunked") != std::string::npos)
+                request.chunked = true;
+        }
+        if (!request.chunked)
+            return readBytes(fd, pending, contentLength, request.body);
+        while (readLine(fd, pending, line)) {
+            size_t size = (size_t)std::strtoull(line.c_str(), nullptr, 16);
+            if (size == 0)
+                return readLine(fd, pending, line);
+            std::string crlf;
+            if (!readBytes(fd, pending, size, request.body) || !readBytes(fd, pending, 2, crlf))
+                return false;
+            request.chunks++;
+        }
+        return false;
+    }
+
+    void serve(int fd, int connection) {
+        std::string pending;
+        while (!stopping) {
+            Request request;
+            request.connection = connection;
+            if (!readRequest(fd, pending, request))
+                break;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                received.push_back(request);
+            }
+            if (responseDelayMs > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(responseDelayMs));
+            std::string response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(responseBody.size())
+                                   + (closeAfterResponse ? "\r\nConnection: close" : "") + "\r\n\r\n" + responseBody;
+            if (send(fd, response.data(), response.size(), MSG_NOSIGNAL) != (ssize_t)response.size()
+                || closeAfterResponse)
+                break;
+        }
+        shutdown(fd, SHUT_RDWR);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < sockets.size(); i++) {
+            if (sockets[i] == fd) {
+                sockets.erase(sockets.begin() + i);
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    int listener = -1;
+    int port = 0;
+    std::atomic<bool> stopping{ false };
+    std::atomic<int> accepted{ 0 };
+    std::thread acceptor;
+    mutable std::mutex mutex;
+    std::vector<int> sockets;
+    std::vector<std::thread> workers;
+    std::vector<Request> received;
+};
+
+#endif // TESTS_LOOPBACK_SERVER_H
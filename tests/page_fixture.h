@@ -0,0 +1,66 @@
+#ifndef TESTS_PAGE_FIXTURE_H
+#define TESTS_PAGE_FIXTURE_H
+
+#include "yuv_jpeg.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// The frame the JPEG tests and benchmarks encode: a page with paper, lines
+// of print and a coloured highlight, with some noise. The planes are padded
+// past the width like the VPSS strides are.
+
+enum Layout { NV21, NV12, I420 };
+
+struct PageFrame {
+    int width;
+    int height;
+    int strideY;
+    int strideUV;
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> uv;
+
+    PageFrame(int width, int height, unsigned seed)
+        : width(width), height(height), strideY(width + 5), strideUV((width + 1) / 2 * 2 + 6),
+          y((size_t)strideY * height), uv((size_t)strideUV * ((height + 1) / 2)) {
+        std::srand(seed);
+        for (int r = 0; r < height; r++) {
+            for (int c = 0; c < width; c++) {
+                const bool ink = (r / 6) % 3 == 0 && (c / 4) % 5 != 4;
+                y[(size_t)r * strideY + c] = (uint8_t)((ink ? 40 : 210) + std::rand() % 16);
+            }
+        }
+        for (size_t i = 0; i < uv.size(); i++)
+            uv[i] = (uint8_t)(128 + std::rand() % 9 - 4);
+        for (int r = height / 4; r < height / 3; r++) {
+            for (int c = 0; c < (width + 1) / 2; c++) {
+                uv[(size_t)(r / 2) * strideUV + 2 * c] = 90;
+                uv[(size_t)(r / 2) * strideUV + 2 * c + 1] = 170;
+            }
+        }
+    }
+
+    // the chroma bytes read as interleaved or as two half-width planes
+    Yuv420Image image(Layout layout = NV21) const {
+        Yuv420Image image;
+        image.y = y.data();
+        image.strideY = strideY;
+        image.width = width;
+        image.height = height;
+        if (layout == I420) {
+            image.u = uv.data();
+            image.v = uv.data() + strideUV / 2;
+            image.strideUV = strideUV;
+            image.chromaStep = 1;
+        } else {
+            image.v = layout == NV21 ? uv.data() : uv.data() + 1;
+            image.u = layout == NV21 ? uv.data() + 1 : uv.data();
+            image.strideUV = strideUV;
+            image.chromaStep = 2;
+        }
+        return image;
+    }
+};
+
+#endif // TESTS_PAGE_FIXTURE_H
@@ -0,0 +1,20 @@
+# Cross build of the tests for the SG2002's C906 with the SDK's musl toolchain,
+# ctest runs them under QEMU so the RVV paths are checked against the scalar ones:
+#
+#   COMPILER=<toolchain bin dir> cmake -S . -B build-qemu -DJOTTER_TESTS=ON \
+#       -DCMAKE_TOOLCHAIN_FILE=tests/riscv-qemu.cmake
+#
+# The C906 implements RVV 0.7.1, which needs a QEMU that knows the T-Head cores,
+# e.g. the Xuantie build with -cpu c906fdv. JOTTER_QEMU overrides the command.
+
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR riscv64)
+
+set(CMAKE_C_COMPILER "$ENV{COMPILER}/riscv64-unknown-linux-musl-gcc")
+set(CMAKE_CXX_COMPILER "$ENV{COMPILER}/riscv64-unknown-linux-musl-g++")
+set(CMAKE_CXX_FLAGS_INIT "-march=rv64imafd -O2")
+# no sysroot to hand to QEMU
+set(CMAKE_EXE_LINKER_FLAGS_INIT "-static")
+
+set(JOTTER_QEMU "qemu-riscv64;-cpu;c906fdv" CACHE STRING "Command that runs a riscv64 test binary")
+set(CMAKE_CROSSCOMPILING_EMULATOR ${JOTTER_QEMU})
@@ -0,0 +1,263 @@
+// The change detector backends through change_detector_core.h, the part of
+// them that does not need opencv-mobile FrameRefs or the TDL SDK:
+// - the config checks createChangeDetector() runs before picking a backend;
+// - PlaneChangeCounter, what the fused and scalar backends do with the Y
+//   plane of a frame, against a plain per-pixel count;
+// - countBoxPixels(), how the hardware backend turns the regions IVE reports
+//   into tile counts.
+// The kernel itself is checked by test_motion_kernel.
+
+#include "change_detector_core.h"
+#include "check.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+bool throws(ChangeDetectorBackend backend, const ChangeDetectorConfig& config, bool hasTdlHandle) {
+    try {
+        checkChangeDetectorConfig(backend, config, hasTdlHandle);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void checkBackendNames() {
+    CHECK(parseChangeDetectorBackend("opencv") == ChangeDetectorBackend::OpenCV);
+    CHECK(parseChangeDetectorBackend("hardware") == ChangeDetectorBackend::Hardware);
+    CHECK(parseChangeDetectorBackend("fused") == ChangeDetectorBackend::Fused);
+    CHECK(parseChangeDetectorBackend("scalar") == ChangeDetectorBackend::Scalar);
+    bool unknown = false;
+    try {
+        parseChangeDetectorBackend("Fused");
+    } catch (const std::runtime_error&) {
+        unknown = true;
+    }
+    CHECK(unknown);
+}
+
+void checkConfigValidation() {
+    const ChangeDetectorBackend backends[] = { ChangeDetectorBackend::OpenCV, ChangeDetectorBackend::Hardware,
+                                               ChangeDetectorBackend::Fused, ChangeDetectorBackend::Scalar };
+    for (ChangeDetectorBackend backend : backends) {
+        ChangeDetectorConfig config;
+        config.tilesX = 4;
+        config.tilesY = 3;
+        CHECK(!throws(backend, config, true));
+        ChangeDetectorConfig bad = config;
+        bad.tilesX = 0;
+        CHECK(throws(backend, bad, true));
+        bad = config;
+        bad.tilesY = -1;
+        CHECK(throws(backend, bad, true));
+        bad = config;
+        bad.step = 0;
+        CHECK(throws(backend, bad, true));
+        bad = config;
+        bad.pixelThreshold = 256;
+        CHECK(throws(backend, bad, true));
+        bad = config;
+        bad.pixelThreshold = -1;
+        CHECK(throws(backend, bad, true));
+        bad = config;
+        bad.minArea = -1;
+        CHECK(throws(backend, bad, true));
+        // only the hardware backend needs the handle
+        CHECK(throws(backend, config, false) == (backend == ChangeDetectorBackend::Hardware));
+    }
+}
+
+struct Plane {
+    int width;
+    int height;
+    int stride;
+    std::vector<uint8_t> data;
+
+    Plane(int width, int height, int stride) : width(width), height(height), stride(stride), data((size_t)stride * height) {}
+
+    uint8_t& at(int x, int y) { return data[(size_t)y * stride + x]; }
+};
+
+// what the backend promises, one pixel at a time
+int referenceCount(Plane& a, Plane& b, int threshold, int step, int tilesX, int tilesY, std::vector<int>& tiles) {
+    tiles.assign((size_t)tilesX * tilesY, 0);
+    int total = 0;
+    for (int y = 0; y < a.height; y += step) {
+        const int ty = y * tilesY / a.height;
+        for (int tx = 0; tx < tilesX; tx++) {
+            for (int x = tx * a.width / tilesX; x < (tx + 1) * a.width / tilesX; x++) {
+                if (x % step != 0)
+                    continue;
+                const int d = std::abs((int)a.at(x, y) - (int)b.at(x, y));
+                if (d > threshold) {
+                    tiles[(size_t)ty * tilesX + tx]++;
+                    total++;
+                }
+            }
+        }
+    }
+    return total;
+}
+
+// a page with some ink, the next frame shifted by noise and one moved block
+void makeFrames(Plane& a, Plane& b, unsigned seed) {
+    std::srand(seed);
+    for (int y = 0; y < a.height; y++) {
+        for (int x = 0; x < a.stride; x++) {
+            uint8_t v = (uint8_t)(200 - ((x / 7 + y / 5) % 3 == 0 ? 150 : 0));
+            a.at(x, y) = v;
+            int noisy = v + std::rand() % 21 - 10;
+            b.at(x, y) = (uint8_t)(noisy < 0 ? 0 : noisy > 255 ? 255 : noisy);
+        }
+    }
+    for (int y = a.height / 3; y < a.height / 2; y++) {
+        for (int x = a.width / 4; x < a.width / 2; x++)
+            b.at(x, y) = (uint8_t)(255 - a.at(x, y));
+    }
+}
+
+// the reference is copied out of a padded plane, the next one compared per tile
+void checkPlaneCounter(int width, int height, int padding) {
+    Plane a(width, height, width + padding);
+    Plane b(width, height, width + padding);
+    makeFrames(a, b, (unsigned)(width * 31 + height));
+    const int thresholds[] = { 0, 10, 30, 255 };
+    const int steps[] = { 1, 3 };
+    const int grids[][2] = { { 1, 1 }, { 4, 3 }, { 7, 2 } };
+    for (int threshold : thresholds) {
+        for (int step : steps) {
+            for (const auto& grid : grids) {
+                ChangeDetectorConfig config;
+                config.pixelThreshold = threshold;
+                config.step = step;
+                config.tilesX = grid[0];
+                config.tilesY = grid[1];
+                std::vector<int> expected;
+                const int expectedTotal = referenceCount(a, b, threshold, step, grid[0], grid[1], expected);
+                for (bool scalar : { true, false }) {
+                    PlaneChangeCounter counter(config, scalar);
+                    CHECK(!counter.hasReference());
+                    CHECK_EQ(counter.compare(b.data.data(), b.stride, width, height), -1);
+                    Plane reference = a;
+                    counter.setReference(reference.data.data(), reference.stride, width, height);
+                    CHECK(counter.hasReference());
+                    // the counter kept a copy, the frame it came from may be gone
+                    std::fill(reference.data.begin(), reference.data.end(), 0);
+                    CHECK_EQ(counter.compare(b.data.data(), b.stride, width, height), expectedTotal);
+                    CHECK(counter.tileCounts() == expected);
+                    CHECK_EQ(std::accumulate(counter.tileCounts().begin(), counter.tileCounts().end(), 0),
+                             expectedTotal);
+                }
+            }
+        }
+    }
+}
+
+void checkPlaneCounterReference() {
+    ChangeDetectorConfig config;
+    config.tilesX = 4;
+    config.tilesY = 4;
+    Plane a(160, 90, 160);
+    Plane b(160, 90, 160);
+    makeFrames(a, b, 1);
+    PlaneChangeCounter counter(config, false);
+    counter.setReference(a.data.data(), a.stride, a.width, a.height);
+    CHECK_EQ(counter.compare(a.data.data(), a.stride, a.width, a.height), 0);
+    CHECK(counter.tileCounts() == std::vector<int>(16, 0));
+    // another size than the reference is a failure, not a count
+    CHECK_EQ(counter.compare(b.data.data(), b.stride, 80, 90), -1);
+    counter.setReference(nullptr, 0, 0, 0);
+    CHECK(!counter.hasReference());
+    CHECK_EQ(counter.compare(a.data.data(), a.stride, a.width, a.height), -1);
+}
+
+// the tile counts of boxes, one pixel at a time
+int referenceBoxCount(const std::vector<ChangeBox>& boxes, int width, int height, int tilesX, int tilesY,
+                      std::vector<int>& tiles) {
+    tiles.assign((size_t)tilesX * tilesY, 0);
+    int total = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            bool covered = false;
+            for (const ChangeBox& box : boxes) {
+                if (x + 1 > box.x1 && x < box.x2 && y + 1 > box.y1 && y < box.y2)
+                    covered = true;
+            }
+            if (!covered)
+                continue;
+            int tx = 0;
+            while ((tx + 1) * width / tilesX <= x)
+                tx++;
+            tiles[(size_t)(y * tilesY / height) * tilesX + tx]++;
+            total++;
+        }
+    }
+    return total;
+}
+
+void checkBoxes(const std::vector<ChangeBox>& boxes, int width, int height, int tilesX, int tilesY) {
+    std::vector<int> expected;
+    const int expectedTotal = referenceBoxCount(boxes, width, height, tilesX, tilesY, expected);
+    std::vector<int> tiles((size_t)tilesX * tilesY, -1);
+    CHECK_EQ(countBoxPixels(boxes, width, height, tilesX, tilesY, tiles.data()), expectedTotal);
+    CHECK(tiles == expected);
+    CHECK_EQ(countBoxPixels(boxes, width, height, tilesX, tilesY, nullptr), expectedTotal);
+}
+
+void checkBoxPixels() {
+    const int width = 160;
+    const int height = 90;
+    std::vector<int> tiles(12, -1);
+
+    // a hand in the top left corner only shows in that tile
+    std::vector<ChangeBox> hand = { { 0, 0, 30, 20 } };
+    CHECK_EQ(countBoxPixels(hand, width, height, 4, 3, tiles.data()), 600);
+    CHECK_EQ(tiles[0], 600);
+    CHECK_EQ(std::accumulate(tiles.begin() + 1, tiles.end(), 0), 0);
+
+    // two boxes over the same region count it once
+    std::vector<ChangeBox> overlapping = { { 10, 10, 50, 40 }, { 30, 20, 70, 60 } };
+    CHECK_EQ(countBoxPixels(overlapping, width, height, 1, 1, nullptr), 40 * 30 + 40 * 40 - 20 * 20);
+
+    // boxes past the edges are clipped, the whole frame is the most there is
+    std::vector<ChangeBox> outside = { { -20, -10, 200, 120 }, { 0, 0, 160, 90 }, { 150, 80, 400, 400 } };
+    CHECK_EQ(countBoxPixels(outside, width, height, 4, 3, tiles.data()), width * height);
+    CHECK_EQ(std::accumulate(tiles.begin(), tiles.end(), 0), width * height);
+    std::vector<ChangeBox> gone = { { 200, 10, 260, 50 }, { 10, -40, 50, -5 }, { 40, 40, 40, 60 } };
+    CHECK_EQ(countBoxPixels(gone, width, height, 4, 3, tiles.data()), 0);
+    CHECK(tiles == std::vector<int>(12, 0));
+
+    // against the per-pixel count: boxes across tile borders, nested, touching and fractional
+    checkBoxes(overlapping, width, height, 4, 3);
+    checkBoxes({ { 35, 25, 125, 65 } }, width, height, 4, 3);
+    checkBoxes({ { 20, 20, 100, 80 }, { 40, 30, 60, 50 }, { 100, 20, 140, 80 } }, width, height, 4, 3);
+    checkBoxes({ { 10.5f, 3.2f, 47.7f, 33.9f }, { 47.1f, 30.f, 90.4f, 88.6f } }, width, height, 5, 5);
+    checkBoxes({ { 0, 0, 5, 4 } }, 5, 4, 7, 2);
+    std::srand(7);
+    std::vector<ChangeBox> random;
+    for (int i = 0; i < 12; i++) {
+        const float x = (float)(std::rand() % 180 - 10);
+        const float y = (float)(std::rand() % 100 - 5);
+        random.push_back({ x, y, x + std::rand() % 60, y + std::rand() % 40 });
+    }
+    checkBoxes(random, width, height, 4, 3);
+}
+
+} // namespace
+
+int main() {
+    checkBackendNames();
+    checkConfigValidation();
+    // the motion stream size, an odd one and one narrower than the tile grid
+    checkPlaneCounter(160, 90, 0);
+    checkPlaneCounter(97, 53, 11);
+    checkPlaneCounter(5, 4, 3);
+    checkPlaneCounterReference();
+    checkBoxPixels();
+    return checkResult();
+}
@@ -0,0 +1,115 @@
+// HttpClient against a server on the loopback interface: connections are
+// kept and reused between requests, HttpResult::reused says so, and the
+// phase timings come out in order.
+
+#include "check.h"
+#include "http_client.h"
+#include "loopback_server.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+// every phase ends after the one before, the request took some time. libcurl
+// reports no connect time on a reused connection, though it counts the lookup
+void checkTimings(const HttpResult& result) {
+    const HttpTimings& t = result.timings;
+    CHECK(t.dnsMs >= 0);
+    CHECK(result.reused || t.connectMs >= t.dnsMs);
+    CHECK_EQ(t.tlsMs, 0);
+    CHECK(t.firstByteMs >= t.connectMs);
+    CHECK(t.totalMs >= t.firstByteMs);
+    CHECK(t.totalMs > 0);
+}
+
+void checkReuse() {
+    LoopbackServer server;
+    HttpClient client{ HttpClientConfig() };
+    HttpResult first = client.get(server.url("/first"));
+    CHECK(first.ok);
+    CHECK_EQ(first.statusCode, 200);
+    CHECK(first.body == "ok");
+    CHECK(!first.reused);
+    checkTimings(first);
+
+    HttpResult second = client.get(server.url("/second"));
+    CHECK(second.ok);
+    CHECK(second.reused);
+    checkTimings(second);
+    // no handshake on a kept connection
+    CHECK(second.timings.connectMs < 1);
+    CHECK_EQ(server.connections(), 1);
+
+    const std::string body(100000, 'x');
+    HttpResult posted = client.post(server.url("/post"), body.data(), body.size(), { "Content-Type: text/plain" });
+    CHECK(posted.ok);
+    CHECK(posted.reused);
+    checkTimings(posted);
+    CHECK_EQ(server.connections(), 1);
+    std::vector<LoopbackServer::Request> requests = server.requests();
+    CHECK_EQ(requests.size(), 3);
+    if (requests.size() == 3) {
+        CHECK(requests[0].method == "GET" && requests[0].path == "/first");
+        CHECK(requests[2].method == "POST" && requests[2].body == body && !requests[2].chunked);
+    }
+}
+
+// a server that closes after each response makes every request connect again
+void checkClosedConnection() {
+    LoopbackServer server;
+    server.closeAfterResponse = true;
+    HttpClient client{ HttpClientConfig() };
+    for (int i = 0; i < 3; i++) {
+        HttpResult result = client.get(server.url());
+        CHECK(result.ok);
+        CHECK(!result.reused);
+        checkTimings(result);
+    }
+    CHECK_EQ(server.connections(), 3);
+}
+
+// the time the server takes to answer shows up before the first byte
+void checkSlowResponse() {
+    LoopbackServer server;
+    HttpClient client{ HttpClientConfig() };
+    HttpResult warm = client.get(server.url());
+    CHECK(warm.ok);
+    server.responseDelayMs = 100;
+    HttpResult slow = client.get(server.url());
+    CHECK(slow.ok);
+    CHECK(slow.reused);
+    checkTimings(slow);
+    CHECK(slow.timings.firstByteMs >= 90);
+    CHECK(slow.timings.connectMs < 90);
+}
+
+// nobody listening: not ok, an error message, nothing reused
+void checkRefused() {
+    std::string url;
+    {
+        LoopbackServer server;
+        url = server.url();
+    }
+    HttpClient client{ HttpClientConfig() };
+    HttpResult result = client.get(url);
+    CHECK(!result.ok);
+    CHECK(!result.error.empty());
+    CHECK(!result.reused);
+}
+
+} // namespace
+
+int main() {
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+        std::fprintf(stderr, "curl_global_init() failed\n");
+        return 1;
+    }
+    checkReuse();
+    checkClosedConnection();
+    checkSlowResponse();
+    checkRefused();
+    curl_global_cleanup();
+    return checkResult();
+}
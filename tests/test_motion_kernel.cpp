@@ -0,0 +1,85 @@
+// countChangedPixels() must count exactly what countChangedPixelsScalar()
+// does. On the host both are the scalar loop; built with
+// tests/riscv-qemu.cmake the first one is the RVV kernel and runs under QEMU.
+
+#include "check.h"
+#include "motion_kernel.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+void fill(std::vector<uint8_t>& plane, unsigned seed) {
+    std::srand(seed);
+    for (uint8_t& v : plane)
+        v = (uint8_t)(std::rand() & 0xff);
+}
+
+// b close to a, so every threshold splits the pixels somewhere
+void perturb(const std::vector<uint8_t>& a, std::vector<uint8_t>& b, int spread) {
+    for (size_t i = 0; i < a.size(); i++) {
+        int v = a[i] + std::rand() % (2 * spread + 1) - spread;
+        b[i] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+}
+
+void compare(const uint8_t* a, int strideA, const uint8_t* b, int strideB, int width, int height,
+             int threshold, int step, int tilesX, int tilesY) {
+    std::vector<int> tiles((size_t)tilesX * tilesY, -1);
+    std::vector<int> tilesScalar((size_t)tilesX * tilesY, -2);
+    int total = countChangedPixels(a, strideA, b, strideB, width, height, threshold, step, tilesX, tilesY, tiles.data());
+    int totalScalar = countChangedPixelsScalar(a, strideA, b, strideB, width, height, threshold, step,
+                                               tilesX, tilesY, tilesScalar.data());
+    CHECK_EQ(total, totalScalar);
+    CHECK(tiles == tilesScalar);
+    if (total != totalScalar || tiles != tilesScalar)
+        std::fprintf(stderr, "  %dx%d threshold %d step %d tiles %dx%d\n", width, height, threshold, step, tilesX, tilesY);
+}
+
+} // namespace
+
+int main() {
+#if defined(__riscv) && !defined(__riscv_vector)
+    std::fprintf(stderr, "built for riscv without the vector extension, the RVV kernel is not tested\n");
+    return 1;
+#endif
+#if __riscv_vector
+    std::printf("countChangedPixels: rvv\n");
+#else
+    std::printf("countChangedPixels: scalar\n");
+#endif
+    // widths around the vector lengths of e8m8, odd strides and an unaligned start
+    const int widths[] = { 1, 7, 31, 64, 65, 127, 128, 129, 160, 255, 257, 640 };
+    const int thresholds[] = { 0, 1, 17, 30, 128, 254, 255 };
+    for (int width : widths) {
+        const int height = 9;
+        const int stride = width + 3;
+        std::vector<uint8_t> a((size_t)stride * height + 1);
+        std::vector<uint8_t> b(a.size());
+        fill(a, (unsigned)width);
+        perturb(a, b, 40);
+        for (int threshold : thresholds) {
+            for (int step = 1; step <= 5; step++) {
+                compare(a.data() + 1, stride, b.data() + 1, stride, width, height, threshold, step, 1, 1);
+                compare(a.data() + 1, stride, b.data() + 1, stride, width, height, threshold, step, 4, 3);
+            }
+        }
+    }
+
+    // the motion stream as main.cpp sets it up
+    std::vector<uint8_t> a(160 * 90);
+    std::vector<uint8_t> b(a.size());
+    fill(a, 90);
+    perturb(a, b, 60);
+    for (int step = 1; step <= 2; step++)
+        compare(a.data(), 160, b.data(), 160, 160, 90, 30, step, 4, 3);
+    // extremes: all equal, all as far apart as it gets
+    compare(a.data(), 160, a.data(), 160, 160, 90, 0, 1, 4, 3);
+    std::vector<uint8_t> black(a.size(), 0);
+    std::vector<uint8_t> white(a.size(), 255);
+    compare(black.data(), 160, white.data(), 160, 160, 90, 254, 1, 4, 3);
+    return checkResult();
+}
@@ -0,0 +1,161 @@
+// Time to trigger of StabilityEstimator against the fixed counter it replaced,
+// replayed over per-tile motion traces of the 160x90 motion stream split into
+// the 4x3 tiles main.cpp uses.
+//
+// The old loop counted frames whose changed pixels stayed under 10% of the
+// frame and fired on the 10th; one frame above restarted the count.
+
+#include "check.h"
+#include "stability_estimator.h"
+
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const int TILES = 12;
+const int TILE_PIXELS = 40 * 30;
+const int OLD_FRAME_LIMIT = 10;
+const double OLD_CHANGE_THRESHOLD = 0.10;
+
+// changed fraction per tile, one entry per frame
+typedef std::vector<std::vector<double>> Trace;
+
+// frames of the same motion, noise adds a fixed pattern so tiles differ a little
+void append(Trace& trace, int frames, double level, double noise, int busyTile = -1, double busyLevel = 0) {
+    for (int f = 0; f < frames; f++) {
+        std::vector<double> tiles(TILES);
+        for (int t = 0; t < TILES; t++)
+            tiles[t] = level + noise * ((t * 7 + f * 3) % 5) / 4.0;
+        if (busyTile >= 0)
+            tiles[busyTile] = busyLevel;
+        trace.push_back(tiles);
+    }
+}
+
+// first frame from start the estimator settled on, -1 when it never did; settles
+// before start are counted in early
+int estimatorTrigger(const Trace& trace, int start, int* early = nullptr) {
+    StabilityEstimator estimator{ StabilityConfig() };
+    int settled = -1;
+    for (int f = 0; f < (int)trace.size(); f++) {
+        std::vector<int> counts(TILES);
+        for (int t = 0; t < TILES; t++)
+            counts[t] = (int)(trace[f][t] * TILE_PIXELS + 0.5);
+        StabilityEstimator::Event event = estimator.update(counts, TILE_PIXELS);
+        if (event == StabilityEstimator::Settled && settled < 0 && f >= start)
+            settled = f;
+        if (event == StabilityEstimator::Settled && f < start && early)
+            (*early)++;
+    }
+    return settled;
+}
+
+// the same for the old counter, which only saw the frame total
+int oldTrigger(const Trace& trace, int start, int* early = nullptr) {
+    int stillCount = 0;
+    int fired = -1;
+    for (int f = 0; f < (int)trace.size(); f++) {
+        double total = 0;
+        for (double tile : trace[f])
+            total += tile;
+        total /= TILES;
+        stillCount = total < OLD_CHANGE_THRESHOLD ? stillCount + 1 : 0;
+        if (stillCount == OLD_FRAME_LIMIT) {
+            if (f < start && early)
+                (*early)++;
+            if (f >= start && fired < 0)
+                fired = f;
+        }
+    }
+    return fired;
+}
+
+void report(const char* name, int start, int estimator, int old) {
+    std::printf("%-16s estimator %3d frames, old counter %3d frames after the motion stopped\n", name,
+                estimator < 0 ? -1 : estimator - start, old < 0 ? -1 : old - start);
+}
+
+// a page put down and held on a quiet scene
+void checkQuietPage() {
+    Trace trace;
+    append(trace, 5, 0.0, 0.002);
+    append(trace, 15, 0.35, 0.10);
+    const int start = (int)trace.size();
+    append(trace, 30, 0.0, 0.002);
+    const int estimator = estimatorTrigger(trace, start);
+    const int old = oldTrigger(trace, start);
+    report("quiet page", start, estimator, old);
+    CHECK(estimator >= start);
+    CHECK_EQ(old - start, OLD_FRAME_LIMIT - 1);
+    // the motion average decays for a few frames, then minStableFrames
+    CHECK(estimator - start <= 6);
+    CHECK(estimator < old);
+}
+
+// sensor noise near the still level: the estimator asks for up to maxStableFrames
+// still frames here, so it may fire a little after the old counter, which never
+// looked at the noise, but it fires and takes longer than on a quiet scene
+void checkNoisyPage() {
+    Trace trace;
+    append(trace, 40, 0.008, 0.004);
+    append(trace, 15, 0.35, 0.10);
+    const int start = (int)trace.size();
+    append(trace, 40, 0.008, 0.004);
+    const int estimator = estimatorTrigger(trace, start);
+    const int old = oldTrigger(trace, start);
+    report("noisy page", start, estimator, old);
+    CHECK(estimator >= start);
+
+    Trace quiet;
+    append(quiet, 40, 0.0, 0.002);
+    append(quiet, 15, 0.35, 0.10);
+    append(quiet, 40, 0.0, 0.002);
+    CHECK(estimator - start > estimatorTrigger(quiet, start) - start);
+    CHECK(estimator - start <= StabilityConfig().maxStableFrames + 2);
+    CHECK(old >= start);
+}
+
+// a hand writing in one corner: under 10% of the whole frame, so the old counter
+// fired on a page that was never still, the busiest tile keeps the estimator off
+void checkHandInCorner() {
+    Trace trace;
+    append(trace, 15, 0.35, 0.10);
+    append(trace, 40, 0.0, 0.002, 11, 0.40);
+    const int start = (int)trace.size();
+    append(trace, 30, 0.0, 0.002);
+    int estimatorEarly = 0;
+    int oldEarly = 0;
+    const int estimator = estimatorTrigger(trace, start, &estimatorEarly);
+    const int old = oldTrigger(trace, start, &oldEarly);
+    report("hand in corner", start, estimator, old);
+    CHECK_EQ(estimatorEarly, 0);
+    CHECK(oldEarly > 0);
+    CHECK(estimator >= start && estimator - start <= 6);
+}
+
+// once settled, a page drifting between the still and the exit level stays stable
+void checkHysteresis() {
+    StabilityEstimator estimator{ StabilityConfig() };
+    std::vector<int> quiet(TILES, 0);
+    std::vector<int> drift(TILES, (int)(0.03 * TILE_PIXELS));
+    std::vector<int> moving(TILES, (int)(0.3 * TILE_PIXELS));
+    int f = 0;
+    while (!estimator.stable() && f++ < 20)
+        estimator.update(quiet, TILE_PIXELS);
+    CHECK(estimator.stable());
+    for (int i = 0; i < 10; i++)
+        CHECK_EQ(estimator.update(drift, TILE_PIXELS), StabilityEstimator::None);
+    CHECK(estimator.stable());
+    CHECK_EQ(estimator.update(moving, TILE_PIXELS), StabilityEstimator::Moved);
+}
+
+} // namespace
+
+int main() {
+    checkQuietPage();
+    checkNoisyPage();
+    checkHandInCorner();
+    checkHysteresis();
+    return checkResult();
+}
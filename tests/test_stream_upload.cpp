@@ -0,0 +1,132 @@
+// A JPEG streamed with StreamUpload, piece by piece as the encoder hands
+// out its restart intervals, must arrive byte for byte as the file the
+// plain encode writes. A send that gave up must not count as network bound.
+
+#include "check.h"
+#include "http_client.h"
+#include "loopback_server.h"
+#include "page_fixture.h"
+#include "stream_upload.h"
+#include "yuv_jpeg.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int WIDTH = 640;
+const int HEIGHT = 360;
+
+// streamed the way main.cpp streams a full frame, the whole file kept for the spool
+HttpResult stream(HttpClient& client, const std::string& url, const Yuv420Image& image, const YuvJpegParams& params,
+                  size_t queueChunks, std::vector<uint8_t>& encoded, int& pieces, bool& networkBound) {
+    StreamUpload upload(client, url, { "Content-Type: application/octet-stream" }, 10000, queueChunks);
+    encoded.clear();
+    pieces = 0;
+    bool streaming = true;
+    bool ok = encodeYuv420Jpeg(image, params, [&](const uint8_t* data, size_t size) {
+        encoded.insert(encoded.end(), data, data + size);
+        pieces++;
+        if (streaming)
+            streaming = upload.write(data, size);
+        return true;
+    });
+    CHECK(ok);
+    HttpResult result = ok ? upload.finish() : upload.abort();
+    networkBound = upload.networkBound();
+    return result;
+}
+
+void checkReassembly() {
+    const PageFrame page(WIDTH, HEIGHT, 7);
+    const Yuv420Image image = page.image();
+    LoopbackServer server;
+    HttpClient client{ HttpClientConfig() };
+    const int restarts[] = { 40, 7, 1 };
+    for (int restart : restarts) {
+        YuvJpegParams params;
+        params.quality = 85;
+        params.restartInterval = restart;
+        std::vector<uint8_t> expected;
+        CHECK(encodeYuv420Jpeg(image, params, expected));
+
+        for (size_t queueChunks : { (size_t)1, (size_t)8 }) {
+            std::vector<uint8_t> encoded;
+            int pieces = 0;
+            bool networkBound = false;
+            HttpResult result = stream(client, server.url("/upload"), image, params, queueChunks, encoded, pieces,
+                                       networkBound);
+            CHECK(result.ok);
+            CHECK_EQ(result.statusCode, 200);
+            CHECK(pieces > 1);
+            CHECK(encoded == expected);
+            std::vector<LoopbackServer::Request> requests = server.requests();
+            CHECK(!requests.empty());
+            if (requests.empty())
+                continue;
+            const LoopbackServer::Request& last = requests.back();
+            CHECK(last.chunked);
+            CHECK(last.path == "/upload");
+            CHECK(last.body.size() == expected.size());
+            CHECK(last.body == std::string(expected.begin(), expected.end()));
+            if (last.body != std::string(expected.begin(), expected.end()))
+                std::fprintf(stderr, "  restart %d queue %zu: %zu bytes arrived of %zu\n", restart, queueChunks,
+                             last.body.size(), expected.size());
+        }
+    }
+}
+
+// nobody listening: writes are refused once the send gave up, and that is
+// not the link being slower than the encoder
+void checkRefused() {
+    std::string url;
+    {
+        LoopbackServer server;
+        url = server.url("/upload");
+    }
+    const PageFrame page(WIDTH, HEIGHT, 7);
+    HttpClient client{ HttpClientConfig() };
+    YuvJpegParams params;
+    params.restartInterval = 1;
+    std::vector<uint8_t> encoded;
+    std::vector<uint8_t> expected;
+    CHECK(encodeYuv420Jpeg(page.image(), params, expected));
+    int pieces = 0;
+    bool networkBound = true;
+    HttpResult result = stream(client, url, page.image(), params, 1, encoded, pieces, networkBound);
+    CHECK(!result.ok);
+    CHECK(!networkBound);
+    // the spool still gets the whole file
+    CHECK(encoded == expected);
+}
+
+// an aborted body fails the request, the server never sees it complete
+void checkAbort() {
+    LoopbackServer server;
+    HttpClient client{ HttpClientConfig() };
+    HttpResult result;
+    {
+        StreamUpload upload(client, server.url("/upload"), {}, 10000, 4);
+        const uint8_t piece[100] = {};
+        CHECK(upload.write(piece, sizeof(piece)));
+        result = upload.abort();
+    }
+    CHECK(!result.ok);
+    CHECK(server.requests().empty());
+}
+
+} // namespace
+
+int main() {
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+        std::fprintf(stderr, "curl_global_init() failed\n");
+        return 1;
+    }
+    checkReassembly();
+    checkRefused();
+    checkAbort();
+    curl_global_cleanup();
+    return checkResult();
+}
@@ -0,0 +1,184 @@
+// UploadController driven by a simulated link: every page is "encoded" to
+// the size a page of print has at the decided settings, "sent" over a link
+// of known throughput and round trip, and both are fed back through
+// recordEncoded() and recordUpload() as the encode stage does.
+
+#include "check.h"
+#include "upload_controller.h"
+
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const uint64_t FRAME_PIXELS = 2560ull * 1440;
+const double RTT_MS = 100;
+const double CONNECT_MS = 2 * RTT_MS;
+
+// bits per pixel of the ladder qualities on the test page, a little denser than the controller's model
+double pageBitsPerPixel(int quality) {
+    switch (quality) {
+    case 95: return 2.6 * 1.2;
+    case 85: return 1.5 * 1.2;
+    case 75: return 1.1 * 1.2;
+    default: return 0.85 * 1.2;
+    }
+}
+
+struct Link {
+    UploadController controller;
+    double bytesPerSecond = 1e6;
+    std::vector<UploadDecision> decisions;
+
+    explicit Link(const UploadControllerConfig& config) : controller(config) {}
+
+    UploadDecision send(const UploadPageInfo& page) {
+        UploadDecision decision = controller.decide(page);
+        const int d = decision.downscale;
+        const double pixels = (double)(decision.cropsOnly ? page.cropPixels : page.framePixels) / (d * d);
+        const size_t bytes = (size_t)(pixels * pageBitsPerPixel(decision.quality) / 8 * (decision.gray ? 0.8 : 1.0));
+        controller.recordEncoded(page, decision, bytes);
+        // a new connection every time, the handshake shows the round trip
+        HttpResult result;
+        result.ok = true;
+        result.statusCode = 200;
+        result.timings.dnsMs = CONNECT_MS - RTT_MS;
+        result.timings.connectMs = CONNECT_MS;
+        result.timings.totalMs = CONNECT_MS + RTT_MS + bytes * 1000.0 / bytesPerSecond;
+        result.timings.firstByteMs = result.timings.totalMs;
+        controller.recordUpload(bytes, result, false);
+        decisions.push_back(decision);
+        return decision;
+    }
+
+    // enough pages at one rate for the estimates to settle
+    UploadDecision run(double rate, int pages, const UploadPageInfo& page) {
+        bytesPerSecond = rate;
+        UploadDecision decision;
+        for (int i = 0; i < pages; i++)
+            decision = send(page);
+        return decision;
+    }
+};
+
+UploadPageInfo fullFrame() {
+    UploadPageInfo page;
+    page.framePixels = FRAME_PIXELS;
+    return page;
+}
+
+// throughput falling page after page walks the ladder down, never up
+void checkStepsDown() {
+    UploadControllerConfig config;
+    config.sendCrops = false;
+    Link link(config);
+    // from the initial estimate up to a fast link first
+    UploadDecision fast = link.run(4e6, 20, fullFrame());
+    CHECK_EQ(fast.step, 0);
+    CHECK_EQ(fast.downscale, 1);
+    const size_t settled = link.decisions.size() - 1;
+    const double rates[] = { 1e6, 400e3, 200e3, 100e3, 50e3, 20e3, 8e3 };
+    for (double rate : rates)
+        link.run(rate, 20, fullFrame());
+    for (size_t i = settled + 1; i < link.decisions.size(); i++)
+        CHECK(link.decisions[i].step >= link.decisions[i - 1].step);
+    const UploadDecision& last = link.decisions.back();
+    CHECK_EQ(last.downscale, 4);
+    CHECK(last.gray);
+    // settled at each rate, the page fits the target unless nothing does
+    CHECK(link.decisions[settled + 4 * 20].predictedMs <= config.targetMs);
+    std::printf("down:  %zu pages, %.0f kB/s estimated at the end, last step q%d 1/%d%s\n", link.decisions.size(),
+                link.controller.bytesPerSecond() / 1000, last.quality, last.downscale, last.gray ? " gray" : "");
+}
+
+// first page that took a better step than the one before, -1 when none did
+int firstStepUp(const std::vector<UploadDecision>& decisions, size_t from) {
+    for (size_t i = from + 1; i < decisions.size(); i++) {
+        if (decisions[i].step < decisions[i - 1].step)
+            return (int)i;
+    }
+    return -1;
+}
+
+// a recovering link: a better step only once it is predicted under
+// upHysteresis of the target, later than without the margin
+void checkStepsUpWithHysteresis() {
+    UploadControllerConfig config;
+    config.sendCrops = false;
+    UploadControllerConfig noMargin = config;
+    noMargin.upHysteresis = 1.0;
+    Link link(config);
+    Link eager(noMargin);
+    link.run(20e3, 30, fullFrame());
+    eager.run(20e3, 30, fullFrame());
+    const size_t slow = link.decisions.size() - 1;
+    CHECK(link.decisions[slow].step > 0);
+    CHECK_EQ(link.decisions[slow].step, eager.decisions[slow].step);
+    // slowly back up, 2% more each page
+    for (double rate = 20e3; rate < 6e6; rate *= 1.02) {
+        link.run(rate, 1, fullFrame());
+        eager.run(rate, 1, fullFrame());
+    }
+    for (size_t i = slow + 1; i < link.decisions.size(); i++) {
+        if (link.decisions[i].step < link.decisions[i - 1].step)
+            CHECK(link.decisions[i].predictedMs <= config.targetMs * config.upHysteresis);
+        // never ahead of the controller without the margin
+        CHECK(link.decisions[i].step >= eager.decisions[i].step);
+    }
+    const int up = firstStepUp(link.decisions, slow);
+    const int eagerUp = firstStepUp(eager.decisions, slow);
+    CHECK(up > 0 && eagerUp > 0);
+    CHECK(up > eagerUp);
+    CHECK_EQ(link.decisions.back().step, 0);
+    std::printf("up:    first better step after %d pages, %d without the margin\n", up - (int)slow, eagerUp - (int)slow);
+}
+
+// with detections the crops go out at every rate, at the best step they fit,
+// a page without any goes out as the frame
+void checkCropsOnly() {
+    UploadControllerConfig config;
+    UploadPageInfo page = fullFrame();
+    page.cropPixels = FRAME_PIXELS / 10;
+
+    Link link(config);
+    Link framesOnly(config);
+    const double rates[] = { 4e6, 400e3, 100e3 };
+    for (double rate : rates) {
+        UploadDecision crops = link.run(rate, 20, page);
+        CHECK(crops.cropsOnly);
+        CHECK_EQ(crops.downscale, 1);
+        CHECK(crops.predictedMs <= config.targetMs);
+        UploadDecision frame = framesOnly.run(rate, 20, fullFrame());
+        CHECK(!frame.cropsOnly);
+        // a tenth of the pixels never needs a worse step than the frame
+        CHECK(crops.step <= frame.step);
+        if (rate == 4e6) {
+            CHECK_EQ(crops.step, 0);
+            CHECK_EQ(frame.step, 0);
+        }
+        if (rate == 100e3) {
+            CHECK_EQ(frame.downscale, 2);
+            CHECK(crops.step < frame.step);
+        }
+    }
+
+    // full mode: the frame goes out, downscaled when the link needs it
+    UploadControllerConfig noCrops = config;
+    noCrops.sendCrops = false;
+    Link full(noCrops);
+    UploadDecision fast = full.run(4e6, 20, page);
+    CHECK(!fast.cropsOnly);
+    CHECK_EQ(fast.downscale, 1);
+    UploadDecision downscaled = full.run(100e3, 20, page);
+    CHECK(!downscaled.cropsOnly);
+    CHECK_EQ(downscaled.downscale, 2);
+}
+
+} // namespace
+
+int main() {
+    checkStepsDown();
+    checkStepsUpWithHysteresis();
+    checkCropsOnly();
+    return checkResult();
+}
@@ -0,0 +1,247 @@
+// UploadSpool on a scratch directory: pages come back from run() in the
+// order they were appended, also after the spool is reopened, and damage a
+// crash or a bad flash block leaves in a segment is cut off on open()
+// without losing the records before it. A full spool drops its oldest
+// segment and moves the index past it.
+
+#include "check.h"
+#include "upload_spool.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+typedef std::vector<unsigned char> Page;
+
+// header in front of every record: magic, size, id, crc, reserved
+const size_t RECORD_HEADER_BYTES = 24;
+const size_t PAGE_BYTES = 1000;
+
+// a page that says which one it is in every byte
+Page makePage(int number) {
+    Page page(PAGE_BYTES);
+    for (size_t i = 0; i < page.size(); i++)
+        page[i] = (unsigned char)(number * 37 + i);
+    return page;
+}
+
+struct ScratchDir {
+    std::string path;
+
+    ScratchDir() {
+        char name[] = "/tmp/test_upload_spool.XXXXXX";
+        if (mkdtemp(name) == nullptr) {
+            std::perror("mkdtemp");
+            std::exit(1);
+        }
+        path = name;
+    }
+
+    ~ScratchDir() {
+        if (DIR* dir = opendir(path.c_str())) {
+            while (struct dirent* ent = readdir(dir)) {
+                if (ent->d_name[0] != '.')
+                    unlink((path + "/" + ent->d_name).c_str());
+            }
+            closedir(dir);
+        }
+        rmdir(path.c_str());
+    }
+
+    std::string segment(uint64_t firstId) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.seg", (unsigned long long)firstId);
+        return path + name;
+    }
+};
+
+UploadSpoolConfig configFor(const ScratchDir& dir) {
+    UploadSpoolConfig config;
+    config.directory = dir.path;
+    config.retryMinMs = 1;
+    config.retryMaxMs = 4;
+    return config;
+}
+
+bool appendPages(UploadSpool& spool, int first, int count) {
+    bool ok = true;
+    for (int i = first; i < first + count; i++)
+        ok = spool.append(makePage(i)) && ok;
+    return ok;
+}
+
+// Let run() send until count pages were acknowledged. failFirst sends are
+// refused first, run() has to retry them.
+std::vector<Page> drain(UploadSpool& spool, size_t count, int failFirst = 0) {
+    std::vector<Page> received;
+    int refused = 0;
+    std::thread sender([&] {
+        spool.run([&](const Page& page) {
+            if (refused < failFirst) {
+                refused++;
+                return false;
+            }
+            received.push_back(page);
+            if (received.size() == count)
+                spool.stop();
+            return true;
+        });
+    });
+    sender.join();
+    return received;
+}
+
+long long fileSize(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (long long)st.st_size : -1;
+}
+
+uint64_t readIndex(const ScratchDir& dir) {
+    uint64_t head = ~0ull;
+    if (FILE* f = std::fopen((dir.path + "/index").c_str(), "rb")) {
+        if (std::fread(&head, sizeof(head), 1, f) != 1)
+            head = ~0ull;
+        std::fclose(f);
+    }
+    return head;
+}
+
+bool samePages(const std::vector<Page>& received, int first, int count) {
+    if ((int)received.size() != count)
+        return false;
+    for (int i = 0; i < count; i++) {
+        if (received[i] != makePage(first + i))
+            return false;
+    }
+    return true;
+}
+
+// what was not acknowledged before the spool went away is sent first, in order
+void checkResendAfterReopen() {
+    ScratchDir dir;
+    {
+        UploadSpool spool(configFor(dir));
+        CHECK(spool.open());
+        CHECK(appendPages(spool, 0, 5));
+        CHECK_EQ(spool.pendingCount(), 5);
+        // a refused send is retried, the page does not get lost or reordered
+        CHECK(samePages(drain(spool, 2, 3), 0, 2));
+        CHECK_EQ(spool.pendingCount(), 3);
+        CHECK_EQ(readIndex(dir), 2);
+    }
+    UploadSpool reopened(configFor(dir));
+    CHECK(reopened.open());
+    CHECK_EQ(reopened.pendingCount(), 3);
+    CHECK(appendPages(reopened, 5, 1));
+    CHECK(samePages(drain(reopened, 4), 2, 4));
+    CHECK_EQ(reopened.pendingCount(), 0);
+    CHECK_EQ(readIndex(dir), 6);
+    // everything acknowledged, the segment is gone
+    CHECK_EQ(fileSize(dir.segment(0)), -1);
+}
+
+// a crash in the middle of append() leaves half a record at the end
+void checkTornRecord() {
+    ScratchDir dir;
+    {
+        UploadSpool spool(configFor(dir));
+        CHECK(spool.open());
+        CHECK(appendPages(spool, 0, 3));
+    }
+    const long long record = RECORD_HEADER_BYTES + PAGE_BYTES;
+    CHECK_EQ(fileSize(dir.segment(0)), 3 * record);
+    CHECK_EQ(truncate(dir.segment(0).c_str(), 3 * record - 100), 0);
+
+    {
+        UploadSpool reopened(configFor(dir));
+        CHECK(reopened.open());
+        CHECK_EQ(reopened.pendingCount(), 2);
+        CHECK_EQ(fileSize(dir.segment(0)), 2 * record);
+        // the next page takes the id of the one that was cut off
+        CHECK(appendPages(reopened, 2, 1));
+        CHECK(samePages(drain(reopened, 3), 0, 3));
+    }
+
+    // a header cut short is dropped as well
+    {
+        UploadSpool spool(configFor(dir));
+        CHECK(spool.open());
+        CHECK_EQ(spool.pendingCount(), 0);
+        CHECK(appendPages(spool, 10, 2));
+    }
+    const uint64_t first = 3;
+    CHECK_EQ(truncate(dir.segment(first).c_str(), record + RECORD_HEADER_BYTES / 2), 0);
+    UploadSpool again(configFor(dir));
+    CHECK(again.open());
+    CHECK_EQ(again.pendingCount(), 1);
+    CHECK(samePages(drain(again, 1), 10, 1));
+}
+
+// a flipped byte fails the checksum, the spool keeps the records before it
+void checkCrcMismatch() {
+    ScratchDir dir;
+    {
+        UploadSpool spool(configFor(dir));
+        CHECK(spool.open());
+        CHECK(appendPages(spool, 0, 4));
+    }
+    const long long record = RECORD_HEADER_BYTES + PAGE_BYTES;
+    if (FILE* f = std::fopen(dir.segment(0).c_str(), "r+b")) {
+        std::fseek(f, 2 * record + RECORD_HEADER_BYTES + 500, SEEK_SET);
+        const int byte = std::fgetc(f);
+        std::fseek(f, -1, SEEK_CUR);
+        std::fputc(byte ^ 0x40, f);
+        std::fclose(f);
+    }
+
+    UploadSpool reopened(configFor(dir));
+    CHECK(reopened.open());
+    // recovery stops at the damaged record, what follows it cannot be trusted
+    CHECK_EQ(reopened.pendingCount(), 2);
+    CHECK_EQ(fileSize(dir.segment(0)), 2 * record);
+    CHECK(samePages(drain(reopened, 2), 0, 2));
+}
+
+// past maxBytes the oldest segment goes, unsent or not, and the index follows
+void checkEviction() {
+    ScratchDir dir;
+    const uint64_t record = RECORD_HEADER_BYTES + PAGE_BYTES;
+    UploadSpoolConfig config = configFor(dir);
+    // one record per segment, room for three
+    config.segmentBytes = record + record / 2;
+    config.maxBytes = 3 * record;
+    {
+        UploadSpool spool(config);
+        CHECK(spool.open());
+        CHECK(appendPages(spool, 0, 5));
+        CHECK_EQ(spool.pendingCount(), 3);
+        CHECK_EQ(readIndex(dir), 2);
+        CHECK_EQ(fileSize(dir.segment(0)), -1);
+        CHECK_EQ(fileSize(dir.segment(1)), -1);
+        CHECK_EQ(fileSize(dir.segment(2)), (long long)record);
+    }
+    UploadSpool reopened(config);
+    CHECK(reopened.open());
+    CHECK_EQ(reopened.pendingCount(), 3);
+    CHECK(samePages(drain(reopened, 3), 2, 3));
+    CHECK_EQ(readIndex(dir), 5);
+}
+
+} // namespace
+
+int main() {
+    checkResendAfterReopen();
+    checkTornRecord();
+    checkCrcMismatch();
+    checkEviction();
+    return checkResult();
+}
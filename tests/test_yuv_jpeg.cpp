@@ -0,0 +1,136 @@
+// encodeYuv420Jpeg() must write the same bytes as encodeYuv420JpegScalar(),
+// and the pieces the chunked version hands out must add up to that file. On
+// the host both are the scalar transform; built with tests/riscv-qemu.cmake
+// the first one is the RVV transform and runs under QEMU. With libjpeg on
+// the host the files are also decoded and compared with the input.
+
+#include "check.h"
+#include "page_fixture.h"
+#include "yuv_jpeg.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+namespace {
+
+#if HAVE_LIBJPEG
+// peak signal to noise ratio of the decoded luma against the input, downscaled like the encoder did
+double decodedLumaPsnr(const std::vector<uint8_t>& jpeg, const PageFrame& frame, const YuvJpegParams& params) {
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<uint8_t*>(jpeg.data()), jpeg.size());
+    double psnr = -1;
+    const int d = params.downscale;
+    const int width = (frame.width + d - 1) / d;
+    const int height = (frame.height + d - 1) / d;
+    if (jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK && (int)cinfo.image_width == width
+        && (int)cinfo.image_height == height) {
+        cinfo.out_color_space = JCS_GRAYSCALE;
+        jpeg_start_decompress(&cinfo);
+        std::vector<uint8_t> row(width);
+        double squared = 0;
+        while (cinfo.output_scanline < cinfo.output_height) {
+            const int r = cinfo.output_scanline;
+            uint8_t* rows[1] = { row.data() };
+            jpeg_read_scanlines(&cinfo, rows, 1);
+            for (int c = 0; c < width; c++) {
+                int sum = 0;
+                int count = 0;
+                for (int dy = 0; dy < d && r * d + dy < frame.height; dy++) {
+                    for (int dx = 0; dx < d && c * d + dx < frame.width; dx++) {
+                        sum += frame.y[(size_t)(r * d + dy) * frame.strideY + c * d + dx];
+                        count++;
+                    }
+                }
+                const double diff = row[c] - (double)sum / count;
+                squared += diff * diff;
+            }
+        }
+        jpeg_finish_decompress(&cinfo);
+        const double mse = squared / ((double)width * height);
+        psnr = mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : 99;
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return psnr;
+}
+#endif
+
+void compare(const PageFrame& frame, Layout layout, const YuvJpegParams& params) {
+    const Yuv420Image image = frame.image(layout);
+    std::vector<uint8_t> jpeg;
+    std::vector<uint8_t> jpegScalar;
+    CHECK(encodeYuv420Jpeg(image, params, jpeg));
+    CHECK(encodeYuv420JpegScalar(image, params, jpegScalar));
+    CHECK(!jpeg.empty());
+    CHECK(jpeg == jpegScalar);
+
+    std::vector<uint8_t> joined;
+    int pieces = 0;
+    CHECK(encodeYuv420Jpeg(image, params, [&](const uint8_t* data, size_t size) {
+        joined.insert(joined.end(), data, data + size);
+        pieces++;
+        return true;
+    }));
+    CHECK(joined == jpeg);
+    CHECK(params.restartInterval > 0 || pieces == 1);
+
+    if (jpeg != jpegScalar || joined != jpeg)
+        std::fprintf(stderr, "  %dx%d layout %d q%d 1/%d%s restart %d\n", frame.width, frame.height, (int)layout,
+                     params.quality, params.downscale, params.gray ? " gray" : "", params.restartInterval);
+#if HAVE_LIBJPEG
+    // print survives any quality the upload ladder uses
+    if (params.quality >= 60)
+        CHECK(decodedLumaPsnr(jpeg, frame, params) > 28);
+#endif
+}
+
+} // namespace
+
+int main() {
+#if defined(__riscv) && !defined(__riscv_vector)
+    std::fprintf(stderr, "built for riscv without the vector extension, the RVV transform is not tested\n");
+    return 1;
+#endif
+#if __riscv_vector
+    std::printf("encodeYuv420Jpeg: rvv\n");
+#else
+    std::printf("encodeYuv420Jpeg: scalar\n");
+#endif
+    // one MCU, odd sizes that need edge padding and a crop sized like the uploads
+    const int sizes[][2] = { { 16, 16 }, { 17, 9 }, { 33, 47 }, { 250, 131 }, { 640, 360 } };
+    const int qualities[] = { 1, 60, 75, 95, 100 };
+    const Layout layouts[] = { NV21, NV12, I420 };
+    for (const auto& size : sizes) {
+        const PageFrame frame(size[0], size[1], (unsigned)(size[0] * 7 + size[1]));
+        for (Layout layout : layouts) {
+            for (int quality : qualities) {
+                YuvJpegParams params;
+                params.quality = quality;
+                compare(frame, layout, params);
+            }
+        }
+        YuvJpegParams params;
+        params.quality = 85;
+        for (int downscale : { 2, 4 }) {
+            params.downscale = downscale;
+            compare(frame, NV21, params);
+        }
+        params.downscale = 1;
+        params.gray = true;
+        compare(frame, NV21, params);
+        params.gray = false;
+        for (int restart : { 1, 3, 40 }) {
+            params.restartInterval = restart;
+            compare(frame, NV21, params);
+        }
+    }
+    return checkResult();
+}
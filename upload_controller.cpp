@@ -0,0 +1,184 @@
+#include "upload_controller.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+struct Step {
+    int quality;
+    int downscale;
+    bool gray;
+};
+
+const Step LADDER[] = {
+    { 95, 1, false },
+    { 85, 1, false },
+    { 75, 1, false },
+    { 85, 2, false },
+    { 75, 2, false },
+    { 75, 2, true },
+    { 60, 4, true },
+};
+constexpr int STEP_COUNT = sizeof(LADDER) / sizeof(LADDER[0]);
+
+// Bits per output pixel of a 4:2:0 baseline JPEG of a printed page, the
+// measured sizes scale it to the real content
+struct Rate {
+    int quality;
+    double bitsPerPixel;
+};
+
+const Rate RATES[] = {
+    { 1, 0.2 },
+    { 50, 0.7 },
+    { 60, 0.85 },
+    { 75, 1.1 },
+    { 85, 1.5 },
+    { 95, 2.6 },
+    { 100, 5.0 },
+};
+constexpr int RATE_COUNT = sizeof(RATES) / sizeof(RATES[0]);
+
+// chroma is a small part of a page of print
+constexpr double GRAY_SIZE = 0.8;
+
+// below this an upload says more about the round trip than the throughput
+constexpr size_t MIN_RATE_BYTES = 16u << 10;
+
+double bitsPerPixel(int quality) {
+    quality = std::min(std::max(quality, RATES[0].quality), RATES[RATE_COUNT - 1].quality);
+    for (int i = 1; i < RATE_COUNT; i++) {
+        if (quality <= RATES[i].quality) {
+            const Rate& a = RATES[i - 1];
+            const Rate& b = RATES[i];
+            return a.bitsPerPixel + (b.bitsPerPixel - a.bitsPerPixel) * (quality - a.quality) / (b.quality - a.quality);
+        }
+    }
+    return RATES[RATE_COUNT - 1].bitsPerPixel;
+}
+
+uint64_t stepPixels(uint64_t pixels, bool crops, int step) {
+    const int d = crops ? 1 : LADDER[step].downscale;
+    return pixels / (d * d);
+}
+
+std::string describeStep(int step, bool crops) {
+    const Step& s = LADDER[step];
+    char text[48];
+    std::snprintf(text, sizeof(text), "%sq%d%s%s", crops ? "crops " : "", s.quality,
+                  crops || s.downscale == 1 ? "" : s.downscale == 2 ? " 1/2" : " 1/4", s.gray ? " gray" : "");
+    return text;
+}
+
+double ema(double average, double sample, float alpha) {
+    return average + alpha * (sample - average);
+}
+
+} // namespace
+
+UploadController::UploadController(const UploadControllerConfig& config)
+    : config(config), throughput(config.initialBytesPerSecond), rtt(config.initialRttMs) {}
+
+double UploadController::predictBytes(uint64_t pixels, int quality, bool gray) const {
+    return pixels * bitsPerPixel(quality) / 8 * (gray ? GRAY_SIZE : 1.0) * sizeScale;
+}
+
+// First step whose predicted time fits, steps better than the last one
+// need the hysteresis margin. The cheapest allowed step when none fits.
+int UploadController::fit(uint64_t pixels, bool crops, double& predictedMs) const {
+    int chosen = -1;
+    for (int i = 0; i < STEP_COUNT; i++) {
+        if (LADDER[i].gray && !config.allowGray)
+            continue;
+        const double bytes = predictBytes(stepPixels(pixels, crops, i), LADDER[i].quality, LADDER[i].gray);
+        predictedMs = rtt + bytes * 1000 / throughput;
+        chosen = i;
+        const double limit = config.targetMs * (i < lastStep ? config.upHysteresis : 1.0);
+        if (predictedMs <= limit)
+            break;
+    }
+    return chosen;
+}
+
+UploadDecision UploadController::decide(const UploadPageInfo& page) {
+    std::lock_guard<std::mutex> lock(mutex);
+    UploadDecision decision;
+    decision.cropsOnly = config.sendCrops && page.cropPixels > 0;
+    decision.step = fit(decision.cropsOnly ? page.cropPixels : page.framePixels, decision.cropsOnly,
+                        decision.predictedMs);
+    std::string why;
+    if (decision.cropsOnly)
+        cropPages++;
+    const Step& step = LADDER[decision.step];
+    decision.quality = step.quality;
+    decision.downscale = decision.cropsOnly ? 1 : step.downscale;
+    decision.gray = step.gray;
+
+    if (decision.predictedMs > config.targetMs)
+        why += ", nothing fits";
+    if (decision.step != lastStep) {
+        why += decision.step > lastStep ? ", down from " : ", up from ";
+        why += describeStep(lastStep, lastCrops);
+        stepChanges++;
+    }
+    const uint64_t pixels = stepPixels(decision.cropsOnly ? page.cropPixels : page.framePixels,
+                                       decision.cropsOnly, decision.step);
+    char text[160];
+    std::snprintf(text, sizeof(text), "%s: %.0f ms for %.0f kB at %.0f kB/s rtt %.0f ms, target %.0f ms",
+                  describeStep(decision.step, decision.cropsOnly).c_str(), decision.predictedMs,
+                  predictBytes(pixels, step.quality, step.gray) / 1000, throughput / 1000, rtt, config.targetMs);
+    decision.reason = text + why;
+    lastStep = decision.step;
+    lastCrops = decision.cropsOnly;
+    decisions++;
+    return decision;
+}
+
+void UploadController::recordEncoded(const UploadPageInfo& page, const UploadDecision& decision, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint64_t pixels = stepPixels(decision.cropsOnly ? page.cropPixels : page.framePixels,
+                                       decision.cropsOnly, decision.step);
+    if (pixels == 0 || bytes == 0)
+        return;
+    const double modelled = pixels * bitsPerPixel(decision.quality) / 8 * (decision.gray ? GRAY_SIZE : 1.0);
+    const double ratio = std::min(std::max(bytes / modelled, 0.05), 20.0);
+    sizeScale = ema(sizeScale, ratio, config.emaAlpha);
+}
+
+void UploadController::recordUpload(size_t bytes, const HttpResult& result, bool lowerBound) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!result.ok) {
+        // nothing measured, but the link is worse than we thought
+        throughput = std::max(throughput / 2, config.minBytesPerSecond);
+        return;
+    }
+    const HttpTimings& t = result.timings;
+    // the TCP handshake takes one round trip
+    if (!result.reused && t.connectMs > t.dnsMs)
+        rtt = ema(rtt, t.connectMs - t.dnsMs, config.emaAlpha);
+    if (bytes < MIN_RATE_BYTES)
+        return;
+    const double setupMs = result.reused ? 0 : std::max(t.connectMs, t.tlsMs);
+    const double sendMs = std::max(t.totalMs - setupMs - rtt, 1.0);
+    const double sample = bytes * 1000 / sendMs;
+    if (!lowerBound || sample > throughput)
+        throughput = std::max(ema(throughput, sample, config.emaAlpha), config.minBytesPerSecond);
+}
+
+double UploadController::bytesPerSecond() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return throughput;
+}
+
+double UploadController::rttMs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return rtt;
+}
+
+void UploadController::print() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::printf("  %-8s %.0f kB/s rtt: %.0f ms size: %.2fx step: %s pages: %llu changes: %llu crops: %llu\n",
+                "uplink", throughput / 1000, rtt, sizeScale, describeStep(lastStep, lastCrops).c_str(),
+                (unsigned long long)decisions, (unsigned long long)stepChanges, (unsigned long long)cropPages);
+}
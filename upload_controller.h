@@ -0,0 +1,92 @@
+#ifndef UPLOAD_CONTROLLER_H
+#define UPLOAD_CONTROLLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "http_result.h"
+
+struct UploadControllerConfig {
+    double targetMs = 3000;             // time on the network a page should stay under
+    double upHysteresis = 0.7;          // a better step is taken again once predicted under this share of the target
+    float emaAlpha = 0.3f;              // weight of the newest sample in the link and size estimates
+    double initialBytesPerSecond = 250e3;
+    double initialRttMs = 100;
+    double minBytesPerSecond = 4e3;     // floor after failed uploads
+    bool allowGray = true;
+    bool sendCrops = true;              // a page with detections goes out as their crops, not the frame
+};
+
+// The page about to be encoded.
+struct UploadPageInfo {
+    uint64_t framePixels = 0;
+    uint64_t cropPixels = 0;            // of all crops of its detections, 0 without any
+};
+
+// How to encode it.
+struct UploadDecision {
+    bool cropsOnly = false;             // the crops of its detections instead of the full frame
+    int quality = 95;
+    int downscale = 1;                  // per side, full frames only, crops keep their resolution
+    bool gray = false;
+    int step = 0;                       // on the ladder, 0 is the best
+    double predictedMs = 0;
+    std::string reason;
+};
+
+// Picks the encode settings of each page so it reaches the remote within a
+// target time over whatever link there is.
+//
+// Throughput and round trip time are smoothed from finished uploads, the
+// JPEG size per pixel from finished encodes. The page walks down a fixed
+// ladder of settings, best first, until its predicted time on the network
+// fits the target:
+//
+//   q95, q85, q75 at full size, q85, q75 at half size,
+//   gray q75 at half size, gray q60 at quarter size
+//
+// With sendCrops a page that has detection crops goes out as them, at the
+// best step they fit, and only a page without any as the full frame. Crops
+// keep their full resolution. A better step than the last one is only taken
+// once it is predicted well under the target, so a link near the edge does
+// not flip the settings every page.
+// Safe to use from the encode and upload stages at the same time.
+class UploadController {
+public:
+    explicit UploadController(const UploadControllerConfig& config);
+
+    UploadDecision decide(const UploadPageInfo& page);
+
+    // The page was encoded as decided into bytes.
+    void recordEncoded(const UploadPageInfo& page, const UploadDecision& decision, size_t bytes);
+
+    // An upload of bytes finished. lowerBound marks a body that was produced
+    // slower than the link could take it, e.g. streamed while encoding, so
+    // its rate can only raise the throughput estimate.
+    void recordUpload(size_t bytes, const HttpResult& result, bool lowerBound);
+
+    double bytesPerSecond() const;
+
+    double rttMs() const;
+
+    void print() const;
+
+private:
+    double predictBytes(uint64_t pixels, int quality, bool gray) const;
+    int fit(uint64_t pixels, bool crops, double& predictedMs) const;
+
+    UploadControllerConfig config;
+    mutable std::mutex mutex;
+    double throughput;          // bytes per second
+    double rtt;                 // ms
+    double sizeScale = 1.0;     // measured over modelled JPEG size
+    int lastStep = 0;
+    bool lastCrops = false;
+    uint64_t decisions = 0;
+    uint64_t cropPages = 0;     // pages sent as their crops
+    uint64_t stepChanges = 0;
+};
+
+#endif // UPLOAD_CONTROLLER_H
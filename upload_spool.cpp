@@ -0,0 +1,339 @@
+#include "upload_spool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t RECORD_MAGIC = 0x4c4f4f50; // "POOL"
+constexpr const char* INDEX_FILE_NAME = "index";
+constexpr const char* SEGMENT_SUFFIX = ".seg";
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t size;
+    uint64_t id;
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+struct Crc32Table {
+    uint32_t entries[256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32(const unsigned char* data, size_t size) {
+    static const Crc32Table table;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < size; i++)
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+bool writeAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool readAll(int fd, void* data, size_t size, uint64_t offset) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+} // namespace
+
+UploadSpool::UploadSpool(const UploadSpoolConfig& config) : config(config) {}
+
+UploadSpool::~UploadSpool() {
+    closeWriter();
+    if (indexFd >= 0)
+        close(indexFd);
+}
+
+std::string UploadSpool::segmentPath(uint64_t segmentId) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)segmentId, SEGMENT_SUFFIX);
+    return config.directory + "/" + name;
+}
+
+bool UploadSpool::open() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (mkdir(config.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Unable to create spool directory " << config.directory << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::string indexPath = config.directory + "/" + INDEX_FILE_NAME;
+    indexFd = ::open(indexPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (indexFd < 0) {
+        std::cerr << "Unable to open spool index " << indexPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (!readAll(indexFd, &head, sizeof(head), 0))
+        head = 0;
+
+    std::vector<uint64_t> segmentIds;
+    DIR* dir = opendir(config.directory.c_str());
+    if (dir == nullptr) {
+        std::cerr << "Unable to list spool directory " << config.directory << std::endl;
+        return false;
+    }
+    while (struct dirent* ent = readdir(dir)) {
+        unsigned long long id = 0;
+        char suffix[8] = {0};
+        if (strlen(ent->d_name) == 16 + strlen(SEGMENT_SUFFIX)
+            && std::sscanf(ent->d_name, "%16llx%7s", &id, suffix) == 2 && strcmp(suffix, SEGMENT_SUFFIX) == 0)
+            segmentIds.push_back(id);
+    }
+    closedir(dir);
+    std::sort(segmentIds.begin(), segmentIds.end());
+
+    nextId = head;
+    for (uint64_t segmentId : segmentIds)
+        recoverSegment(segmentId);
+    removeSentSegments();
+    recovered = pending.size();
+    if (recovered > 0)
+        std::cout << "upload spool: " << recovered << " pages left from last run" << std::endl;
+    return true;
+}
+
+// Walk the records of one segment and queue the ones not sent yet. A torn
+// record at the end, from a crash in the middle of append(), is cut off.
+bool UploadSpool::recoverSegment(uint64_t segmentId) {
+    std::string path = segmentPath(segmentId);
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    uint64_t fileSize = fstat(fd, &st) == 0 ? st.st_size : 0;
+    Segment segment = { segmentId, segmentId, 0 };
+    std::vector<unsigned char> payload;
+    uint64_t offset = 0;
+    while (offset + sizeof(RecordHeader) <= fileSize) {
+        RecordHeader header;
+        if (!readAll(fd, &header, sizeof(header), offset) || header.magic != RECORD_MAGIC || header.id < segment.endId
+            || offset + sizeof(header) + header.size > fileSize)
+            break;
+        payload.resize(header.size);
+        if (!readAll(fd, payload.data(), header.size, offset + sizeof(header))
+            || crc32(payload.data(), header.size) != header.crc)
+            break;
+        if (header.id >= head)
+            pending.push_back({ header.id, segmentId, offset + sizeof(header), header.size });
+        segment.endId = header.id + 1;
+        offset += sizeof(header) + header.size;
+    }
+    if (offset < fileSize) {
+        std::cerr << "upload spool: dropping " << fileSize - offset << " damaged bytes at the end of " << path << std::endl;
+        if (ftruncate(fd, offset) != 0)
+            std::cerr << "ftruncate failed: " << strerror(errno) << std::endl;
+    }
+    close(fd);
+    if (offset == 0) {
+        unlink(path.c_str());
+        return false;
+    }
+    segment.bytes = offset;
+    segments.push_back(segment);
+    diskBytes += offset;
+    nextId = std::max(nextId, segment.endId);
+    return true;
+}
+
+bool UploadSpool::append(const std::vector<unsigned char>& data) {
+    const uint64_t recordBytes = sizeof(RecordHeader) + data.size();
+    if (recordBytes > config.maxBytes) {
+        std::cerr << "upload spool: page of " << data.size() << " bytes does not fit" << std::endl;
+        return false;
+    }
+    RecordHeader header = { RECORD_MAGIC, (uint32_t)data.size(), 0, crc32(data.data(), data.size()), 0 };
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (indexFd < 0)
+        return false;
+    if (writerFd >= 0 && segments.back().bytes + recordBytes > config.segmentBytes)
+        closeWriter();
+    if (writerFd < 0) {
+        std::string path = segmentPath(nextId);
+        writerFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (writerFd < 0) {
+            std::cerr << "Unable to create spool segment " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        segments.push_back({ nextId, nextId, 0 });
+    }
+    Segment& segment = segments.back();
+    header.id = nextId;
+    if (!writeAll(writerFd, &header, sizeof(header)) || !writeAll(writerFd, data.data(), data.size())
+        || fdatasync(writerFd) != 0) {
+        std::cerr << "upload spool: write failed: " << strerror(errno) << std::endl;
+        // leave the segment as it was, a partial record would end recovery early
+        if (ftruncate(writerFd, segment.bytes) != 0) {
+            closeWriter();
+            if (segment.bytes == 0) {
+                unlink(segmentPath(segment.firstId).c_str());
+                segments.pop_back();
+            }
+        }
+        return false;
+    }
+    pending.push_back({ nextId, segment.firstId, segment.bytes + sizeof(header), (uint32_t)data.size() });
+    segment.bytes += recordBytes;
+    segment.endId = ++nextId;
+    diskBytes += recordBytes;
+    appended++;
+    while (diskBytes > config.maxBytes && segments.size() > 1)
+        evictOldest();
+    wake.notify_one();
+    return true;
+}
+
+bool UploadSpool::readPayload(const Entry& entry, std::vector<unsigned char>& payload) const {
+    int fd = ::open(segmentPath(entry.segmentId).c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    payload.resize(entry.size);
+    bool ok = readAll(fd, payload.data(), entry.size, entry.offset);
+    close(fd);
+    return ok;
+}
+
+bool UploadSpool::writeIndex() {
+    if (pwrite(indexFd, &head, sizeof(head), 0) != (ssize_t)sizeof(head) || fdatasync(indexFd) != 0) {
+        std::cerr << "upload spool: index write failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void UploadSpool::advanceHead(uint64_t id) {
+    while (!pending.empty() && pending.front().id <= id)
+        pending.pop_front();
+    if (head > id)
+        return;
+    head = id + 1;
+    writeIndex();
+    removeSentSegments();
+}
+
+void UploadSpool::removeSentSegments() {
+    while (!segments.empty() && segments.front().endId <= head) {
+        if (segments.size() == 1)
+            closeWriter();
+        unlink(segmentPath(segments.front().firstId).c_str());
+        diskBytes -= segments.front().bytes;
+        segments.pop_front();
+    }
+}
+
+// Out of space, give up on the oldest segment whether it was sent or not.
+void UploadSpool::evictOldest() {
+    const Segment& segment = segments.front();
+    uint64_t dropped = 0;
+    while (!pending.empty() && pending.front().segmentId == segment.firstId) {
+        pending.pop_front();
+        dropped++;
+    }
+    evicted += dropped;
+    if (dropped > 0)
+        std::cerr << "upload spool full, dropped " << dropped << " unsent pages" << std::endl;
+    if (segment.endId > head) {
+        head = segment.endId;
+        writeIndex();
+    }
+    removeSentSegments();
+}
+
+void UploadSpool::closeWriter() {
+    if (writerFd >= 0) {
+        close(writerFd);
+        writerFd = -1;
+    }
+}
+
+void UploadSpool::run(const std::function<bool(const std::vector<unsigned char>&)>& send) {
+    int backoffMs = 0;
+    std::vector<unsigned char> payload;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopped) {
+        if (pending.empty()) {
+            wake.wait(lock, [this] { return stopped || !pending.empty(); });
+            continue;
+        }
+        const Entry entry = pending.front();
+        if (!readPayload(entry, payload)) {
+            std::cerr << "upload spool: page " << entry.id << " is unreadable, skipping it" << std::endl;
+            advanceHead(entry.id);
+            continue;
+        }
+        // appends go on while we are on the network
+        lock.unlock();
+        bool ok = send(payload);
+        lock.lock();
+        if (ok) {
+            sent++;
+            backoffMs = 0;
+            advanceHead(entry.id);
+            continue;
+        }
+        failures++;
+        backoffMs = backoffMs == 0 ? config.retryMinMs : std::min(backoffMs * 2, config.retryMaxMs);
+        std::cerr << "upload spool: retrying page " << entry.id << " in " << backoffMs << " ms" << std::endl;
+        wake.wait_for(lock, std::chrono::milliseconds(backoffMs), [this] { return stopped; });
+    }
+}
+
+void UploadSpool::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    wake.notify_all();
+}
+
+size_t UploadSpool::pendingCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending.size();
+}
+
+void UploadSpool::print() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::printf("  %-8s pending: %zu disk: %.1f MB appended: %llu sent: %llu failed: %llu evicted: %llu recovered: %llu\n",
+                "spool", pending.size(), diskBytes / 1048576.0, (unsigned long long)appended, (unsigned long long)sent,
+                (unsigned long long)failures, (unsigned long long)evicted, (unsigned long long)recovered);
+}
@@ -0,0 +1,94 @@
+#ifndef UPLOAD_SPOOL_H
+#define UPLOAD_SPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct UploadSpoolConfig {
+    std::string directory;              // created if missing
+    uint64_t maxBytes = 128u << 20;     // oldest segments are dropped beyond this
+    uint64_t segmentBytes = 8u << 20;   // a new segment is started past this size
+    int retryMinMs = 1000;              // first backoff after a failed send, doubled up to retryMaxMs
+    int retryMaxMs = 60000;
+};
+
+// Uploads that survive network outages and restarts.
+//
+// Pages are appended to segment files in the spool directory, each record
+// carrying its id and a checksum, and synced before append() returns. An index
+// file holds the id of the oldest page not yet acknowledged by the remote.
+// run() sends the pages in order from a worker thread and only moves the index
+// forward once a send succeeded, so whatever was pending at a crash or reboot
+// is found again by open() and sent first. Segments are deleted once all their
+// pages went out, or dropped oldest first when the spool outgrows maxBytes.
+class UploadSpool {
+public:
+    explicit UploadSpool(const UploadSpoolConfig& config);
+    ~UploadSpool();
+
+    // Create the directory and recover pending pages from a previous run.
+    bool open();
+
+    // Store one page for sending, false when it could not be written.
+    bool append(const std::vector<unsigned char>& data);
+
+    // Send pages until stop(). send returns true once the remote has the page,
+    // otherwise the same page is retried after a growing delay.
+    void run(const std::function<bool(const std::vector<unsigned char>&)>& send);
+
+    // Wake run() up and make it return, pending pages stay on disk.
+    void stop();
+
+    // Pages not yet acknowledged by the remote, the one being sent included.
+    size_t pendingCount() const;
+
+    void print() const;
+
+private:
+    struct Segment {
+        uint64_t firstId;
+        uint64_t endId;     // one past the last id written to it
+        uint64_t bytes;
+    };
+
+    struct Entry {
+        uint64_t id;
+        uint64_t segmentId;
+        uint64_t offset;    // of the payload
+        uint32_t size;
+    };
+
+    std::string segmentPath(uint64_t segmentId) const;
+    bool recoverSegment(uint64_t segmentId);
+    bool readPayload(const Entry& entry, std::vector<unsigned char>& payload) const;
+    bool writeIndex();
+    void advanceHead(uint64_t id);
+    void removeSentSegments();
+    void evictOldest();
+    void closeWriter();
+
+    UploadSpoolConfig config;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Segment> segments;
+    std::deque<Entry> pending;
+    uint64_t head = 0;          // oldest id not yet acknowledged
+    uint64_t nextId = 0;
+    uint64_t diskBytes = 0;
+    int writerFd = -1;          // segments.back() while it takes appends
+    int indexFd = -1;
+    bool stopped = false;
+
+    uint64_t appended = 0;
+    uint64_t sent = 0;
+    uint64_t failures = 0;
+    uint64_t evicted = 0;
+    uint64_t recovered = 0;
+};
+
+#endif // UPLOAD_SPOOL_H
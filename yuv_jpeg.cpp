@@ -0,0 +1,581 @@
+#include "yuv_jpeg.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if __riscv_vector
+#include <riscv_vector.h>
+#endif
+
+namespace {
+
+// ISO/IEC 10918-1 Annex K, natural order
+const uint8_t LUMA_QUANT[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61,
+    12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56,
+    14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77,
+    24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+const uint8_t CHROMA_QUANT[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+// natural index of each zigzag position
+const uint8_t ZIGZAG[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Annex K.3 Huffman tables, code counts per length 1..16 followed by the symbols
+const uint8_t DC_LUMA_BITS[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+const uint8_t DC_CHROMA_BITS[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+const uint8_t DC_VALUES[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+const uint8_t AC_LUMA_BITS[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+const uint8_t AC_LUMA_VALUES[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+const uint8_t AC_CHROMA_BITS[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+const uint8_t AC_CHROMA_VALUES[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+// Integer forward DCT after the LLM algorithm in libjpeg's jfdctint.c.
+// The row pass keeps PASS1_BITS of extra precision, the result comes out
+// scaled by 8, which the quantization divides back out.
+constexpr int CONST_BITS = 13;
+constexpr int PASS1_BITS = 2;
+constexpr int32_t FIX_0_298631336 = 2446;
+constexpr int32_t FIX_0_390180644 = 3196;
+constexpr int32_t FIX_0_541196100 = 4433;
+constexpr int32_t FIX_0_765366865 = 6270;
+constexpr int32_t FIX_0_899976223 = 7373;
+constexpr int32_t FIX_1_175875602 = 9633;
+constexpr int32_t FIX_1_501321110 = 12299;
+constexpr int32_t FIX_1_847759065 = 15137;
+constexpr int32_t FIX_1_961570560 = 16069;
+constexpr int32_t FIX_2_053119869 = 16819;
+constexpr int32_t FIX_2_562915447 = 20995;
+constexpr int32_t FIX_3_072711026 = 25172;
+
+// DCT and quantization of one 8x8 block of level shifted samples in place,
+// reciprocal holds 1 / (8 * quant) in natural order
+typedef void (*TransformFunc)(int32_t* block, const float* reciprocal);
+
+inline int32_t descale(int32_t x, int n) {
+    return (x + (1 << (n - 1))) >> n;
+}
+
+// One 1-D pass over the 8 lines of a block. Sample k of line i sits at
+// block[i * lineStep + k * sampleStep], rows first then columns.
+void fdctPassScalar(int32_t* block, int lineStep, int sampleStep, bool rows) {
+    const int shift = rows ? CONST_BITS - PASS1_BITS : CONST_BITS + PASS1_BITS;
+    for (int i = 0; i < 8; i++) {
+        int32_t* d = block + i * lineStep;
+        int32_t tmp0 = d[0 * sampleStep] + d[7 * sampleStep];
+        int32_t tmp7 = d[0 * sampleStep] - d[7 * sampleStep];
+        int32_t tmp1 = d[1 * sampleStep] + d[6 * sampleStep];
+        int32_t tmp6 = d[1 * sampleStep] - d[6 * sampleStep];
+        int32_t tmp2 = d[2 * sampleStep] + d[5 * sampleStep];
+        int32_t tmp5 = d[2 * sampleStep] - d[5 * sampleStep];
+        int32_t tmp3 = d[3 * sampleStep] + d[4 * sampleStep];
+        int32_t tmp4 = d[3 * sampleStep] - d[4 * sampleStep];
+
+        int32_t tmp10 = tmp0 + tmp3;
+        int32_t tmp13 = tmp0 - tmp3;
+        int32_t tmp11 = tmp1 + tmp2;
+        int32_t tmp12 = tmp1 - tmp2;
+        if (rows) {
+            d[0 * sampleStep] = (tmp10 + tmp11) << PASS1_BITS;
+            d[4 * sampleStep] = (tmp10 - tmp11) << PASS1_BITS;
+        } else {
+            d[0 * sampleStep] = descale(tmp10 + tmp11, PASS1_BITS);
+            d[4 * sampleStep] = descale(tmp10 - tmp11, PASS1_BITS);
+        }
+        int32_t z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        d[2 * sampleStep] = descale(z1 + tmp13 * FIX_0_765366865, shift);
+        d[6 * sampleStep] = descale(z1 - tmp12 * FIX_1_847759065, shift);
+
+        z1 = tmp4 + tmp7;
+        int32_t z2 = tmp5 + tmp6;
+        int32_t z3 = tmp4 + tmp6;
+        int32_t z4 = tmp5 + tmp7;
+        int32_t z5 = (z3 + z4) * FIX_1_175875602;
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+        d[7 * sampleStep] = descale(tmp4 + z1 + z3, shift);
+        d[5 * sampleStep] = descale(tmp5 + z2 + z4, shift);
+        d[3 * sampleStep] = descale(tmp6 + z2 + z3, shift);
+        d[1 * sampleStep] = descale(tmp7 + z1 + z4, shift);
+    }
+}
+
+void transformScalar(int32_t* block, const float* reciprocal) {
+    fdctPassScalar(block, 8, 1, true);
+    fdctPassScalar(block, 1, 8, false);
+    // round to nearest even, the same as the vector path
+    for (int i = 0; i < 64; i++)
+        block[i] = (int32_t)lrintf((float)block[i] * reciprocal[i]);
+}
+
+#if __riscv_vector
+inline vint32m2_t descaleRVV(vint32m2_t x, int n, size_t vl) {
+    return vsra_vx_i32m2(vadd_vx_i32m2(x, 1 << (n - 1), vl), n, vl);
+}
+
+// The scalar pass with the 8 lines in the 8 lanes of a vector: for the row
+// pass sample k of every row is a strided load down column k, for the
+// column pass it is row k loaded as is.
+void fdctPassRVV(int32_t* block, int lineStep, int sampleStep, bool rows) {
+    const size_t vl = 8;
+    const ptrdiff_t stride = lineStep * sizeof(int32_t);
+    const int shift = rows ? CONST_BITS - PASS1_BITS : CONST_BITS + PASS1_BITS;
+    int32_t* d = block;
+    vint32m2_t d0 = vlse32_v_i32m2(d + 0 * sampleStep, stride, vl);
+    vint32m2_t d1 = vlse32_v_i32m2(d + 1 * sampleStep, stride, vl);
+    vint32m2_t d2 = vlse32_v_i32m2(d + 2 * sampleStep, stride, vl);
+    vint32m2_t d3 = vlse32_v_i32m2(d + 3 * sampleStep, stride, vl);
+    vint32m2_t d4 = vlse32_v_i32m2(d + 4 * sampleStep, stride, vl);
+    vint32m2_t d5 = vlse32_v_i32m2(d + 5 * sampleStep, stride, vl);
+    vint32m2_t d6 = vlse32_v_i32m2(d + 6 * sampleStep, stride, vl);
+    vint32m2_t d7 = vlse32_v_i32m2(d + 7 * sampleStep, stride, vl);
+
+    vint32m2_t tmp0 = vadd_vv_i32m2(d0, d7, vl);
+    vint32m2_t tmp7 = vsub_vv_i32m2(d0, d7, vl);
+    vint32m2_t tmp1 = vadd_vv_i32m2(d1, d6, vl);
+    vint32m2_t tmp6 = vsub_vv_i32m2(d1, d6, vl);
+    vint32m2_t tmp2 = vadd_vv_i32m2(d2, d5, vl);
+    vint32m2_t tmp5 = vsub_vv_i32m2(d2, d5, vl);
+    vint32m2_t tmp3 = vadd_vv_i32m2(d3, d4, vl);
+    vint32m2_t tmp4 = vsub_vv_i32m2(d3, d4, vl);
+
+    vint32m2_t tmp10 = vadd_vv_i32m2(tmp0, tmp3, vl);
+    vint32m2_t tmp13 = vsub_vv_i32m2(tmp0, tmp3, vl);
+    vint32m2_t tmp11 = vadd_vv_i32m2(tmp1, tmp2, vl);
+    vint32m2_t tmp12 = vsub_vv_i32m2(tmp1, tmp2, vl);
+    vint32m2_t out0 = vadd_vv_i32m2(tmp10, tmp11, vl);
+    vint32m2_t out4 = vsub_vv_i32m2(tmp10, tmp11, vl);
+    if (rows) {
+        out0 = vsll_vx_i32m2(out0, PASS1_BITS, vl);
+        out4 = vsll_vx_i32m2(out4, PASS1_BITS, vl);
+    } else {
+        out0 = descaleRVV(out0, PASS1_BITS, vl);
+        out4 = descaleRVV(out4, PASS1_BITS, vl);
+    }
+    vint32m2_t z1 = vmul_vx_i32m2(vadd_vv_i32m2(tmp12, tmp13, vl), FIX_0_541196100, vl);
+    vint32m2_t out2 = descaleRVV(vmacc_vx_i32m2(z1, FIX_0_765366865, tmp13, vl), shift, vl);
+    vint32m2_t out6 = descaleRVV(vmacc_vx_i32m2(z1, -FIX_1_847759065, tmp12, vl), shift, vl);
+
+    z1 = vadd_vv_i32m2(tmp4, tmp7, vl);
+    vint32m2_t z2 = vadd_vv_i32m2(tmp5, tmp6, vl);
+    vint32m2_t z3 = vadd_vv_i32m2(tmp4, tmp6, vl);
+    vint32m2_t z4 = vadd_vv_i32m2(tmp5, tmp7, vl);
+    vint32m2_t z5 = vmul_vx_i32m2(vadd_vv_i32m2(z3, z4, vl), FIX_1_175875602, vl);
+    tmp4 = vmul_vx_i32m2(tmp4, FIX_0_298631336, vl);
+    tmp5 = vmul_vx_i32m2(tmp5, FIX_2_053119869, vl);
+    tmp6 = vmul_vx_i32m2(tmp6, FIX_3_072711026, vl);
+    tmp7 = vmul_vx_i32m2(tmp7, FIX_1_501321110, vl);
+    z1 = vmul_vx_i32m2(z1, -FIX_0_899976223, vl);
+    z2 = vmul_vx_i32m2(z2, -FIX_2_562915447, vl);
+    z3 = vmacc_vx_i32m2(z5, -FIX_1_961570560, z3, vl);
+    z4 = vmacc_vx_i32m2(z5, -FIX_0_390180644, z4, vl);
+    vint32m2_t out7 = descaleRVV(vadd_vv_i32m2(vadd_vv_i32m2(tmp4, z1, vl), z3, vl), shift, vl);
+    vint32m2_t out5 = descaleRVV(vadd_vv_i32m2(vadd_vv_i32m2(tmp5, z2, vl), z4, vl), shift, vl);
+    vint32m2_t out3 = descaleRVV(vadd_vv_i32m2(vadd_vv_i32m2(tmp6, z2, vl), z3, vl), shift, vl);
+    vint32m2_t out1 = descaleRVV(vadd_vv_i32m2(vadd_vv_i32m2(tmp7, z1, vl), z4, vl), shift, vl);
+
+    vsse32_v_i32m2(d + 0 * sampleStep, stride, out0, vl);
+    vsse32_v_i32m2(d + 1 * sampleStep, stride, out1, vl);
+    vsse32_v_i32m2(d + 2 * sampleStep, stride, out2, vl);
+    vsse32_v_i32m2(d + 3 * sampleStep, stride, out3, vl);
+    vsse32_v_i32m2(d + 4 * sampleStep, stride, out4, vl);
+    vsse32_v_i32m2(d + 5 * sampleStep, stride, out5, vl);
+    vsse32_v_i32m2(d + 6 * sampleStep, stride, out6, vl);
+    vsse32_v_i32m2(d + 7 * sampleStep, stride, out7, vl);
+}
+
+void transformRVV(int32_t* block, const float* reciprocal) {
+    fdctPassRVV(block, 8, 1, true);
+    fdctPassRVV(block, 1, 8, false);
+    // vfcvt.x.f rounds with frm, round to nearest even unless someone changed it
+    int n = 64;
+    while (n > 0) {
+        size_t vl = vsetvl_e32m8(n);
+        vfloat32m8_t coef = vfcvt_f_x_v_f32m8(vle32_v_i32m8(block, vl), vl);
+        vfloat32m8_t scaled = vfmul_vv_f32m8(coef, vle32_v_f32m8(reciprocal, vl), vl);
+        vse32_v_i32m8(block, vfcvt_x_f_v_i32m8(scaled, vl), vl);
+        block += vl;
+        reciprocal += vl;
+        n -= vl;
+    }
+}
+#endif
+
+struct HuffmanTable {
+    uint16_t code[256];
+    uint8_t size[256];
+};
+
+void buildHuffmanTable(const uint8_t* bits, const uint8_t* values, HuffmanTable& table) {
+    memset(&table, 0, sizeof(table));
+    int code = 0;
+    int k = 0;
+    for (int length = 1; length <= 16; length++) {
+        for (int i = 0; i < bits[length - 1]; i++, k++) {
+            table.code[values[k]] = (uint16_t)code++;
+            table.size[values[k]] = (uint8_t)length;
+        }
+        code <<= 1;
+    }
+}
+
+// Entropy coded segment writer, 0xFF bytes get a 0x00 stuffed after them.
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void put(uint32_t code, int size) {
+        acc = (acc << size) | code;
+        bits += size;
+        while (bits >= 8) {
+            bits -= 8;
+            uint8_t byte = (uint8_t)(acc >> bits);
+            out.push_back(byte);
+            if (byte == 0xFF)
+                out.push_back(0);
+        }
+        acc &= (1u << bits) - 1;
+    }
+
+    // pad the last byte with ones
+    void flush() {
+        if (bits > 0)
+            put((1u << (8 - bits)) - 1, 8 - bits);
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint32_t acc = 0;
+    int bits = 0;
+};
+
+inline int magnitudeBits(int32_t value) {
+    uint32_t a = value < 0 ? -value : value;
+    return a ? 32 - __builtin_clz(a) : 0;
+}
+
+// Huffman code one quantized block. The zero runs come from a bit mask of
+// the nonzero AC coefficients in zigzag order, so the mostly empty high
+// frequencies cost nothing.
+void encodeBlock(BitWriter& writer, const int32_t* block, int32_t& lastDC,
+                 const HuffmanTable& dc, const HuffmanTable& ac) {
+    int32_t diff = block[0] - lastDC;
+    lastDC = block[0];
+    int size = magnitudeBits(diff);
+    writer.put(dc.code[size], dc.size[size]);
+    if (size)
+        writer.put((diff < 0 ? diff - 1 : diff) & ((1u << size) - 1), size);
+
+    uint64_t nonzero = 0;
+    for (int k = 1; k < 64; k++)
+        nonzero |= (uint64_t)(block[ZIGZAG[k]] != 0) << k;
+    int next = 1;
+    while (nonzero) {
+        int k = __builtin_ctzll(nonzero);
+        nonzero &= nonzero - 1;
+        int run = k - next;
+        for (; run > 15; run -= 16)
+            writer.put(ac.code[0xF0], ac.size[0xF0]);
+        int32_t value = block[ZIGZAG[k]];
+        size = magnitudeBits(value);
+        int symbol = (run << 4) | size;
+        writer.put(ac.code[symbol], ac.size[symbol]);
+        writer.put((value < 0 ? value - 1 : value) & ((1u << size) - 1), size);
+        next = k + 1;
+    }
+    if (next < 64)
+        writer.put(ac.code[0x00], ac.size[0x00]);
+}
+
+// A plane as the blocks see it, every output sample the mean of scale x
+// scale source samples
+struct Plane {
+    const uint8_t* data;
+    int stride;
+    int step;           // bytes between two samples of a row
+    int width;          // in source samples
+    int height;
+    int scale;
+    int outWidth;       // in output samples
+    int outHeight;
+};
+
+Plane makePlane(const uint8_t* data, int stride, int step, int width, int height, int scale) {
+    return Plane{ data, stride, step, width, height, scale, (width + scale - 1) / scale, (height + scale - 1) / scale };
+}
+
+// 8x8 output samples at x0, y0 of a plane minus 128, rows and columns past
+// the plane edge repeat the last one
+void loadBlock(const Plane& plane, int x0, int y0, int32_t* block) {
+    if (plane.scale == 1) {
+        for (int r = 0; r < 8; r++) {
+            const uint8_t* row = plane.data + (size_t)std::min(y0 + r, plane.height - 1) * plane.stride;
+            int32_t* out = block + r * 8;
+            if (x0 + 8 <= plane.width) {
+                const uint8_t* p = row + (size_t)x0 * plane.step;
+                for (int c = 0; c < 8; c++)
+                    out[c] = (int32_t)p[c * plane.step] - 128;
+            } else {
+                for (int c = 0; c < 8; c++)
+                    out[c] = (int32_t)row[(size_t)std::min(x0 + c, plane.width - 1) * plane.step] - 128;
+            }
+        }
+        return;
+    }
+    const int scale = plane.scale;
+    const int area = scale * scale;
+    for (int r = 0; r < 8; r++) {
+        const int sy = std::min(y0 + r, plane.outHeight - 1) * scale;
+        for (int c = 0; c < 8; c++) {
+            const int sx = std::min(x0 + c, plane.outWidth - 1) * scale;
+            int sum = 0;
+            for (int dy = 0; dy < scale; dy++) {
+                const uint8_t* row = plane.data + (size_t)std::min(sy + dy, plane.height - 1) * plane.stride;
+                for (int dx = 0; dx < scale; dx++)
+                    sum += row[(size_t)std::min(sx + dx, plane.width - 1) * plane.step];
+            }
+            block[r * 8 + c] = (sum + area / 2) / area - 128;
+        }
+    }
+}
+
+// libjpeg's quality scaling of the Annex K tables
+void scaleQuantTable(const uint8_t* base, int quality, uint8_t* table, float* reciprocal) {
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int i = 0; i < 64; i++) {
+        int q = std::min(std::max((base[i] * scale + 50) / 100, 1), 255);
+        table[i] = (uint8_t)q;
+        reciprocal[i] = 1.0f / (q * 8);
+    }
+}
+
+void putMarker(std::vector<uint8_t>& out, uint8_t marker, int length) {
+    out.push_back(0xFF);
+    out.push_back(marker);
+    if (length > 0) {
+        out.push_back((uint8_t)(length >> 8));
+        out.push_back((uint8_t)length);
+    }
+}
+
+void putHuffmanTable(std::vector<uint8_t>& out, uint8_t id, const uint8_t* bits, const uint8_t* values) {
+    int count = 0;
+    out.push_back(id);
+    for (int i = 0; i < 16; i++) {
+        out.push_back(bits[i]);
+        count += bits[i];
+    }
+    out.insert(out.end(), values, values + count);
+}
+
+void writeHeaders(std::vector<uint8_t>& out, int width, int height, bool gray, int restartInterval,
+                  const uint8_t* lumaQuant, const uint8_t* chromaQuant) {
+    putMarker(out, 0xD8, 0);
+
+    static const uint8_t JFIF[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    putMarker(out, 0xE0, 2 + sizeof(JFIF));
+    out.insert(out.end(), JFIF, JFIF + sizeof(JFIF));
+
+    putMarker(out, 0xDB, 2 + (gray ? 1 : 2) * 65);
+    out.push_back(0);
+    for (int k = 0; k < 64; k++)
+        out.push_back(lumaQuant[ZIGZAG[k]]);
+    if (!gray) {
+        out.push_back(1);
+        for (int k = 0; k < 64; k++)
+            out.push_back(chromaQuant[ZIGZAG[k]]);
+    }
+
+    // Y sampled 2x2, Cb and Cr 1x1 with the second table, or Y alone
+    const uint8_t sof[] = {
+        8, (uint8_t)(height >> 8), (uint8_t)height, (uint8_t)(width >> 8), (uint8_t)width,
+        (uint8_t)(gray ? 1 : 3), 1, (uint8_t)(gray ? 0x11 : 0x22), 0, 2, 0x11, 1, 3, 0x11, 1,
+    };
+    const size_t sofSize = gray ? 9 : sizeof(sof);
+    putMarker(out, 0xC0, 2 + sofSize);
+    out.insert(out.end(), sof, sof + sofSize);
+
+    putMarker(out, 0xC4, 2 + (gray ? 1 : 2) * (2 * 17 + 12 + 162));
+    putHuffmanTable(out, 0x00, DC_LUMA_BITS, DC_VALUES);
+    putHuffmanTable(out, 0x10, AC_LUMA_BITS, AC_LUMA_VALUES);
+    if (!gray) {
+        putHuffmanTable(out, 0x01, DC_CHROMA_BITS, DC_VALUES);
+        putHuffmanTable(out, 0x11, AC_CHROMA_BITS, AC_CHROMA_VALUES);
+    }
+
+    if (restartInterval > 0) {
+        putMarker(out, 0xDD, 4);
+        out.push_back((uint8_t)(restartInterval >> 8));
+        out.push_back((uint8_t)restartInterval);
+    }
+
+    static const uint8_t sos[] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    static const uint8_t graySos[] = { 1, 1, 0x00, 0, 63, 0 };
+    putMarker(out, 0xDA, 2 + (gray ? sizeof(graySos) : sizeof(sos)));
+    if (gray)
+        out.insert(out.end(), graySos, graySos + sizeof(graySos));
+    else
+        out.insert(out.end(), sos, sos + sizeof(sos));
+}
+
+// With a sink, jpeg only holds what was not handed to it yet.
+bool encode(TransformFunc transform, const Yuv420Image& image, const YuvJpegParams& params,
+            const JpegChunkSink* sink, std::vector<uint8_t>& jpeg) {
+    const int width = image.width;
+    const int height = image.height;
+    const int chromaWidth = (width + 1) / 2;
+    const int chromaHeight = (height + 1) / 2;
+    const bool gray = params.gray;
+    if (!image.y || width <= 0 || height <= 0 || width > 65535 || height > 65535 || image.strideY < width)
+        return false;
+    if (!gray && (!image.u || !image.v || image.chromaStep < 1
+                  || image.strideUV < (chromaWidth - 1) * image.chromaStep + 1))
+        return false;
+    const int scale = params.downscale >= 4 ? 4 : params.downscale >= 2 ? 2 : 1;
+    const int quality = std::min(std::max(params.quality, 1), 100);
+    const int restartInterval = std::min(std::max(params.restartInterval, 0), 65535);
+
+    uint8_t lumaQuant[64];
+    uint8_t chromaQuant[64];
+    float lumaReciprocal[64];
+    float chromaReciprocal[64];
+    scaleQuantTable(LUMA_QUANT, quality, lumaQuant, lumaReciprocal);
+    scaleQuantTable(CHROMA_QUANT, quality, chromaQuant, chromaReciprocal);
+    HuffmanTable dcLuma, acLuma, dcChroma, acChroma;
+    buildHuffmanTable(DC_LUMA_BITS, DC_VALUES, dcLuma);
+    buildHuffmanTable(AC_LUMA_BITS, AC_LUMA_VALUES, acLuma);
+    buildHuffmanTable(DC_CHROMA_BITS, DC_VALUES, dcChroma);
+    buildHuffmanTable(AC_CHROMA_BITS, AC_CHROMA_VALUES, acChroma);
+
+    const Plane luma = makePlane(image.y, image.strideY, 1, width, height, scale);
+    const Plane cb = makePlane(image.u, image.strideUV, image.chromaStep, chromaWidth, chromaHeight, scale);
+    const Plane cr = makePlane(image.v, image.strideUV, image.chromaStep, chromaWidth, chromaHeight, scale);
+    jpeg.clear();
+    jpeg.reserve(sink ? 64 << 10 : (size_t)luma.outWidth * luma.outHeight / 2 + 1024);
+    writeHeaders(jpeg, luma.outWidth, luma.outHeight, gray, restartInterval, lumaQuant, chromaQuant);
+
+    BitWriter writer(jpeg);
+    int32_t lastY = 0, lastU = 0, lastV = 0;
+    int32_t block[64];
+    // a gray MCU is one block
+    const int mcuSize = gray ? 8 : 16;
+    int mcu = 0;
+    int restarts = 0;
+    for (int my = 0; my < luma.outHeight; my += mcuSize) {
+        for (int mx = 0; mx < luma.outWidth; mx += mcuSize) {
+            if (restartInterval > 0 && mcu > 0 && mcu % restartInterval == 0) {
+                // byte align, mark and start the DC predictions over
+                writer.flush();
+                putMarker(jpeg, 0xD0 + (restarts++ & 7), 0);
+                lastY = lastU = lastV = 0;
+                if (sink) {
+                    if (!(*sink)(jpeg.data(), jpeg.size()))
+                        return false;
+                    jpeg.clear();
+                }
+            }
+            mcu++;
+            if (gray) {
+                loadBlock(luma, mx, my, block);
+                transform(block, lumaReciprocal);
+                encodeBlock(writer, block, lastY, dcLuma, acLuma);
+                continue;
+            }
+            for (int i = 0; i < 4; i++) {
+                loadBlock(luma, mx + (i & 1) * 8, my + (i >> 1) * 8, block);
+                transform(block, lumaReciprocal);
+                encodeBlock(writer, block, lastY, dcLuma, acLuma);
+            }
+            loadBlock(cb, mx / 2, my / 2, block);
+            transform(block, chromaReciprocal);
+            encodeBlock(writer, block, lastU, dcChroma, acChroma);
+            loadBlock(cr, mx / 2, my / 2, block);
+            transform(block, chromaReciprocal);
+            encodeBlock(writer, block, lastV, dcChroma, acChroma);
+        }
+    }
+    writer.flush();
+    putMarker(jpeg, 0xD9, 0);
+    if (sink) {
+        if (!(*sink)(jpeg.data(), jpeg.size()))
+            return false;
+        jpeg.clear();
+    }
+    return true;
+}
+
+TransformFunc selectTransform() {
+#if __riscv_vector
+    // the DCT keeps a block line per lane, 8 lanes of 32 bits in m2
+    if (vsetvl_e32m2(8) == 8)
+        return transformRVV;
+#endif
+    return transformScalar;
+}
+
+} // namespace
+
+bool encodeYuv420JpegScalar(const Yuv420Image& image, const YuvJpegParams& params, std::vector<uint8_t>& jpeg) {
+    return encode(transformScalar, image, params, nullptr, jpeg);
+}
+
+bool encodeYuv420Jpeg(const Yuv420Image& image, const YuvJpegParams& params, std::vector<uint8_t>& jpeg) {
+    return encode(selectTransform(), image, params, nullptr, jpeg);
+}
+
+bool encodeYuv420Jpeg(const Yuv420Image& image, const YuvJpegParams& params, const JpegChunkSink& sink) {
+    std::vector<uint8_t> pending;
+    return encode(selectTransform(), image, params, &sink, pending);
+}
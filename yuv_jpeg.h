@@ -0,0 +1,50 @@
+#ifndef YUV_JPEG_H
+#define YUV_JPEG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// A YUV 4:2:0 image in caller memory, semi-planar (NV21, NV12) or planar
+// (I420, YV12), any strides. u and v point at the first sample of each
+// chroma plane, for semi-planar input both point into the same rows one
+// byte apart and chromaStep is 2.
+struct Yuv420Image {
+    const uint8_t* y = nullptr;
+    int strideY = 0;
+    const uint8_t* u = nullptr;
+    const uint8_t* v = nullptr;
+    int strideUV = 0;
+    int chromaStep = 1;
+    int width = 0;
+    int height = 0;
+};
+
+struct YuvJpegParams {
+    int quality = 95;           // 1..100
+    int downscale = 1;          // 1, 2 or 4 per side, box filtered
+    bool gray = false;          // luma only, u and v of the image are not read
+    int restartInterval = 0;    // MCUs between restart markers, 0 for none
+};
+
+// Baseline JPEG straight from YUV 4:2:0, without a round trip through BGR.
+// The samples go into 16x16 MCUs as they are, with the standard Annex K
+// quantization tables scaled for quality and the standard Huffman tables.
+// Edges are padded by repeating the last row and column. The forward DCT
+// and quantization use RVV when the build has it.
+bool encodeYuv420Jpeg(const Yuv420Image& image, const YuvJpegParams& params, std::vector<uint8_t>& jpeg);
+
+// Receives the file piece by piece in order, false stops the encode.
+typedef std::function<bool(const uint8_t* data, size_t size)> JpegChunkSink;
+
+// The same handed out in pieces while it is being encoded. Every restart
+// interval the entropy coded data is closed with a restart marker and
+// everything up to it goes to sink, so a consumer can send the start of the
+// file before the end is encoded. Without restarts sink gets one piece.
+bool encodeYuv420Jpeg(const Yuv420Image& image, const YuvJpegParams& params, const JpegChunkSink& sink);
+
+// Portable version of the above, also used when the build has no RVV.
+bool encodeYuv420JpegScalar(const Yuv420Image& image, const YuvJpegParams& params, std::vector<uint8_t>& jpeg);
+
+#endif // YUV_JPEG_H